@@ -0,0 +1,349 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/HuffmanEncoder.h"
+#include "../src/Sha256.h"
+#include "../src/BitCollector.h"
+#include "../src/Digest.h"
+
+/// <summary>
+/// Private members of HuffmanEncoder measured by the benchmarks.
+/// </summary>
+class HuffmanBenchmark
+{
+public:
+	using FrequencyContainer = HuffmanEncoder::FrequencyContainer;
+
+	static auto GetFrequencyAndHash(const uint8_t* first, const uint8_t* last, const HuffmanEncoder::EncodeOptions& options)
+	{
+		HuffmanEncoder::Progress progress;
+		return HuffmanEncoder::GetFrequencyAndHash(first, last, options, progress);
+	}
+
+	static auto GetFrequency(const uint8_t* first, const uint8_t* last)
+	{
+		return HuffmanEncoder::GetFrequency(first, last);
+	}
+
+	static auto GenerateTreeFromFrequency(const FrequencyContainer& frequency)
+	{
+		return HuffmanEncoder::GenerateTreeFromFrequency(frequency);
+	}
+};
+
+namespace
+{
+	/// <summary>
+	/// Synthetic sources of distinct statistics.
+	/// </summary>
+	enum class Corpus
+	{
+		Uniform,      ///< Random bytes, incompressible.
+		Skewed,       ///< Geometrically distributed bytes, a few characters dominate.
+		Text,         ///< Words of a small vocabulary by Zipf's law, with spaces and line breaks.
+		Binary,       ///< Records of little endian integers, counters and zero padding.
+		SingleSymbol, ///< One character repeated.
+	};
+
+	constexpr std::array<Corpus, 5> kCorpora{
+		Corpus::Uniform, Corpus::Skewed, Corpus::Text, Corpus::Binary, Corpus::SingleSymbol
+	};
+
+	constexpr std::array<size_t, 3> kSizes{64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+
+	auto CorpusName(const Corpus corpus) -> const char*
+	{
+		switch (corpus)
+		{
+		case Corpus::Uniform:
+			return "uniform";
+		case Corpus::Skewed:
+			return "skewed";
+		case Corpus::Text:
+			return "text";
+		case Corpus::Binary:
+			return "binary";
+		case Corpus::SingleSymbol:
+			return "single";
+		}
+		return "";
+	}
+
+	auto GenerateCorpus(const Corpus corpus, const size_t length) -> std::vector<uint8_t>
+	{
+		std::mt19937_64 random(length);
+		std::vector<uint8_t> source;
+		source.reserve(length);
+		switch (corpus)
+		{
+		case Corpus::Uniform:
+			while (source.size() < length)
+			{
+				source.push_back(static_cast<uint8_t>(random()));
+			}
+			break;
+		case Corpus::Skewed:
+		{
+			std::geometric_distribution<int> distribution(0.2);
+			while (source.size() < length)
+			{
+				source.push_back(static_cast<uint8_t>('a' + distribution(random) % 64));
+			}
+			break;
+		}
+		case Corpus::Text:
+		{
+			static const std::array<const char*, 16> kWords{
+				"the", "of", "and", "to", "a", "in", "is", "that",
+				"huffman", "encoder", "stream", "block", "table", "digest", "frequency", "canonical"
+			};
+			std::array<double, kWords.size()> weights{};
+			for (size_t i{}; i < weights.size(); ++i)
+			{
+				weights[i] = 1.0 / static_cast<double>(i + 1);
+			}
+			std::discrete_distribution<size_t> distribution(weights.begin(), weights.end());
+			size_t lineLength{};
+			while (source.size() < length)
+			{
+				for (auto word = kWords[distribution(random)]; *word; ++word)
+				{
+					source.push_back(static_cast<uint8_t>(*word));
+				}
+				lineLength = random() % 12 ? lineLength + 1 : 0;
+				source.push_back(lineLength ? ' ' : '\n');
+			}
+			source.resize(length);
+			break;
+		}
+		case Corpus::Binary:
+		{
+			uint32_t counter{};
+			while (source.size() < length)
+			{
+				const uint32_t fields[]{counter++, static_cast<uint32_t>(random() % 1000), 0, 0xdeadbeef};
+				for (const auto field : fields)
+				{
+					for (size_t i{}; i < sizeof(field); ++i)
+					{
+						source.push_back(static_cast<uint8_t>(field >> (8 * i)));
+					}
+				}
+			}
+			source.resize(length);
+			break;
+		}
+		case Corpus::SingleSymbol:
+			source.assign(length, 'a');
+			break;
+		}
+		return source;
+	}
+
+	/// <summary>
+	/// Corpora are generated once and shared by all benchmarks.
+	/// </summary>
+	auto GetCorpus(const Corpus corpus, const size_t length) -> const std::vector<uint8_t>&
+	{
+		static std::map<std::pair<Corpus, size_t>, std::vector<uint8_t>> corpora;
+		auto found = corpora.find({corpus, length});
+		if (found == corpora.end())
+		{
+			found = corpora.emplace(std::make_pair(corpus, length), GenerateCorpus(corpus, length)).first;
+		}
+		return found->second;
+	}
+
+	/// <summary>
+	/// Report MB/s and time per byte (printed in ns) of length bytes per iteration.
+	/// </summary>
+	auto SetThroughput(benchmark::State& state, const size_t length) -> void
+	{
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * length));
+		state.counters["time/byte"] = benchmark::Counter(static_cast<double>(length),
+		                                                 benchmark::Counter::kIsIterationInvariantRate |
+		                                                 benchmark::Counter::kInvert);
+	}
+
+	auto BenchmarkEncode(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		const std::string content(source.begin(), source.end());
+		for (auto _ : state)
+		{
+			std::istringstream input(content);
+			std::ostringstream output;
+			HuffmanEncoder::Encode(input, output, {});
+			benchmark::DoNotOptimize(output);
+		}
+		SetThroughput(state, source.size());
+	}
+
+	auto BenchmarkDecode(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		std::istringstream input(std::string(source.begin(), source.end()));
+		std::ostringstream encoded;
+		HuffmanEncoder::Encode(input, encoded, {});
+		const auto content = encoded.str();
+		for (auto _ : state)
+		{
+			std::istringstream encodedInput(content);
+			std::ostringstream output;
+			HuffmanEncoder::Decode(encodedInput, output, {});
+			benchmark::DoNotOptimize(output);
+		}
+		SetThroughput(state, source.size());
+	}
+
+	auto BenchmarkEncodeBuffer(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize = 1024 * 1024;
+		std::vector<uint8_t> output(HuffmanEncoder::EncodeBound(source.size(), options));
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(
+				HuffmanEncoder::EncodeBuffer(source.data(), source.size(), output.data(), output.size(), options));
+		}
+		SetThroughput(state, source.size());
+	}
+
+	auto BenchmarkDecodeBuffer(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize = 1024 * 1024;
+		std::vector<uint8_t> encoded(HuffmanEncoder::EncodeBound(source.size(), options));
+		encoded.resize(
+			HuffmanEncoder::EncodeBuffer(source.data(), source.size(), encoded.data(), encoded.size(), options));
+		std::vector<uint8_t> output(HuffmanEncoder::DecodeBound(encoded.data(), encoded.size()));
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(
+				HuffmanEncoder::DecodeBuffer(encoded.data(), encoded.size(), output.data(), output.size(), {}));
+		}
+		SetThroughput(state, source.size());
+	}
+
+	auto BenchmarkFrequencyAndHash(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(
+				HuffmanBenchmark::GetFrequencyAndHash(source.data(), source.data() + source.size(), {}));
+		}
+		SetThroughput(state, source.size());
+	}
+
+	/// <summary>
+	/// Tree build doesn't depend on the length of source, so symbols per second are reported instead.
+	/// </summary>
+	auto BenchmarkTreeBuild(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		const auto frequency = HuffmanBenchmark::GetFrequency(source.data(), source.data() + source.size());
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(HuffmanBenchmark::GenerateTreeFromFrequency(frequency));
+		}
+		state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * frequency.size()));
+	}
+
+	/// <summary>
+	/// Push codes of 1 to 12 bits, the lengths the default encode options produce.
+	/// Throughput is of the bytes collected.
+	/// </summary>
+	auto BenchmarkBitCollector(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		std::vector<uint8_t> buffer;
+		buffer.reserve(source.size() * 2);
+		for (auto _ : state)
+		{
+			buffer.clear();
+			BitCollector collector(buffer);
+			for (const auto character : source)
+			{
+				collector.Push(static_cast<unsigned int>(character), 0, character % 12 + 1);
+			}
+			benchmark::DoNotOptimize(buffer.data());
+		}
+		SetThroughput(state, source.size());
+	}
+
+	auto BenchmarkPicosha2(benchmark::State& state, const std::vector<uint8_t>& source) -> void
+	{
+		std::vector<unsigned char> digest(picosha2::k_digest_size);
+		for (auto _ : state)
+		{
+			picosha2::hash256(source.begin(), source.end(), digest.begin(), digest.end());
+			benchmark::DoNotOptimize(digest.data());
+		}
+		SetThroughput(state, source.size());
+	}
+
+	auto BenchmarkDigest(benchmark::State& state, const std::vector<uint8_t>& source, const Digest::Algorithm algorithm)
+	-> void
+	{
+		for (auto _ : state)
+		{
+			benchmark::DoNotOptimize(Digest::Compute(algorithm, source.data(), source.data() + source.size()));
+		}
+		SetThroughput(state, source.size());
+	}
+}
+
+/// <summary>
+/// Every benchmark runs over every corpus at every size, named like Encode/text/1048576.
+/// </summary>
+int main(int argc, char** argv)
+{
+	using Benchmark = void (*)(benchmark::State&, const std::vector<uint8_t>&);
+	const std::pair<const char*, Benchmark> benchmarks[]{
+		{"Encode", BenchmarkEncode},
+		{"Decode", BenchmarkDecode},
+		{"EncodeBuffer", BenchmarkEncodeBuffer},
+		{"DecodeBuffer", BenchmarkDecodeBuffer},
+		{"FrequencyAndHash", BenchmarkFrequencyAndHash},
+		{"TreeBuild", BenchmarkTreeBuild},
+		{"BitCollector", BenchmarkBitCollector},
+		{"Picosha2", BenchmarkPicosha2},
+	};
+	const Digest::Algorithm algorithms[]{
+		Digest::Algorithm::Sha256, Digest::Algorithm::Sha256Tree, Digest::Algorithm::Crc32c, Digest::Algorithm::XxHash64
+	};
+
+	for (const auto size : kSizes)
+	{
+		for (const auto corpus : kCorpora)
+		{
+			const auto suffix = std::string("/") + CorpusName(corpus) + "/" + std::to_string(size);
+			for (const auto& [name, function] : benchmarks)
+			{
+				benchmark::RegisterBenchmark((name + suffix).c_str(), [function = function, corpus, size](benchmark::State& state)
+				{
+					function(state, GetCorpus(corpus, size));
+				})->Unit(benchmark::kMicrosecond);
+			}
+			for (const auto algorithm : algorithms)
+			{
+				benchmark::RegisterBenchmark((std::string("Digest/") + Digest::Name(algorithm) + suffix).c_str(),
+				                             [algorithm, corpus, size](benchmark::State& state)
+				{
+					BenchmarkDigest(state, GetCorpus(corpus, size), algorithm);
+				})->Unit(benchmark::kMicrosecond);
+			}
+		}
+	}
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+	{
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
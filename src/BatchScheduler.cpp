@@ -0,0 +1,101 @@
+#include "pch.h"
+#include "BatchScheduler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+auto BatchScheduler::Run(const std::vector<uint64_t>& memory,
+                         const Options& options,
+                         const std::function<void(size_t)>& job) -> void
+{
+	const auto order = Order(memory);
+	std::mutex mutex;
+	std::condition_variable jobDone;
+	size_t orderPos{};
+	uint64_t memoryInFlight{};
+	size_t jobsInFlight{};
+	std::exception_ptr firstException;
+
+	const auto isCancelled = [&options]()
+	{
+		return options.m_Cancellation && options.m_Cancellation->load();
+	};
+	// Jobs start in order, the next one waits for room even if a smaller one after it would fit.
+	// Waiting needs a job in flight, whose end wakes the waiter.
+	const auto hasRoom = [&](const uint64_t jobMemory)
+	{
+		return 0 == jobsInFlight || 0 == options.m_MemoryBudget || memoryInFlight + jobMemory <= options.m_MemoryBudget;
+	};
+	const auto runWorker = [&]()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		while (true)
+		{
+			jobDone.wait(lock, [&]()
+			{
+				return orderPos == order.size() || isCancelled() || hasRoom(memory[order[orderPos]]);
+			});
+			if (orderPos == order.size() || isCancelled())
+			{
+				return;
+			}
+			const auto index     = order[orderPos++];
+			const auto jobMemory = memory[index];
+			memoryInFlight += jobMemory;
+			++jobsInFlight;
+
+			lock.unlock();
+			try
+			{
+				job(index);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> exceptionLock{mutex};
+				if (!firstException)
+				{
+					firstException = std::current_exception();
+				}
+			}
+			lock.lock();
+			memoryInFlight -= jobMemory;
+			--jobsInFlight;
+			jobDone.notify_all();
+		}
+	};
+
+	const auto workerCount = (std::min)(ThreadPool::ResolveThreadCount(options.m_WorkerCount), order.size());
+	std::vector<std::thread> workers;
+	for (size_t i{1}; i < workerCount; ++i)
+	{
+		workers.emplace_back(runWorker);
+	}
+	if (workerCount)
+	{
+		runWorker();
+	}
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	if (firstException)
+	{
+		std::rethrow_exception(firstException);
+	}
+}
+
+auto BatchScheduler::Order(const std::vector<uint64_t>& memory) -> std::vector<size_t>
+{
+	std::vector<size_t> order(memory.size());
+	std::iota(order.begin(), order.end(), size_t{});
+	std::stable_sort(order.begin(), order.end(), [&memory](const size_t left, const size_t right)
+	{
+		return memory[left] > memory[right];
+	});
+	return order;
+}
@@ -0,0 +1,50 @@
+#ifndef BATCH_SCHEDULER_H
+#define BATCH_SCHEDULER_H
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/// <summary>
+/// Runs the jobs of a batch on a pool of workers, the largest jobs first.
+/// Starting the largest jobs first keeps a long job from starting last while the other workers idle.
+/// </summary>
+class BatchScheduler
+{
+public:
+	/// <summary>
+	/// Options of a batch.
+	/// </summary>
+	struct Options
+	{
+		size_t m_WorkerCount{0};    ///< Jobs at once, 0 for the count of hardware threads.
+		uint64_t m_MemoryBudget{0}; ///< Memory of the jobs in flight at most, 0 for no limit.
+
+		/// <summary>
+		/// Polled before every job, once it is set the jobs not started yet are skipped.
+		/// </summary>
+		const std::atomic<bool>* m_Cancellation{nullptr};
+	};
+
+	/// <summary>
+	/// Run job(index) for every job and wait for all of them.
+	/// A job starts once the jobs in flight leave room for its memory in the budget,
+	/// a job larger than the whole budget runs alone.
+	/// </summary>
+	/// <param name="memory">Memory every job holds at most, like the length of its file, which orders the jobs</param>
+	/// <param name="options">Options of the batch</param>
+	/// <param name="job">Callable taking the index of job</param>
+	/// <returns>void, the first exception of jobs is rethrown once every started job is done</returns>
+	static auto Run(const std::vector<uint64_t>& memory,
+	                const Options& options,
+	                const std::function<void(size_t)>& job) -> void;
+
+	/// <summary>
+	/// Indexes of jobs from the largest to the smallest, jobs of equal memory keep their order.
+	/// </summary>
+	static auto Order(const std::vector<uint64_t>& memory) -> std::vector<size_t>;
+};
+
+#endif // BATCH_SCHEDULER_H
@@ -2,6 +2,8 @@
 #ifndef BIT_COLLECTOR_H
 #define BIT_COLLECTOR_H
 
+#include <climits>
+#include <cstdint>
 #include <vector>
 
 /// <summary>
@@ -0,0 +1,16 @@
+#include "pch.h"
+#include "BitWriter.h"
+
+auto BitWriter::Flush() -> void
+{
+	while (m_BitCount > CHAR_BIT)
+	{
+		*Extend(1) = static_cast<uint8_t>(m_Accumulator);
+		m_Accumulator >>= CHAR_BIT;
+		m_BitCount -= CHAR_BIT;
+	}
+}
+
+auto BitWriter::Unpacked() const noexcept -> uint8_t { return static_cast<uint8_t>(m_Accumulator); }
+
+auto BitWriter::RedundancyBit() const noexcept -> size_t { return m_BitCount; }
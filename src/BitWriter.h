@@ -0,0 +1,101 @@
+#pragma once
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+/// <summary>
+/// Generate a buffer from bit codes.
+/// Bits are collected in a 64-bit accumulator which is appended to the buffer a word at a time.
+/// The buffer is either a growing container or a fixed range of memory.
+/// </summary>
+class BitWriter
+{
+	using WordType = uint64_t;
+
+	constexpr static auto WordBit() -> size_t { return CHAR_BIT * sizeof(WordType); }
+
+public:
+	explicit BitWriter(std::vector<uint8_t>& container)
+		: m_Container(&container)
+	{
+	}
+
+	/// <summary>
+	/// Write into memory from first to last, pushing beyond last throws std::out_of_range.
+	/// </summary>
+	BitWriter(uint8_t* first, uint8_t* last)
+		: m_WritePos(first), m_WriteEnd(last)
+	{
+	}
+
+	/// <summary>
+	/// Append the low bitLength bits of value, the higher bits of value must be zero.
+	/// </summary>
+	/// <param name="value">Bits to append</param>
+	/// <param name="bitLength">Count of bits, 1 to 32</param>
+	/// <returns>void</returns>
+	auto Push(const WordType value, const size_t bitLength) -> void
+	{
+		m_Accumulator |= value << m_BitCount;
+		m_BitCount += bitLength;
+		if (m_BitCount >= WordBit())
+		{
+			PushWord(m_Accumulator);
+			m_BitCount -= WordBit();
+			m_Accumulator = m_BitCount ? value >> (bitLength - m_BitCount) : 0;
+		}
+	}
+
+	/// <summary>
+	/// Move the complete bytes of the accumulator into the buffer.
+	/// The remaining bits are available from Unpacked() and RedundancyBit().
+	/// </summary>
+	/// <returns>void</returns>
+	auto Flush() -> void;
+
+	auto Unpacked() const noexcept -> uint8_t;
+
+	auto RedundancyBit() const noexcept -> size_t;
+
+private:
+	WordType m_Accumulator{};
+	size_t m_BitCount{};
+	std::vector<uint8_t>* m_Container{}; ///< Null when writing into memory.
+	uint8_t* m_WritePos{};
+	uint8_t* m_WriteEnd{};
+
+	/// <summary>
+	/// Reserve length bytes at the end of buffer.
+	/// </summary>
+	auto Extend(const size_t length) -> uint8_t*
+	{
+		if (m_Container)
+		{
+			const auto size = m_Container->size();
+			m_Container->resize(size + length);
+			return m_Container->data() + size;
+		}
+		if (static_cast<size_t>(m_WriteEnd - m_WritePos) < length)
+		{
+			throw std::out_of_range("BitWriter: Buffer overflow");
+		}
+		auto* output = m_WritePos;
+		m_WritePos += length;
+		return output;
+	}
+
+	auto PushWord(const WordType value) -> void
+	{
+		auto* output = Extend(sizeof(WordType));
+		for (size_t i{}; i < sizeof(WordType); ++i)
+		{
+			output[i] = static_cast<uint8_t>(value >> (i * CHAR_BIT));
+		}
+	}
+};
+
+#endif // BIT_WRITER_H
@@ -0,0 +1,663 @@
+#include "pch.h"
+#include "Digest.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DIGEST_X86_SUPPORTED
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DIGEST_TARGET(features) __attribute__((target(features)))
+#else
+#define DIGEST_TARGET(features)
+#endif
+
+namespace
+{
+	constexpr uint32_t kSha256Constants[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+
+	constexpr uint32_t kSha256InitialState[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	constexpr uint64_t kXxHashPrime1 = 0x9E3779B185EBCA87;
+	constexpr uint64_t kXxHashPrime2 = 0xC2B2AE3D27D4EB4F;
+	constexpr uint64_t kXxHashPrime3 = 0x165667B19E3779F9;
+	constexpr uint64_t kXxHashPrime4 = 0x85EBCA77C2B2AE63;
+	constexpr uint64_t kXxHashPrime5 = 0x27D4EB2F165667C5;
+
+	/// <summary>
+	/// Leading bytes of the leaves and nodes of a tree hash, so a leaf never hashes like a node.
+	/// </summary>
+	constexpr uint8_t kTreeLeafPrefix = 0x00;
+	constexpr uint8_t kTreeNodePrefix = 0x01;
+
+	/// <summary>
+	/// Reflected CRC32C (Castagnoli) polynomial.
+	/// </summary>
+	constexpr uint32_t kCrc32cPolynomial = 0x82F63B78;
+
+	constexpr auto RotateRight(const uint32_t value, const int count) -> uint32_t
+	{
+		return (value >> count) | (value << (32 - count));
+	}
+
+	constexpr auto RotateLeft(const uint64_t value, const int count) -> uint64_t
+	{
+		return (value << count) | (value >> (64 - count));
+	}
+
+	auto LoadBigEndian32(const uint8_t* data) -> uint32_t
+	{
+		return uint32_t{data[0]} << 24 | uint32_t{data[1]} << 16 | uint32_t{data[2]} << 8 | uint32_t{data[3]};
+	}
+
+	auto LoadLittleEndian32(const uint8_t* data) -> uint32_t
+	{
+		return uint32_t{data[0]} | uint32_t{data[1]} << 8 | uint32_t{data[2]} << 16 | uint32_t{data[3]} << 24;
+	}
+
+	auto LoadLittleEndian64(const uint8_t* data) -> uint64_t
+	{
+		return uint64_t{LoadLittleEndian32(data)} | uint64_t{LoadLittleEndian32(data + 4)} << 32;
+	}
+
+	auto StoreBigEndian(const uint64_t value, const size_t length, unsigned char* output) -> void
+	{
+		for (size_t i{}; i < length; ++i)
+		{
+			output[i] = static_cast<unsigned char>(value >> ((length - 1 - i) * 8));
+		}
+	}
+
+	auto XxHash64Round(uint64_t accumulator, const uint64_t input) -> uint64_t
+	{
+		accumulator += input * kXxHashPrime2;
+		return RotateLeft(accumulator, 31) * kXxHashPrime1;
+	}
+
+	auto XxHash64Merge(uint64_t hash, const uint64_t accumulator) -> uint64_t
+	{
+		hash ^= XxHash64Round(0, accumulator);
+		return hash * kXxHashPrime1 + kXxHashPrime4;
+	}
+
+	/// <summary>
+	/// Table of the byte-wise CRC32C, extended to slice eight bytes at a time.
+	/// </summary>
+	auto Crc32cTable() -> const std::array<std::array<uint32_t, 256>, 8>&
+	{
+		static const auto table = []()
+		{
+			std::array<std::array<uint32_t, 256>, 8> result{};
+			for (uint32_t character{}; character < 256; ++character)
+			{
+				auto crc = character;
+				for (int bit{}; bit < 8; ++bit)
+				{
+					crc = crc & 1 ? (crc >> 1) ^ kCrc32cPolynomial : crc >> 1;
+				}
+				result[0][character] = crc;
+			}
+			for (uint32_t character{}; character < 256; ++character)
+			{
+				for (size_t slice{1}; slice < result.size(); ++slice)
+				{
+					const auto previous      = result[slice - 1][character];
+					result[slice][character] = (previous >> 8) ^ result[0][previous & 0xFF];
+				}
+			}
+			return result;
+		}();
+		return table;
+	}
+
+#ifdef DIGEST_X86_SUPPORTED
+	/// <summary>
+	/// Registers {eax, ebx, ecx, edx} of cpuid, zero if the leaf isn't supported.
+	/// </summary>
+	auto CpuId(const unsigned leaf, const unsigned subLeaf) -> std::array<uint32_t, 4>
+	{
+		std::array<uint32_t, 4> registers{};
+#ifdef _MSC_VER
+		int values[4]{};
+		__cpuid(values, 0);
+		if (static_cast<unsigned>(values[0]) < leaf)
+		{
+			return registers;
+		}
+		__cpuidex(values, static_cast<int>(leaf), static_cast<int>(subLeaf));
+		for (size_t i{}; i < registers.size(); ++i)
+		{
+			registers[i] = static_cast<uint32_t>(values[i]);
+		}
+#else
+		unsigned values[4]{};
+		if (__get_cpuid_count(leaf, subLeaf, &values[0], &values[1], &values[2], &values[3]))
+		{
+			for (size_t i{}; i < registers.size(); ++i)
+			{
+				registers[i] = values[i];
+			}
+		}
+#endif
+		return registers;
+	}
+
+	/// <summary>
+	/// SHA-256 by the SHA extensions, four rounds per pair of sha256rnds2.
+	/// </summary>
+	DIGEST_TARGET("sha,sse4.1,ssse3")
+	auto Sha256BlocksSha(uint32_t* state, const uint8_t* blocks, size_t blockCount) -> void
+	{
+		const auto byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+
+		// The instructions take the state as {ABEF} and {CDGH}.
+		auto cdab      = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+		auto efgh      = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+		auto stateAbef = _mm_alignr_epi8(cdab, efgh, 8);
+		auto stateCdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+		for (; blockCount; --blockCount, blocks += 64)
+		{
+			const auto savedAbef = stateAbef;
+			const auto savedCdgh = stateCdgh;
+
+			// The last four groups of four message words.
+			__m128i words[4];
+			for (size_t group{}; group < 16; ++group)
+			{
+				auto& current = words[group & 3];
+				if (group < 4)
+				{
+					current = _mm_shuffle_epi8(
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + group * 16)), byteSwap);
+				}
+				else
+				{
+					const auto& previous = words[(group - 1) & 3];
+					const auto shifted   = _mm_alignr_epi8(previous, words[(group - 2) & 3], 4);
+					current = _mm_sha256msg2_epu32(
+						_mm_add_epi32(_mm_sha256msg1_epu32(current, words[(group - 3) & 3]), shifted), previous);
+				}
+				auto message = _mm_add_epi32(
+					current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(kSha256Constants + group * 4)));
+				stateCdgh = _mm_sha256rnds2_epu32(stateCdgh, stateAbef, message);
+				message   = _mm_shuffle_epi32(message, 0x0E);
+				stateAbef = _mm_sha256rnds2_epu32(stateAbef, stateCdgh, message);
+			}
+
+			stateAbef = _mm_add_epi32(stateAbef, savedAbef);
+			stateCdgh = _mm_add_epi32(stateCdgh, savedCdgh);
+		}
+
+		const auto feba = _mm_shuffle_epi32(stateAbef, 0x1B);
+		const auto dchg = _mm_shuffle_epi32(stateCdgh, 0xB1);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(feba, dchg, 0xF0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+	}
+
+	/// <summary>
+	/// CRC32C by the crc32 instruction of SSE 4.2.
+	/// </summary>
+	DIGEST_TARGET("sse4.2")
+	auto Crc32cSse42(uint32_t crc, const uint8_t* first, const uint8_t* last) -> uint32_t
+	{
+#if defined(__x86_64__) || defined(_M_X64)
+		uint64_t wideCrc{crc};
+		for (; last - first >= 8; first += 8)
+		{
+			wideCrc = _mm_crc32_u64(wideCrc, LoadLittleEndian64(first));
+		}
+		crc = static_cast<uint32_t>(wideCrc);
+#endif
+		for (; last - first >= 4; first += 4)
+		{
+			crc = _mm_crc32_u32(crc, LoadLittleEndian32(first));
+		}
+		for (; first != last; ++first)
+		{
+			crc = _mm_crc32_u8(crc, *first);
+		}
+		return crc;
+	}
+#endif
+}
+
+Digest::Digest(const Algorithm algorithm)
+	: m_Algorithm(algorithm)
+{
+	switch (algorithm)
+	{
+	case Algorithm::Sha256:
+		std::memcpy(m_Sha256State, kSha256InitialState, sizeof(m_Sha256State));
+		break;
+	case Algorithm::Crc32c:
+		m_Crc32c = 0xFFFFFFFF;
+		break;
+	case Algorithm::XxHash64:
+		m_XxHashState[0] = kXxHashPrime1 + kXxHashPrime2;
+		m_XxHashState[1] = kXxHashPrime2;
+		m_XxHashState[2] = 0;
+		m_XxHashState[3] = 0 - kXxHashPrime1;
+		break;
+	case Algorithm::None:
+	case Algorithm::Sha256Tree:
+		break;
+	default:
+		throw std::invalid_argument("Digest: Unknown algorithm");
+	}
+}
+
+auto Digest::Update(const uint8_t* first, const uint8_t* last) -> void
+{
+	const auto length = static_cast<size_t>(last - first);
+	m_Length += length;
+	switch (m_Algorithm)
+	{
+	case Algorithm::Crc32c:
+		m_Crc32c = Crc32c(first, last, m_Crc32c ^ 0xFFFFFFFF) ^ 0xFFFFFFFF;
+		return;
+	case Algorithm::None:
+		return;
+	case Algorithm::Sha256Tree:
+		// Leaves are started once they have a byte, the empty source is started by Finish().
+		while (first != last)
+		{
+			if (0 == m_LeafLength)
+			{
+				std::memcpy(m_Sha256State, kSha256InitialState, sizeof(m_Sha256State));
+				m_BlockLength = 0;
+				UpdateBlocks(&kTreeLeafPrefix, &kTreeLeafPrefix + 1);
+			}
+			const auto count = (std::min)(kTreeLeafSize - m_LeafLength, static_cast<size_t>(last - first));
+			UpdateBlocks(first, first + count);
+			m_LeafLength += count;
+			first += count;
+			if (kTreeLeafSize == m_LeafLength)
+			{
+				TreeHash leaf;
+				FinishSha256(1 + kTreeLeafSize, leaf.data());
+				PushTreeNode(leaf, 1);
+				m_LeafLength = 0;
+			}
+		}
+		return;
+	default:
+		UpdateBlocks(first, last);
+		return;
+	}
+}
+
+auto Digest::UpdateBlocks(const uint8_t* first, const uint8_t* last) -> void
+{
+	// SHA-256 takes blocks of 64 bytes, XXH64 takes stripes of 32 bytes.
+	const size_t blockSize = Algorithm::XxHash64 == m_Algorithm ? 32 : 64;
+	const auto consume     = [this](const uint8_t* blocks, const size_t blockCount)
+	{
+		if (Algorithm::XxHash64 != m_Algorithm)
+		{
+			static const auto sha256Blocks = AcceleratedSha256() ? AcceleratedSha256() : Sha256BlocksPortable;
+			sha256Blocks(m_Sha256State, blocks, blockCount);
+			return;
+		}
+		XxHash64Stripes(m_XxHashState, blocks, blockCount);
+	};
+	if (m_BlockLength)
+	{
+		const auto count = (std::min)(blockSize - m_BlockLength, static_cast<size_t>(last - first));
+		std::memcpy(m_Block + m_BlockLength, first, count);
+		m_BlockLength += count;
+		first += count;
+		if (m_BlockLength < blockSize)
+		{
+			return;
+		}
+		consume(m_Block, 1);
+		m_BlockLength = 0;
+	}
+	const auto blockCount = static_cast<size_t>(last - first) / blockSize;
+	if (blockCount)
+	{
+		consume(first, blockCount);
+		first += blockCount * blockSize;
+	}
+	m_BlockLength = static_cast<size_t>(last - first);
+	if (m_BlockLength)
+	{
+		std::memcpy(m_Block, first, m_BlockLength);
+	}
+}
+
+auto Digest::Finish() -> std::vector<unsigned char>
+{
+	std::vector<unsigned char> digest(Length(m_Algorithm));
+	switch (m_Algorithm)
+	{
+	case Algorithm::Sha256:
+		FinishSha256(m_Length, digest.data());
+		break;
+	case Algorithm::Sha256Tree:
+	{
+		if (m_LeafLength || m_TreeNodes.empty())
+		{
+			if (0 == m_LeafLength)
+			{
+				std::memcpy(m_Sha256State, kSha256InitialState, sizeof(m_Sha256State));
+				m_BlockLength = 0;
+				UpdateBlocks(&kTreeLeafPrefix, &kTreeLeafPrefix + 1);
+			}
+			TreeHash leaf;
+			FinishSha256(1 + m_LeafLength, leaf.data());
+			m_TreeNodes.emplace_back(leaf, 1);
+			m_LeafLength = 0;
+		}
+		// Subtrees left over are merged from the right.
+		auto root = m_TreeNodes.back().first;
+		for (auto node = m_TreeNodes.rbegin() + 1; node != m_TreeNodes.rend(); ++node)
+		{
+			root = TreeNode(node->first, root);
+		}
+		std::copy(root.begin(), root.end(), digest.begin());
+		break;
+	}
+	case Algorithm::Crc32c:
+		StoreBigEndian(m_Crc32c ^ 0xFFFFFFFF, digest.size(), digest.data());
+		break;
+	case Algorithm::XxHash64:
+	{
+		const auto& state = m_XxHashState;
+		uint64_t hash{};
+		if (m_Length >= 32)
+		{
+			hash = RotateLeft(state[0], 1) + RotateLeft(state[1], 7) + RotateLeft(state[2], 12) + RotateLeft(state[3], 18);
+			for (const auto accumulator : state)
+			{
+				hash = XxHash64Merge(hash, accumulator);
+			}
+		}
+		else
+		{
+			hash = kXxHashPrime5;
+		}
+		hash += m_Length;
+
+		const uint8_t* readPos = m_Block;
+		const uint8_t* last    = m_Block + m_BlockLength;
+		for (; last - readPos >= 8; readPos += 8)
+		{
+			hash ^= XxHash64Round(0, LoadLittleEndian64(readPos));
+			hash = RotateLeft(hash, 27) * kXxHashPrime1 + kXxHashPrime4;
+		}
+		if (last - readPos >= 4)
+		{
+			hash ^= LoadLittleEndian32(readPos) * kXxHashPrime1;
+			hash = RotateLeft(hash, 23) * kXxHashPrime2 + kXxHashPrime3;
+			readPos += 4;
+		}
+		for (; readPos != last; ++readPos)
+		{
+			hash ^= *readPos * kXxHashPrime5;
+			hash = RotateLeft(hash, 11) * kXxHashPrime1;
+		}
+
+		hash ^= hash >> 33;
+		hash *= kXxHashPrime2;
+		hash ^= hash >> 29;
+		hash *= kXxHashPrime3;
+		hash ^= hash >> 32;
+		StoreBigEndian(hash, digest.size(), digest.data());
+		break;
+	}
+	default:
+		break;
+	}
+	return digest;
+}
+
+auto Digest::GetAlgorithm() const noexcept -> Algorithm { return m_Algorithm; }
+
+auto Digest::GetLength() const noexcept -> uint64_t { return m_Length; }
+
+auto Digest::AppendLeaf(const TreeHash& leaf, const size_t length) -> void
+{
+	if (Algorithm::Sha256Tree != m_Algorithm || m_Length % kTreeLeafSize || length > kTreeLeafSize)
+	{
+		throw std::invalid_argument("Digest: Leaf out of place");
+	}
+	m_Length += length;
+	PushTreeNode(leaf, 1);
+}
+
+auto Digest::TreeLeaf(const uint8_t* first, const uint8_t* last) -> TreeHash
+{
+	Digest digest{Algorithm::Sha256};
+	digest.Update(&kTreeLeafPrefix, &kTreeLeafPrefix + 1);
+	digest.Update(first, last);
+	TreeHash leaf;
+	digest.FinishSha256(digest.m_Length, leaf.data());
+	return leaf;
+}
+
+auto Digest::TreeNode(const TreeHash& left, const TreeHash& right) -> TreeHash
+{
+	Digest digest{Algorithm::Sha256};
+	digest.Update(&kTreeNodePrefix, &kTreeNodePrefix + 1);
+	digest.Update(left.data(), left.data() + left.size());
+	digest.Update(right.data(), right.data() + right.size());
+	TreeHash node;
+	digest.FinishSha256(digest.m_Length, node.data());
+	return node;
+}
+
+auto Digest::PushTreeNode(const TreeHash& node, const uint64_t leafCount) -> void
+{
+	m_TreeNodes.emplace_back(node, leafCount);
+	while (m_TreeNodes.size() >= 2 && m_TreeNodes.back().second == m_TreeNodes[m_TreeNodes.size() - 2].second)
+	{
+		const auto right = m_TreeNodes.back();
+		m_TreeNodes.pop_back();
+		auto& left  = m_TreeNodes.back();
+		left.first  = TreeNode(left.first, right.first);
+		left.second += right.second;
+	}
+}
+
+auto Digest::FinishSha256(const uint64_t length, uint8_t* digest) -> void
+{
+	// Padded by a bit of 1, zeros and the bit length of source.
+	uint8_t padding[72]{0x80};
+	const auto paddingLength = (m_BlockLength < 56 ? 56 : 120) - m_BlockLength;
+	StoreBigEndian(length * 8, 8, padding + paddingLength);
+	UpdateBlocks(padding, padding + paddingLength + 8);
+	for (size_t i{}; i < 8; ++i)
+	{
+		StoreBigEndian(m_Sha256State[i], 4, digest + i * 4);
+	}
+}
+
+auto Digest::Compute(const Algorithm algorithm, const uint8_t* first, const uint8_t* last)
+-> std::vector<unsigned char>
+{
+	Digest digest{algorithm};
+	digest.Update(first, last);
+	return digest.Finish();
+}
+
+auto Digest::Crc32c(const uint8_t* first, const uint8_t* last, const uint32_t crc) -> uint32_t
+{
+	static const auto update = AcceleratedCrc32c() ? AcceleratedCrc32c() : Crc32cPortable;
+	return update(crc ^ 0xFFFFFFFF, first, last) ^ 0xFFFFFFFF;
+}
+
+auto Digest::IsKnown(const Algorithm algorithm) noexcept -> bool
+{
+	return static_cast<uint8_t>(algorithm) <= static_cast<uint8_t>(Algorithm::Sha256Tree);
+}
+
+auto Digest::Length(const Algorithm algorithm) -> size_t
+{
+	switch (algorithm)
+	{
+	case Algorithm::Sha256:
+	case Algorithm::Sha256Tree:
+		return 32;
+	case Algorithm::Crc32c:
+		return 4;
+	case Algorithm::XxHash64:
+		return 8;
+	case Algorithm::None:
+		return 0;
+	default:
+		throw std::invalid_argument("Digest: Unknown algorithm");
+	}
+}
+
+auto Digest::FromLength(const size_t length) -> Algorithm
+{
+	for (const auto algorithm : {Algorithm::Sha256, Algorithm::Crc32c, Algorithm::XxHash64, Algorithm::None})
+	{
+		if (Length(algorithm) == length)
+		{
+			return algorithm;
+		}
+	}
+	throw std::invalid_argument("Digest: Unknown digest length");
+}
+
+auto Digest::Name(const Algorithm algorithm) noexcept -> const char*
+{
+	switch (algorithm)
+	{
+	case Algorithm::Sha256:
+		return "SHA256";
+	case Algorithm::Crc32c:
+		return "CRC32C";
+	case Algorithm::XxHash64:
+		return "XXH64";
+	case Algorithm::None:
+		return "None";
+	case Algorithm::Sha256Tree:
+		return "SHA256-Tree";
+	default:
+		return "Unknown";
+	}
+}
+
+auto Digest::Sha256BlocksPortable(uint32_t* state, const uint8_t* blocks, size_t blockCount) -> void
+{
+	for (; blockCount; --blockCount, blocks += 64)
+	{
+		uint32_t words[64];
+		for (size_t i{}; i < 16; ++i)
+		{
+			words[i] = LoadBigEndian32(blocks + i * 4);
+		}
+		for (size_t i{16}; i < 64; ++i)
+		{
+			const auto sigma0 = RotateRight(words[i - 15], 7) ^ RotateRight(words[i - 15], 18) ^ (words[i - 15] >> 3);
+			const auto sigma1 = RotateRight(words[i - 2], 17) ^ RotateRight(words[i - 2], 19) ^ (words[i - 2] >> 10);
+			words[i]          = words[i - 16] + sigma0 + words[i - 7] + sigma1;
+		}
+
+		auto a = state[0], b = state[1], c = state[2], d = state[3];
+		auto e = state[4], f = state[5], g = state[6], h = state[7];
+		for (size_t i{}; i < 64; ++i)
+		{
+			const auto sum1   = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+			const auto choose = (e & f) ^ (~e & g);
+			const auto temp1  = h + sum1 + choose + kSha256Constants[i] + words[i];
+			const auto sum0   = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+			const auto major  = (a & b) ^ (a & c) ^ (b & c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + temp1;
+			d = c;
+			c = b;
+			b = a;
+			a = temp1 + sum0 + major;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+auto Digest::Crc32cPortable(uint32_t crc, const uint8_t* first, const uint8_t* last) -> uint32_t
+{
+	const auto& table = Crc32cTable();
+	for (; last - first >= 8; first += 8)
+	{
+		const auto low  = crc ^ LoadLittleEndian32(first);
+		const auto high = LoadLittleEndian32(first + 4);
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24]
+			^ table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+	}
+	for (; first != last; ++first)
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *first) & 0xFF];
+	}
+	return crc;
+}
+
+auto Digest::AcceleratedSha256() noexcept -> Sha256Blocks
+{
+#ifdef DIGEST_X86_SUPPORTED
+	// SHA in leaf 7 ebx, SSSE3 and SSE 4.1 in leaf 1 ecx.
+	const auto features         = CpuId(1, 0);
+	const auto extendedFeatures = CpuId(7, 0);
+	if ((extendedFeatures[1] & (1u << 29)) && (features[2] & (1u << 9)) && (features[2] & (1u << 19)))
+	{
+		return Sha256BlocksSha;
+	}
+#endif
+	return nullptr;
+}
+
+auto Digest::AcceleratedCrc32c() noexcept -> Crc32cUpdate
+{
+#ifdef DIGEST_X86_SUPPORTED
+	// SSE 4.2 in leaf 1 ecx.
+	if (CpuId(1, 0)[2] & (1u << 20))
+	{
+		return Crc32cSse42;
+	}
+#endif
+	return nullptr;
+}
+
+auto Digest::XxHash64Stripes(uint64_t* state, const uint8_t* stripes, size_t stripeCount) -> void
+{
+	for (; stripeCount; --stripeCount, stripes += 32)
+	{
+		for (size_t lane{}; lane < 4; ++lane)
+		{
+			state[lane] = XxHash64Round(state[lane], LoadLittleEndian64(stripes + lane * 8));
+		}
+	}
+}
@@ -0,0 +1,170 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifndef FRIEND_TEST
+#define FRIEND_TEST(x,y)
+#endif
+
+/// <summary>
+/// Incremental digest of a source by a selectable algorithm.
+/// SHA-256 and CRC32C use the instructions of CPU where it has them, detected at run time.
+/// The leaves of a tree hash can also be hashed elsewhere, concurrently, and appended in order.
+/// </summary>
+class Digest
+{
+	FRIEND_TEST(GeneralTest, DigestTest);
+
+public:
+	/// <summary>
+	/// Digest algorithm, recorded in encoded files.
+	/// A digest tells its algorithm by its length, but for Sha256Tree which is as long as Sha256.
+	/// </summary>
+	enum class Algorithm : uint8_t
+	{
+		Sha256     = 0, ///< Cryptographic, 32 bytes. The only algorithm of older files.
+		Crc32c     = 1, ///< Detects corruption only, 4 bytes.
+		XxHash64   = 2, ///< Detects corruption only, 8 bytes.
+		None       = 3, ///< No digest, 0 bytes.
+		Sha256Tree = 4, ///< Cryptographic, 32 bytes. SHA-256 tree hash of kTreeLeafSize leaves, which hash in parallel.
+	};
+
+	/// <summary>
+	/// Longest digest of all algorithms.
+	/// </summary>
+	static constexpr size_t kMaxLength = 32;
+
+	/// <summary>
+	/// Bytes of source per leaf of Sha256Tree, but the last leaf which may be shorter.
+	/// Leaves hash as SHA-256(0x00 | leaf), nodes as SHA-256(0x01 | left | right) like RFC 6962.
+	/// The left subtree of a node holds the largest power of two leaves fewer than all of the node.
+	/// A source of one leaf or less, the empty one too, is a single leaf.
+	/// </summary>
+	static constexpr size_t kTreeLeafSize = 1024 * 1024;
+
+	using TreeHash = std::array<uint8_t, 32>;
+
+	/// <summary>
+	/// Start a digest, unknown algorithms throw std::invalid_argument.
+	/// </summary>
+	explicit Digest(const Algorithm algorithm = Algorithm::Sha256);
+
+	/// <summary>
+	/// Digest bytes from first to last, following the bytes given before.
+	/// </summary>
+	/// <param name="first">Begin of bytes</param>
+	/// <param name="last">End of bytes</param>
+	/// <returns>void</returns>
+	auto Update(const uint8_t* first, const uint8_t* last) -> void;
+
+	/// <summary>
+	/// Finish the digest, no more bytes can be given afterwards.
+	/// Checksums are in big endian, the order they are usually printed in.
+	/// </summary>
+	/// <returns>Digest of Length(algorithm) bytes</returns>
+	auto Finish() -> std::vector<unsigned char>;
+
+	auto GetAlgorithm() const noexcept -> Algorithm;
+
+	/// <summary>
+	/// Bytes given so far.
+	/// </summary>
+	auto GetLength() const noexcept -> uint64_t;
+
+	/// <summary>
+	/// Give the bytes of a leaf hashed by TreeLeaf, Sha256Tree only.
+	/// The bytes given before must be whole leaves, otherwise std::invalid_argument is thrown.
+	/// </summary>
+	/// <param name="leaf">Hash of the leaf</param>
+	/// <param name="length">Bytes of the leaf, only the last leaf is shorter than kTreeLeafSize</param>
+	/// <returns>void</returns>
+	auto AppendLeaf(const TreeHash& leaf, const size_t length) -> void;
+
+	/// <summary>
+	/// Hash a leaf of Sha256Tree, kTreeLeafSize bytes at most.
+	/// </summary>
+	static auto TreeLeaf(const uint8_t* first, const uint8_t* last) -> TreeHash;
+
+	/// <summary>
+	/// Digest a buffer at once.
+	/// </summary>
+	static auto Compute(const Algorithm algorithm, const uint8_t* first, const uint8_t* last)
+	-> std::vector<unsigned char>;
+
+	/// <summary>
+	/// CRC32C of bytes from first to last, following the bytes of crc.
+	/// </summary>
+	/// <param name="first">Begin of bytes</param>
+	/// <param name="last">End of bytes</param>
+	/// <param name="crc">CRC32C of the bytes before, 0 for none</param>
+	/// <returns>CRC32C of all bytes</returns>
+	static auto Crc32c(const uint8_t* first, const uint8_t* last, const uint32_t crc = 0) -> uint32_t;
+
+	static auto IsKnown(const Algorithm algorithm) noexcept -> bool;
+
+	/// <summary>
+	/// Length of digest, unknown algorithms throw std::invalid_argument.
+	/// </summary>
+	static auto Length(const Algorithm algorithm) -> size_t;
+
+	/// <summary>
+	/// Algorithm of a digest of length bytes, unknown lengths throw std::invalid_argument.
+	/// A digest of 32 bytes is taken as Sha256.
+	/// </summary>
+	static auto FromLength(const size_t length) -> Algorithm;
+
+	/// <summary>
+	/// Printable name of algorithm.
+	/// </summary>
+	static auto Name(const Algorithm algorithm) noexcept -> const char*;
+
+private:
+	using Sha256Blocks = void (*)(uint32_t* state, const uint8_t* blocks, size_t blockCount);
+	using Crc32cUpdate = uint32_t (*)(uint32_t crc, const uint8_t* first, const uint8_t* last);
+
+	Algorithm m_Algorithm;
+	uint64_t m_Length{};          ///< Bytes given so far.
+	uint8_t m_Block[64]{};        ///< Bytes waiting for a whole SHA-256 block or XXH64 stripe.
+	size_t m_BlockLength{};
+	uint32_t m_Sha256State[8]{};  ///< Of the current leaf for Sha256Tree.
+	uint64_t m_XxHashState[4]{};
+	uint32_t m_Crc32c{};
+	size_t m_LeafLength{};        ///< Bytes of the current leaf of Sha256Tree.
+	std::vector<std::pair<TreeHash, uint64_t>> m_TreeNodes; ///< Complete subtrees and their leaf counts, left first.
+
+	/// <summary>
+	/// Give whole SHA-256 blocks or XXH64 stripes to the state, keeping the rest in m_Block.
+	/// </summary>
+	auto UpdateBlocks(const uint8_t* first, const uint8_t* last) -> void;
+
+	/// <summary>
+	/// Pad the SHA-256 of length bytes and store it.
+	/// </summary>
+	auto FinishSha256(const uint64_t length, uint8_t* digest) -> void;
+
+	/// <summary>
+	/// Push a subtree of Sha256Tree, merging complete subtrees of equal size.
+	/// </summary>
+	auto PushTreeNode(const TreeHash& node, const uint64_t leafCount) -> void;
+
+	static auto TreeNode(const TreeHash& left, const TreeHash& right) -> TreeHash;
+
+	static auto Sha256BlocksPortable(uint32_t* state, const uint8_t* blocks, size_t blockCount) -> void;
+	static auto Crc32cPortable(uint32_t crc, const uint8_t* first, const uint8_t* last) -> uint32_t;
+
+	/// <summary>
+	/// Implementations by the instructions of CPU, null if the CPU doesn't have them.
+	/// </summary>
+	static auto AcceleratedSha256() noexcept -> Sha256Blocks;
+	static auto AcceleratedCrc32c() noexcept -> Crc32cUpdate;
+
+	static auto XxHash64Stripes(uint64_t* state, const uint8_t* stripes, size_t stripeCount) -> void;
+};
+
+#endif // DIGEST_H
@@ -32,6 +32,9 @@ public:
 		auto dialog = new ProcessDlg;
 		dialog->Create(IDD_PROCESS_DIALOG);
 		dialog->AppendProcessQueue(processUnit.begin(), processUnit.end());
+		// Settings of the registry key of the app, 0 workers for the count of hardware threads, 0 MB for no limit.
+		dialog->SetConcurrency(GetProfileInt(_T("Settings"), _T("WorkerCount"), 0),
+		                       uint64_t{GetProfileInt(_T("Settings"), _T("MemoryBudgetMB"), 1024)} << 20);
 		dialog->ShowWindow(SW_SHOW);
 		dialog->StartProcess();
 	}
@@ -0,0 +1,617 @@
+#include "pch.h"
+#include "HuffmanCodec.h"
+#include "HuffmanEncoder.h"
+#include "Sha256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace
+{
+	constexpr const char* kUsage =
+		"Usage: huffman <command> [options] <arguments>\n"
+		"\n"
+		"Commands:\n"
+		"  encode <input> <output>     Encode a file, - for stdin or stdout\n"
+		"  decode <input> <output>     Decode a file and verify it by its digest, - for stdin or stdout\n"
+		"  verify <input> [original]   Verify an encoded file by decoding it, or an original file by its digest\n"
+		"  info <input>                Print the metadata of an encoded file\n"
+		"  batch <files...>            Encode files to <file>.huff, decode <file>.huff files to <file>\n"
+		"\n"
+		"Options:\n"
+		"  -t, --threads <count>       Threads of a file, 0 for the count of hardware threads (default)\n"
+		"  -j, --jobs <count>          Files of batch at once (default 1)\n"
+		"  -b, --block-size <size>     Characters per block, 0 for a single stream (default)\n"
+		"  -d, --digest <algorithm>    sha256 (default), sha256-tree, crc32c, xxh64 or none\n"
+		"  -c, --checksum              Record a checksum of every block\n"
+		"  -s, --stream                Encode a framed stream, always so for stdin or stdout\n"
+		"  -k, --skip-damaged          Zero fill damaged blocks instead of failing\n"
+		"  -f, --force                 Overwrite existing outputs of batch\n"
+		"  -p, --progress              Print the progress of encode and decode to stderr\n"
+		"      --stats                 Print the time of every phase and counters of encode and decode to stderr\n"
+		"  -h, --help                  Print this help\n";
+
+	constexpr const char* kEncodedExtension = ".huff";
+
+	/// <summary>
+	/// Exit codes.
+	/// </summary>
+	constexpr int kSuccess      = 0;
+	constexpr int kVerifyFailed = 1;
+	constexpr int kFailed       = 2;
+
+	struct CommandLine
+	{
+		std::string m_Command;
+		std::vector<std::string> m_Arguments;
+		HuffmanEncoder::EncodeOptions m_EncodeOptions;
+		HuffmanEncoder::DecodeOptions m_DecodeOptions;
+		size_t m_JobCount{1};
+		bool m_IsFramed{false};
+		bool m_SkipDamaged{false};
+		bool m_Force{false};
+		bool m_PrintStats{false};
+		bool m_PrintProgress{false};
+	};
+
+	/// <summary>
+	/// Stream buffer dropping everything, the destination of verifying.
+	/// </summary>
+	class NullBuffer : public std::streambuf
+	{
+	protected:
+		auto overflow(int_type character) -> int_type override { return traits_type::not_eof(character); }
+		auto xsputn(const char*, std::streamsize count) -> std::streamsize override { return count; }
+	};
+
+	auto ParseCount(const std::string& option, const std::string& value) -> size_t
+	{
+		size_t length{};
+		unsigned long long count{};
+		try
+		{
+			count = std::stoull(value, &length);
+		}
+		catch (const std::logic_error&)
+		{
+			length = 0;
+		}
+		if (value.empty() || length != value.size() || '-' == value.front())
+		{
+			throw std::invalid_argument("Invalid count of " + option + ": " + value);
+		}
+		return static_cast<size_t>(count);
+	}
+
+	auto ParseDigest(const std::string& name) -> Digest::Algorithm
+	{
+		for (const auto algorithm : {Digest::Algorithm::Sha256,
+		                             Digest::Algorithm::Sha256Tree,
+		                             Digest::Algorithm::Crc32c,
+		                             Digest::Algorithm::XxHash64,
+		                             Digest::Algorithm::None})
+		{
+			std::string algorithmName{Digest::Name(algorithm)};
+			std::transform(algorithmName.begin(), algorithmName.end(), algorithmName.begin(),
+			               [](const char character) { return static_cast<char>(std::tolower(character)); });
+			if (name == algorithmName)
+			{
+				return algorithm;
+			}
+		}
+		throw std::invalid_argument("Unknown digest algorithm: " + name);
+	}
+
+	auto ParseCommandLine(const int argc, char** argv) -> CommandLine
+	{
+		CommandLine commandLine;
+		for (int i{1}; i < argc; ++i)
+		{
+			const std::string argument{argv[i]};
+			const auto value = [&]() -> std::string
+			{
+				if (i + 1 == argc)
+				{
+					throw std::invalid_argument("Missing value of " + argument);
+				}
+				return argv[++i];
+			};
+			if ("-h" == argument || "--help" == argument)
+			{
+				commandLine.m_Command = "help";
+				return commandLine;
+			}
+			if ("-t" == argument || "--threads" == argument)
+			{
+				const auto threadCount                    = ParseCount(argument, value());
+				commandLine.m_EncodeOptions.m_ThreadCount = threadCount;
+				commandLine.m_DecodeOptions.m_ThreadCount = threadCount;
+			}
+			else if ("-j" == argument || "--jobs" == argument)
+			{
+				commandLine.m_JobCount = (std::max)(ParseCount(argument, value()), size_t{1});
+			}
+			else if ("-b" == argument || "--block-size" == argument)
+			{
+				commandLine.m_EncodeOptions.m_BlockSize = ParseCount(argument, value());
+			}
+			else if ("-d" == argument || "--digest" == argument)
+			{
+				commandLine.m_EncodeOptions.m_DigestAlgorithm = ParseDigest(value());
+			}
+			else if ("-c" == argument || "--checksum" == argument)
+			{
+				commandLine.m_EncodeOptions.m_BlockChecksum = true;
+			}
+			else if ("-s" == argument || "--stream" == argument)
+			{
+				commandLine.m_IsFramed = true;
+			}
+			else if ("-k" == argument || "--skip-damaged" == argument)
+			{
+				commandLine.m_SkipDamaged = true;
+			}
+			else if ("-f" == argument || "--force" == argument)
+			{
+				commandLine.m_Force = true;
+			}
+			else if ("-p" == argument || "--progress" == argument)
+			{
+				commandLine.m_PrintProgress = true;
+			}
+			else if ("--stats" == argument)
+			{
+				commandLine.m_PrintStats = true;
+			}
+			else if (argument.size() > 1 && '-' == argument.front())
+			{
+				throw std::invalid_argument("Unknown option: " + argument);
+			}
+			else if (commandLine.m_Command.empty())
+			{
+				commandLine.m_Command = argument;
+			}
+			else
+			{
+				commandLine.m_Arguments.push_back(argument);
+			}
+		}
+		return commandLine;
+	}
+
+	auto CheckArgumentCount(const CommandLine& commandLine, const size_t minCount, const size_t maxCount) -> void
+	{
+		const auto count = commandLine.m_Arguments.size();
+		if (count < minCount || count > maxCount)
+		{
+			throw std::invalid_argument("Wrong count of arguments for " + commandLine.m_Command);
+		}
+	}
+
+	auto OpenInput(const std::string& filename, std::ifstream& file) -> std::istream&
+	{
+		if ("-" == filename)
+		{
+			return std::cin;
+		}
+		file.open(filename, std::ios::in | std::ios::binary);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Can't open " + filename);
+		}
+		return file;
+	}
+
+	auto OpenOutput(const std::string& filename, std::ofstream& file) -> std::ostream&
+	{
+		if ("-" == filename)
+		{
+			return std::cout;
+		}
+		file.open(filename, std::ios::out | std::ios::binary);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("Can't open " + filename);
+		}
+		return file;
+	}
+
+	/// <summary>
+	/// Report damaged blocks on stderr, if they are to be skipped.
+	/// filename is referred to, so it may change between files.
+	/// </summary>
+	auto DecodeOptionsOf(const CommandLine& commandLine, const std::string& filename) -> HuffmanEncoder::DecodeOptions
+	{
+		auto options = commandLine.m_DecodeOptions;
+		if (commandLine.m_SkipDamaged)
+		{
+			options.m_OnDamagedBlock = [&filename](const uint64_t offset, const uint64_t length)
+			{
+				std::cerr << filename << ": damaged block of " << length << " characters at " << offset
+					<< ", zero filled\n";
+			};
+		}
+		return options;
+	}
+
+	/// <summary>
+	/// Lines of stats, indented to follow the line of their file.
+	/// </summary>
+	auto FormatStats(const HuffmanEncoder::CodecStats& stats) -> std::string
+	{
+		using Milliseconds = std::chrono::duration<double, std::milli>;
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(3);
+		const auto phase = [&text](const char* name, const HuffmanEncoder::CodecStats::Duration duration)
+		{
+			text << "  " << std::left << std::setw(20) << name << std::right << std::setw(12)
+				<< Milliseconds(duration).count() << " ms\n";
+		};
+		phase("frequency and hash", stats.m_FrequencyAndHashTime);
+		phase("tree build", stats.m_TreeBuildTime);
+		phase("table serialize", stats.m_TableSerializeTime);
+		phase("payload", stats.m_PayloadTime);
+		phase("flush", stats.m_FlushTime);
+		phase("total", stats.m_TotalTime);
+		const auto seconds = std::chrono::duration<double>(stats.m_TotalTime).count();
+		text << "  bytes in " << stats.m_BytesIn << ", out " << stats.m_BytesOut << ", "
+			<< std::setprecision(1) << (seconds > 0 ? stats.m_BytesIn / seconds / 1e6 : 0.0) << " MB/s\n";
+		text << "  symbols " << stats.m_SymbolCount << ", average code length " << std::setprecision(3)
+			<< stats.m_AverageCodeLength << " bits";
+		if (stats.m_Entropy > 0)
+		{
+			text << ", entropy " << stats.m_Entropy << " bits";
+		}
+		text << '\n';
+		return text.str();
+	}
+
+	/// <summary>
+	/// Progress rewriting one line of stderr, with the time left once the bytes to do are known.
+	/// filename is referred to, the line is ended by the caller.
+	/// </summary>
+	auto ProgressPrinter(const std::string& filename) -> std::function<void(uint64_t, uint64_t)>
+	{
+		const auto start = std::chrono::steady_clock::now();
+		return [&filename, start](const uint64_t done, const uint64_t total)
+		{
+			const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::ostringstream text;
+			text << std::fixed << std::setprecision(1) << '\r' << filename << ": ";
+			if (total)
+			{
+				const auto rate = seconds > 0 ? static_cast<double>(done) / seconds : 0.0;
+				text << 100.0 * static_cast<double>(done) / static_cast<double>(total) << "%";
+				if (rate > 0)
+				{
+					text << ", " << static_cast<double>(total - (std::min)(done, total)) / rate << " s left";
+				}
+			}
+			else
+			{
+				text << static_cast<double>(done) / 1e6 << " MB";
+			}
+			std::cerr << text.str() << "   " << std::flush;
+		};
+	}
+
+	auto Encode(const CommandLine& commandLine) -> int
+	{
+		CheckArgumentCount(commandLine, 2, 2);
+		const auto& input  = commandLine.m_Arguments[0];
+		const auto& output = commandLine.m_Arguments[1];
+		auto options       = commandLine.m_EncodeOptions;
+		HuffmanEncoder::CodecStats stats;
+		if (commandLine.m_PrintStats)
+		{
+			options.m_Stats = &stats;
+		}
+		if (commandLine.m_PrintProgress)
+		{
+			options.m_OnProgress = ProgressPrinter(input);
+		}
+
+		// Pipes can't be read twice nor seeked, framed streams need neither.
+		if (commandLine.m_IsFramed || "-" == input || "-" == output)
+		{
+			std::ifstream inputFile;
+			std::ofstream outputFile;
+			auto& destination = OpenOutput(output, outputFile);
+			HuffmanEncoder::EncodeStream(OpenInput(input, inputFile), destination, options);
+			destination.flush();
+			if (!destination)
+			{
+				return kFailed;
+			}
+		}
+		else
+		{
+			HuffmanEncoder::Encode(input, output, options);
+		}
+		if (commandLine.m_PrintProgress)
+		{
+			std::cerr << '\n';
+		}
+		if (commandLine.m_PrintStats)
+		{
+			std::cerr << input << ":\n" << FormatStats(stats);
+		}
+		return kSuccess;
+	}
+
+	auto Decode(const CommandLine& commandLine) -> int
+	{
+		CheckArgumentCount(commandLine, 2, 2);
+		const auto& input  = commandLine.m_Arguments[0];
+		const auto& output = commandLine.m_Arguments[1];
+		auto options       = DecodeOptionsOf(commandLine, input);
+		HuffmanEncoder::CodecStats stats;
+		if (commandLine.m_PrintStats)
+		{
+			options.m_Stats = &stats;
+		}
+		if (commandLine.m_PrintProgress)
+		{
+			options.m_OnProgress = ProgressPrinter(input);
+		}
+
+		bool isVerified{};
+		if ("-" == input || "-" == output)
+		{
+			std::ifstream inputFile;
+			std::ofstream outputFile;
+			auto& destination = OpenOutput(output, outputFile);
+			isVerified        = HuffmanEncoder::DecodeAndVerify(OpenInput(input, inputFile), destination, options);
+			destination.flush();
+		}
+		else
+		{
+			isVerified = HuffmanEncoder::DecodeAndVerify(input, output, options);
+		}
+		if (commandLine.m_PrintProgress)
+		{
+			std::cerr << '\n';
+		}
+		if (commandLine.m_PrintStats)
+		{
+			std::cerr << input << ":\n" << FormatStats(stats);
+		}
+		if (!isVerified)
+		{
+			std::cerr << input << ": decoded characters don't match the digest\n";
+			return kVerifyFailed;
+		}
+		return kSuccess;
+	}
+
+	auto Verify(const CommandLine& commandLine) -> int
+	{
+		CheckArgumentCount(commandLine, 1, 2);
+		const auto& input = commandLine.m_Arguments[0];
+
+		bool isVerified{};
+		if (1 == commandLine.m_Arguments.size())
+		{
+			std::ifstream inputFile;
+			NullBuffer nullBuffer;
+			std::ostream destination{&nullBuffer};
+			isVerified = HuffmanEncoder::DecodeAndVerify(OpenInput(input, inputFile),
+			                                             destination,
+			                                             DecodeOptionsOf(commandLine, input));
+		}
+		else
+		{
+			const auto& original = commandLine.m_Arguments[1];
+			const auto metaData  = std::get<0>(HuffmanEncoder::GetMetaData(input));
+			auto options         = HuffmanEncoder::VerifyOptions{};
+			options.m_DigestAlgorithm = metaData.m_DigestAlgorithm;
+			options.m_ThreadCount     = commandLine.m_DecodeOptions.m_ThreadCount;
+			isVerified = HuffmanEncoder::Verify(original, HuffmanEncoder::GetDigest(metaData), options);
+		}
+		std::cout << input << ": " << (isVerified ? "OK" : "FAILED") << '\n';
+		return isVerified ? kSuccess : kVerifyFailed;
+	}
+
+	auto Info(const CommandLine& commandLine) -> int
+	{
+		CheckArgumentCount(commandLine, 1, 1);
+		const auto& input = commandLine.m_Arguments[0];
+		std::ifstream inputFile;
+		auto& source = OpenInput(input, inputFile);
+
+		char magic[sizeof(HuffmanEncoder::kStreamMagic)]{};
+		source.read(magic, sizeof(magic));
+		if (std::equal(std::begin(magic), std::end(magic), std::begin(HuffmanEncoder::kStreamMagic)))
+		{
+			std::cout << "Format:         framed stream\n";
+			return kSuccess;
+		}
+		// GetMetaData reads the magic again, only the header is taken from source.
+		const size_t kMaxTableLength{4096};
+		const size_t headLength = sizeof(HuffmanEncoder::SerializedHuffmanTableMetaData) + kMaxTableLength
+		                          + sizeof(HuffmanEncoder::SerializedBlockIndexHeader);
+		std::string headBuffer(headLength, '\0');
+		std::copy(std::begin(magic), std::end(magic), headBuffer.begin());
+		source.read(&headBuffer[sizeof(magic)], static_cast<std::streamsize>(headLength - sizeof(magic)));
+		headBuffer.resize(sizeof(magic) + static_cast<size_t>(source.gcount()));
+		std::istringstream head{headBuffer};
+		auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(head);
+
+		const auto hasBlockIndex = 0 != (metaData.m_Flags & HuffmanEncoder::kBlockIndexFlag);
+		std::cout << "Format:         " << (hasBlockIndex ? "block indexed" : "single stream") << '\n';
+		std::cout << "Table format:   "
+			<< (HuffmanEncoder::TableFormat::Canonical == metaData.m_TableFormat ? "canonical" : "explicit") << '\n';
+		std::cout << "Symbols:        " << huffmanTable.size() << '\n';
+		if (metaData.m_Flags & HuffmanEncoder::kPayloadLengthFlag)
+		{
+			std::cout << "Source length:  " << metaData.m_SourceLength << '\n';
+			std::cout << "Payload bits:   " << metaData.m_PayloadBitLength << '\n';
+		}
+		if (hasBlockIndex)
+		{
+			HuffmanEncoder::SerializedBlockIndexHeader indexHeader{};
+			head.read(reinterpret_cast<char*>(&indexHeader), sizeof(indexHeader));
+			std::cout << "Block size:     " << indexHeader.m_BlockSize << '\n';
+			std::cout << "Block count:    " << indexHeader.m_BlockCount << '\n';
+			std::cout << "Checksums:      "
+				<< (metaData.m_Flags & HuffmanEncoder::kBlockChecksumFlag ? "CRC32C" : "none") << '\n';
+		}
+		const auto digest = HuffmanEncoder::GetDigest(metaData);
+		std::cout << "Digest:         " << Digest::Name(metaData.m_DigestAlgorithm) << ' '
+			<< picosha2::bytes_to_hex_string(digest) << '\n';
+		return kSuccess;
+	}
+
+	auto Batch(const CommandLine& commandLine) -> int
+	{
+		CheckArgumentCount(commandLine, 1, (std::numeric_limits<size_t>::max)());
+		const auto& files = commandLine.m_Arguments;
+
+		// Every job keeps a codec, so the buffers of a file are reused by the next one.
+		std::atomic<size_t> filePos{};
+		std::atomic<int> result{kSuccess};
+		std::mutex outputMutex;
+		const auto runJob = [&]()
+		{
+			std::string file;
+			HuffmanEncoder::CodecStats stats;
+			auto encodeOptions = commandLine.m_EncodeOptions;
+			auto decodeOptions = DecodeOptionsOf(commandLine, file);
+			if (commandLine.m_PrintStats)
+			{
+				encodeOptions.m_Stats = &stats;
+				decodeOptions.m_Stats = &stats;
+			}
+			HuffmanCodec codec{encodeOptions, decodeOptions};
+			for (auto pos = filePos++; pos < files.size(); pos = filePos++)
+			{
+				file                 = files[pos];
+				const auto extension = std::strlen(kEncodedExtension);
+				const auto isEncode  = file.size() <= extension
+				                       || 0 != file.compare(file.size() - extension, extension, kEncodedExtension);
+				const auto target    = isEncode ? file + kEncodedExtension : file.substr(0, file.size() - extension);
+				std::string message;
+				auto fileResult = kSuccess;
+				try
+				{
+					if (!commandLine.m_Force && std::filesystem::exists(target))
+					{
+						throw std::runtime_error(target + " exists, --force to overwrite it");
+					}
+					if (isEncode)
+					{
+						codec.Encode(file, target);
+						message = "encoded " + file + " -> " + target;
+					}
+					else if (codec.DecodeAndVerify(file, target))
+					{
+						message = "decoded " + file + " -> " + target;
+					}
+					else
+					{
+						message    = file + ": decoded characters don't match the digest";
+						fileResult = kVerifyFailed;
+					}
+				}
+				catch (const std::exception& exception)
+				{
+					message    = file + ": " + exception.what();
+					fileResult = kFailed;
+				}
+				if (commandLine.m_PrintStats && kFailed != fileResult)
+				{
+					message += '\n' + FormatStats(stats);
+					message.pop_back();
+				}
+
+				std::lock_guard<std::mutex> lock{outputMutex};
+				(kSuccess == fileResult ? std::cout : std::cerr) << message << '\n';
+				if (fileResult > result)
+				{
+					result = fileResult;
+				}
+			}
+		};
+
+		std::vector<std::thread> jobs;
+		for (size_t i{1}; i < (std::min)(commandLine.m_JobCount, files.size()); ++i)
+		{
+			jobs.emplace_back(runJob);
+		}
+		runJob();
+		for (auto& job : jobs)
+		{
+			job.join();
+		}
+		return result;
+	}
+}
+
+auto main(int argc, char** argv) -> int
+{
+	std::ios::sync_with_stdio(false);
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	try
+	{
+		const auto commandLine = ParseCommandLine(argc, argv);
+		if ("encode" == commandLine.m_Command)
+		{
+			return Encode(commandLine);
+		}
+		if ("decode" == commandLine.m_Command)
+		{
+			return Decode(commandLine);
+		}
+		if ("verify" == commandLine.m_Command)
+		{
+			return Verify(commandLine);
+		}
+		if ("info" == commandLine.m_Command)
+		{
+			return Info(commandLine);
+		}
+		if ("batch" == commandLine.m_Command)
+		{
+			return Batch(commandLine);
+		}
+		if ("help" == commandLine.m_Command)
+		{
+			std::cout << kUsage;
+			return kSuccess;
+		}
+		std::cerr << kUsage;
+		return kFailed;
+	}
+	catch (const std::invalid_argument& exception)
+	{
+		std::cerr << "huffman: " << exception.what() << "\n\n" << kUsage;
+		return kFailed;
+	}
+	catch (const std::exception& exception)
+	{
+		std::cerr << "huffman: " << exception.what() << '\n';
+		return kFailed;
+	}
+}
@@ -0,0 +1,60 @@
+#include "pch.h"
+#include "HuffmanCodec.h"
+
+HuffmanCodec::HuffmanCodec(const HuffmanEncoder::EncodeOptions& encodeOptions,
+                           const HuffmanEncoder::DecodeOptions& decodeOptions)
+	: m_EncodeOptions(encodeOptions), m_DecodeOptions(decodeOptions)
+{
+}
+
+auto HuffmanCodec::Encode(const std::string& sourceFilename, const std::string& destination) -> void
+{
+	HuffmanEncoder::Encode(sourceFilename, destination, m_EncodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::Encode(std::istream& source, std::ostream& destination) -> void
+{
+	HuffmanEncoder::Encode(source, destination, m_EncodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::EncodeStream(std::istream& source, std::ostream& destination) -> void
+{
+	HuffmanEncoder::EncodeStream(source, destination, m_EncodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::EncodeBuffer(const uint8_t* source,
+                                const size_t sourceLength,
+                                uint8_t* output,
+                                const size_t outputLength) -> size_t
+{
+	return HuffmanEncoder::EncodeBuffer(source, sourceLength, output, outputLength, m_EncodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::Decode(const std::string& sourceFilename,
+                          const std::string& destination) -> std::vector<unsigned char>
+{
+	return HuffmanEncoder::Decode(sourceFilename, destination, m_DecodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::Decode(std::istream& source, std::ostream& destination) -> std::vector<unsigned char>
+{
+	return HuffmanEncoder::Decode(source, destination, m_DecodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::DecodeAndVerify(const std::string& sourceFilename, const std::string& destination) -> bool
+{
+	return HuffmanEncoder::DecodeAndVerify(sourceFilename, destination, m_DecodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::DecodeAndVerify(std::istream& source, std::ostream& destination) -> bool
+{
+	return HuffmanEncoder::DecodeAndVerify(source, destination, m_DecodeOptions, m_Workspace);
+}
+
+auto HuffmanCodec::DecodeBuffer(const uint8_t* source,
+                                const size_t sourceLength,
+                                uint8_t* output,
+                                const size_t outputLength) -> std::tuple<size_t, std::vector<unsigned char>>
+{
+	return HuffmanEncoder::DecodeBuffer(source, sourceLength, output, outputLength, m_DecodeOptions, m_Workspace);
+}
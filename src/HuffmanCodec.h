@@ -0,0 +1,93 @@
+#ifndef HUFFMAN_CODEC_H
+#define HUFFMAN_CODEC_H
+#pragma once
+
+#include "HuffmanEncoder.h"
+
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Reusable codec context.
+/// Read and write buffers, block buffers and tables are kept between calls, so encoding or decoding
+/// many small files doesn't allocate them again every time. A codec is not thread safe, use one per thread.
+/// </summary>
+class HuffmanCodec
+{
+public:
+	explicit HuffmanCodec(const HuffmanEncoder::EncodeOptions& encodeOptions = {},
+	                      const HuffmanEncoder::DecodeOptions& decodeOptions = {});
+
+	/// <summary>
+	/// Encoding a file, see HuffmanEncoder::Encode.
+	/// </summary>
+	/// <param name="sourceFilename">Filename of source file</param>
+	/// <param name="destination">Destination of encoded file</param>
+	/// <returns>void</returns>
+	auto Encode(const std::string& sourceFilename, const std::string& destination) -> void;
+
+	/// <summary>
+	/// Encoding a stream, see HuffmanEncoder::Encode.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <returns>void</returns>
+	auto Encode(std::istream& source, std::ostream& destination) -> void;
+
+	/// <summary>
+	/// Encoding a stream as a framed stream, see HuffmanEncoder::EncodeStream.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <returns>void</returns>
+	auto EncodeStream(std::istream& source, std::ostream& destination) -> void;
+
+	/// <summary>
+	/// Encoding a buffer into a buffer, see HuffmanEncoder::EncodeBuffer.
+	/// </summary>
+	/// <returns>Length of encoded data in output</returns>
+	auto EncodeBuffer(const uint8_t* source, const size_t sourceLength, uint8_t* output, const size_t outputLength)
+	-> size_t;
+
+	/// <summary>
+	/// Decode a file, see HuffmanEncoder::Decode.
+	/// </summary>
+	/// <param name="sourceFilename">File name of source file</param>
+	/// <param name="destination">Destination of decoded file</param>
+	/// <returns>Digest of the source recorded in file</returns>
+	auto Decode(const std::string& sourceFilename, const std::string& destination) -> std::vector<unsigned char>;
+
+	/// <summary>
+	/// Decode a stream, see HuffmanEncoder::Decode.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <returns>Digest of the source recorded in file</returns>
+	auto Decode(std::istream& source, std::ostream& destination) -> std::vector<unsigned char>;
+
+	/// <summary>
+	/// Decode a file and verify the decoded characters, see HuffmanEncoder::DecodeAndVerify.
+	/// </summary>
+	/// <returns>True if the decoded characters match the digest recorded in file</returns>
+	auto DecodeAndVerify(const std::string& sourceFilename, const std::string& destination) -> bool;
+
+	/// <summary>
+	/// Decode a stream and verify the decoded characters, see HuffmanEncoder::DecodeAndVerify.
+	/// </summary>
+	/// <returns>True if the decoded characters match the digest recorded in stream</returns>
+	auto DecodeAndVerify(std::istream& source, std::ostream& destination) -> bool;
+
+	/// <summary>
+	/// Decode a buffer into a buffer, see HuffmanEncoder::DecodeBuffer.
+	/// </summary>
+	/// <returns>{decodedLength, digest}</returns>
+	auto DecodeBuffer(const uint8_t* source, const size_t sourceLength, uint8_t* output, const size_t outputLength)
+	-> std::tuple<size_t, std::vector<unsigned char>>;
+
+private:
+	HuffmanEncoder::EncodeOptions m_EncodeOptions;
+	HuffmanEncoder::DecodeOptions m_DecodeOptions;
+	HuffmanEncoder::Workspace m_Workspace;
+};
+
+#endif // HUFFMAN_CODEC_H
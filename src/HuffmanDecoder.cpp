@@ -0,0 +1,329 @@
+#include "pch.h"
+#include "HuffmanDecoder.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+auto HuffmanDecoder::Push(const uint8_t* data, const size_t length, std::vector<uint8_t>& output) -> void
+{
+	using Encoder = HuffmanEncoder;
+
+	const auto* readPos = data;
+	const auto* last    = data + length;
+	while (true)
+	{
+		switch (m_Stage)
+		{
+		case Stage::Magic:
+			if (!Fill(readPos, last, sizeof(Encoder::kStreamMagic)))
+			{
+				return;
+			}
+			if (std::equal(std::begin(Encoder::kStreamMagic), std::end(Encoder::kStreamMagic), m_Pending.begin()))
+			{
+				m_Pending.clear();
+				m_Stage = Stage::FrameHeader;
+				break;
+			}
+			m_Stage = Stage::MetaData;
+			break;
+
+		case Stage::MetaData:
+		{
+			// Older files have a shorter metadata, its length is known once the flags are read.
+			const auto legacyLength = offsetof(Encoder::SerializedHuffmanTableMetaData, m_SourceLength);
+			if (!Fill(readPos, last, legacyLength))
+			{
+				return;
+			}
+			std::memcpy(&m_MetaData, m_Pending.data(), legacyLength);
+			if (!Fill(readPos, last, Encoder::MetaDataLength(m_MetaData)))
+			{
+				return;
+			}
+			std::memcpy(&m_MetaData, m_Pending.data(), m_Pending.size());
+			m_Pending.clear();
+			if (m_MetaData.m_TableLength > 256 * sizeof(Encoder::SerializedHuffmanTableItem))
+			{
+				throw std::runtime_error("HuffmanDecoder: Invalid huffman table length");
+			}
+			m_Digest = Encoder::GetDigest(m_MetaData);
+			m_Stage = Stage::Table;
+			break;
+		}
+
+		case Stage::Table:
+			if (!Fill(readPos, last, static_cast<size_t>(m_MetaData.m_TableLength)))
+			{
+				return;
+			}
+			m_Table = Encoder::BuildDecodeTable(Encoder::UnSerializeDecodeHuffmanTable(m_MetaData.m_TableFormat, m_Pending));
+			m_Pending.clear();
+			if (m_MetaData.m_Flags & Encoder::kBlockIndexFlag)
+			{
+				m_Stage = Stage::BlockIndexHeader;
+				break;
+			}
+			if (m_MetaData.m_Flags & Encoder::kPayloadLengthFlag)
+			{
+				BeginSegment(m_MetaData.m_PayloadBitLength);
+				m_Stage = Stage::Payload;
+				break;
+			}
+			// Older files don't record the end of a single stream, every bit is taken as valid until Finish().
+			m_State            = Encoder::DecodeState{};
+			m_State.m_BitsLeft = (std::numeric_limits<uint64_t>::max)();
+			m_Stage            = Stage::Stream;
+			break;
+
+		case Stage::BlockIndexHeader:
+			if (!Fill(readPos, last, sizeof(m_BlockIndexHeader)))
+			{
+				return;
+			}
+			std::memcpy(&m_BlockIndexHeader, m_Pending.data(), sizeof(m_BlockIndexHeader));
+			m_Pending.clear();
+			if (0 == m_BlockIndexHeader.m_BlockSize)
+			{
+				throw std::runtime_error("HuffmanDecoder: Invalid block index");
+			}
+			m_Stage = Stage::BlockIndex;
+			break;
+
+		case Stage::BlockIndex:
+			if (m_BlockIndex.size() == m_BlockIndexHeader.m_BlockCount)
+			{
+				m_Stage = Stage::BlockChecksums;
+				break;
+			}
+			if (!Fill(readPos, last, sizeof(Encoder::SerializedBlockIndexItem)))
+			{
+				return;
+			}
+			m_BlockIndex.emplace_back();
+			std::memcpy(&m_BlockIndex.back(), m_Pending.data(), sizeof(Encoder::SerializedBlockIndexItem));
+			m_Pending.clear();
+			break;
+
+		case Stage::BlockChecksums:
+			if (!(m_MetaData.m_Flags & Encoder::kBlockChecksumFlag) || m_BlockChecksums.size() == m_BlockIndex.size())
+			{
+				m_BlockPos = 0;
+				if (m_BlockIndex.empty())
+				{
+					m_Stage = Stage::Finished;
+					break;
+				}
+				BeginSegment(m_BlockIndex.front().m_BitLength);
+				m_Stage = Stage::Block;
+				break;
+			}
+			if (!Fill(readPos, last, sizeof(uint32_t)))
+			{
+				return;
+			}
+			m_BlockChecksums.emplace_back();
+			std::memcpy(&m_BlockChecksums.back(), m_Pending.data(), sizeof(uint32_t));
+			m_Pending.clear();
+			break;
+
+		case Stage::Stream:
+			if (readPos == last)
+			{
+				return;
+			}
+			if (m_HasHeldByte)
+			{
+				Encoder::DecodeChunk(m_Table, m_State, &m_HeldByte, &m_HeldByte + 1, output);
+			}
+			Encoder::DecodeChunk(m_Table, m_State, readPos, last - 1, output);
+			m_HeldByte    = *(last - 1);
+			m_HasHeldByte = true;
+			readPos       = last;
+			break;
+
+		case Stage::Payload:
+			if (!DecodeSegment(readPos, last, output))
+			{
+				return;
+			}
+			if (m_SegmentOutput != m_MetaData.m_SourceLength)
+			{
+				throw std::runtime_error("HuffmanDecoder: Corrupted payload");
+			}
+			m_Stage = Stage::Finished;
+			break;
+
+		case Stage::Block:
+		{
+			if (!DecodeSegment(readPos, last, output))
+			{
+				return;
+			}
+			// Every block but the last one holds exactly m_BlockSize characters.
+			const bool isLastBlock = m_BlockPos + 1 == m_BlockIndex.size();
+			if (m_SegmentOutput > m_BlockIndexHeader.m_BlockSize
+				|| (!isLastBlock && m_SegmentOutput != m_BlockIndexHeader.m_BlockSize))
+			{
+				throw std::runtime_error("HuffmanDecoder: Corrupted block");
+			}
+			if (!m_BlockChecksums.empty() && m_SegmentChecksum != m_BlockChecksums[m_BlockPos])
+			{
+				throw std::runtime_error("HuffmanDecoder: Damaged block");
+			}
+			if (isLastBlock)
+			{
+				m_Stage = Stage::Finished;
+				break;
+			}
+			BeginSegment(m_BlockIndex[++m_BlockPos].m_BitLength);
+			break;
+		}
+
+		case Stage::FrameHeader:
+			if (!Fill(readPos, last, sizeof(m_FrameHeader)))
+			{
+				return;
+			}
+			std::memcpy(&m_FrameHeader, m_Pending.data(), sizeof(m_FrameHeader));
+			m_Pending.clear();
+			if (0 == m_FrameHeader.m_SourceLength)
+			{
+				if (!Digest::IsKnown(m_FrameHeader.m_DigestAlgorithm))
+				{
+					throw std::runtime_error("HuffmanDecoder: Unknown digest algorithm");
+				}
+				m_Stage = Stage::Digest;
+				break;
+			}
+			if (m_FrameHeader.m_SourceLength > Encoder::kMaxFrameSize
+				|| m_FrameHeader.m_BitLength > m_FrameHeader.m_SourceLength * sizeof(uint32_t) * CHAR_BIT
+				|| m_FrameHeader.m_TableLength > 256
+				|| !Digest::IsKnown(m_FrameHeader.m_DigestAlgorithm))
+			{
+				throw std::runtime_error("HuffmanDecoder: Corrupted frame");
+			}
+			m_Stage = Stage::FrameTable;
+			break;
+
+		case Stage::FrameTable:
+			if (!Fill(readPos, last, m_FrameHeader.m_TableLength))
+			{
+				return;
+			}
+			m_Table = Encoder::BuildDecodeTable(
+				Encoder::UnSerializeDecodeHuffmanTable(Encoder::TableFormat::Canonical, m_Pending));
+			m_Pending.clear();
+			BeginSegment(m_FrameHeader.m_BitLength);
+			m_Stage = Stage::Frame;
+			break;
+
+		case Stage::Frame:
+			if (!DecodeSegment(readPos, last, output))
+			{
+				return;
+			}
+			if (m_SegmentOutput != m_FrameHeader.m_SourceLength)
+			{
+				throw std::runtime_error("HuffmanDecoder: Corrupted frame");
+			}
+			m_Stage = Stage::FrameHeader;
+			break;
+
+		case Stage::Digest:
+			if (!Fill(readPos, last, Digest::Length(m_FrameHeader.m_DigestAlgorithm)))
+			{
+				return;
+			}
+			m_Digest.assign(m_Pending.begin(), m_Pending.end());
+			m_Pending.clear();
+			m_Stage = Stage::Finished;
+			break;
+
+		case Stage::Finished:
+			if (readPos != last)
+			{
+				throw std::runtime_error("HuffmanDecoder: Trailing data after the end");
+			}
+			return;
+		}
+	}
+}
+
+auto HuffmanDecoder::Push(const std::vector<uint8_t>& data, std::vector<uint8_t>& output) -> void
+{
+	Push(data.data(), data.size(), output);
+}
+
+auto HuffmanDecoder::Finish(std::vector<uint8_t>& output) -> void
+{
+	// Stages which need no more bytes go on.
+	Push(nullptr, 0, output);
+
+	if (Stage::Stream == m_Stage)
+	{
+		// Only m_RedundancyBit bits of the last byte are valid.
+		if (m_HasHeldByte)
+		{
+			m_State.m_BitsLeft = m_State.m_BitCount + m_MetaData.m_RedundancyBit;
+			HuffmanEncoder::DecodeChunk(m_Table, m_State, &m_HeldByte, &m_HeldByte + 1, output);
+			m_HasHeldByte = false;
+		}
+		m_Stage = Stage::Finished;
+	}
+	if (Stage::Finished != m_Stage)
+	{
+		throw std::runtime_error("HuffmanDecoder: Truncated input");
+	}
+}
+
+auto HuffmanDecoder::IsFinished() const noexcept -> bool { return Stage::Finished == m_Stage; }
+
+auto HuffmanDecoder::Digest() const -> const std::vector<unsigned char>& { return m_Digest; }
+
+auto HuffmanDecoder::Fill(const uint8_t*& readPos, const uint8_t* last, const size_t size) -> bool
+{
+	if (m_Pending.size() >= size)
+	{
+		return true;
+	}
+	const auto count = (std::min)(size - m_Pending.size(), static_cast<size_t>(last - readPos));
+	m_Pending.insert(m_Pending.end(), readPos, readPos + count);
+	readPos += count;
+	return m_Pending.size() == size;
+}
+
+auto HuffmanDecoder::BeginSegment(const uint64_t bitLength) -> void
+{
+	m_State            = HuffmanEncoder::DecodeState{};
+	m_State.m_BitsLeft = bitLength;
+	m_SegmentBytesLeft = (bitLength + CHAR_BIT - 1) / CHAR_BIT;
+	m_SegmentOutput    = 0;
+	m_SegmentChecksum  = 0;
+}
+
+auto HuffmanDecoder::DecodeSegment(const uint8_t*& readPos,
+                                   const uint8_t* last,
+                                   std::vector<uint8_t>& output) -> bool
+{
+	const auto count     = static_cast<size_t>((std::min)(m_SegmentBytesLeft, static_cast<uint64_t>(last - readPos)));
+	const auto outputPos = output.size();
+	HuffmanEncoder::DecodeChunk(m_Table, m_State, readPos, readPos + count, output);
+	m_SegmentOutput += output.size() - outputPos;
+	if (!m_BlockChecksums.empty())
+	{
+		m_SegmentChecksum = Digest::Crc32c(output.data() + outputPos, output.data() + output.size(), m_SegmentChecksum);
+	}
+	m_SegmentBytesLeft -= count;
+	readPos += count;
+	if (m_SegmentBytesLeft)
+	{
+		return false;
+	}
+	if (m_State.m_BitsLeft)
+	{
+		throw std::runtime_error("HuffmanDecoder: Corrupted block");
+	}
+	return true;
+}
@@ -0,0 +1,110 @@
+#ifndef HUFFMAN_DECODER_H
+#define HUFFMAN_DECODER_H
+#pragma once
+
+#include "HuffmanEncoder.h"
+
+#include <vector>
+
+/// <summary>
+/// Incremental decoder, accepting the encoded data in chunks of any size as they arrive.
+/// Single stream files, block indexed files and framed streams are accepted.
+/// Blocks of files with kBlockChecksumFlag are checked as soon as they are decoded.
+/// Only the current header, huffman table and partial code are kept between chunks.
+/// </summary>
+class HuffmanDecoder
+{
+public:
+	HuffmanDecoder() = default;
+
+	/// <summary>
+	/// Decode a chunk of encoded data.
+	/// </summary>
+	/// <param name="data">Begin of the chunk</param>
+	/// <param name="length">Length of the chunk</param>
+	/// <param name="output">Decoded characters are appended to it</param>
+	/// <returns>void</returns>
+	auto Push(const uint8_t* data, const size_t length, std::vector<uint8_t>& output) -> void;
+
+	/// <summary>
+	/// Decode a chunk of encoded data.
+	/// </summary>
+	/// <param name="data">The chunk</param>
+	/// <param name="output">Decoded characters are appended to it</param>
+	/// <returns>void</returns>
+	auto Push(const std::vector<uint8_t>& data, std::vector<uint8_t>& output) -> void;
+
+	/// <summary>
+	/// Mark the end of encoded data and decode the characters held back.
+	/// The last byte of a single stream in older files is only decodable once the end is known.
+	/// </summary>
+	/// <param name="output">Decoded characters are appended to it</param>
+	/// <returns>void</returns>
+	auto Finish(std::vector<uint8_t>& output) -> void;
+
+	/// <summary>
+	/// Whether the whole encoded data has been decoded.
+	/// Older single stream files only end after Finish(), the others end by themselves.
+	/// </summary>
+	auto IsFinished() const noexcept -> bool;
+
+	/// <summary>
+	/// Digest of the source recorded in encoded data, empty until it has been read or if none is recorded.
+	/// </summary>
+	auto Digest() const -> const std::vector<unsigned char>&;
+
+private:
+	enum class Stage
+	{
+		Magic,
+		MetaData,
+		Table,
+		BlockIndexHeader,
+		BlockIndex,
+		BlockChecksums,
+		Stream,
+		Payload,
+		Block,
+		FrameHeader,
+		FrameTable,
+		Frame,
+		Digest,
+		Finished,
+	};
+
+	Stage m_Stage{Stage::Magic};
+	std::vector<uint8_t> m_Pending;
+	std::vector<unsigned char> m_Digest;
+	HuffmanEncoder::SerializedHuffmanTableMetaData m_MetaData{};
+	HuffmanEncoder::SerializedBlockIndexHeader m_BlockIndexHeader{};
+	std::vector<HuffmanEncoder::SerializedBlockIndexItem> m_BlockIndex;
+	std::vector<uint32_t> m_BlockChecksums;
+	size_t m_BlockPos{};
+	HuffmanEncoder::SerializedFrameHeader m_FrameHeader{};
+	HuffmanEncoder::DecodeTable m_Table{};
+	HuffmanEncoder::DecodeState m_State{};
+	uint64_t m_SegmentBytesLeft{};
+	uint64_t m_SegmentOutput{};
+	uint32_t m_SegmentChecksum{}; ///< CRC32C of the output of current block, kept with kBlockChecksumFlag only.
+	bool m_HasHeldByte{false};
+	uint8_t m_HeldByte{};
+
+	/// <summary>
+	/// Collect bytes into m_Pending until it holds size bytes.
+	/// </summary>
+	/// <returns>True if m_Pending holds at least size bytes</returns>
+	auto Fill(const uint8_t*& readPos, const uint8_t* last, const size_t size) -> bool;
+
+	/// <summary>
+	/// Start decoding a block or frame of bitLength bits.
+	/// </summary>
+	auto BeginSegment(const uint64_t bitLength) -> void;
+
+	/// <summary>
+	/// Decode the bytes of current block or frame.
+	/// </summary>
+	/// <returns>True if the block or frame is complete</returns>
+	auto DecodeSegment(const uint8_t*& readPos, const uint8_t* last, std::vector<uint8_t>& output) -> bool;
+};
+
+#endif // HUFFMAN_DECODER_H
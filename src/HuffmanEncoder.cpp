@@ -1,16 +1,314 @@
 #include "pch.h"
 #include "HuffmanEncoder.h"
-#include "BitCollector.h"
+#include "BitWriter.h"
+#include "ThreadPool.h"
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <fstream>
 #include <iostream>
-#include <stack>
-#include <set>
+#include <optional>
 #include <unordered_map>
 
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+static_assert(offsetof(HuffmanEncoder::SerializedHuffmanTableMetaData, m_SourceLength) == 48,
+              "Unexpected metadata layout");
+static_assert(sizeof(HuffmanEncoder::SerializedHuffmanTableMetaData) == 64, "Unexpected metadata layout");
+
+namespace
+{
+	/// <summary>
+	/// Read only stream buffer over memory, so the stream functions parse buffers without copying.
+	/// </summary>
+	class MemoryBuffer : public std::streambuf
+	{
+	public:
+		MemoryBuffer(const uint8_t* data, const size_t length)
+		{
+			auto* first = const_cast<char*>(reinterpret_cast<const char*>(data));
+			setg(first, first, first + length);
+		}
+
+	protected:
+		auto seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode) -> pos_type override
+		{
+			auto* base = std::ios_base::beg == direction ? eback() : std::ios_base::end == direction ? egptr() : gptr();
+			if (offset < eback() - base || offset > egptr() - base)
+			{
+				return pos_type(off_type(-1));
+			}
+			setg(eback(), base + offset, egptr());
+			return pos_type(gptr() - eback());
+		}
+
+		auto seekpos(pos_type position, std::ios_base::openmode mode) -> pos_type override
+		{
+			return seekoff(off_type(position), std::ios_base::beg, mode);
+		}
+	};
+
+	/// <summary>
+	/// Write only stream buffer over memory, writing beyond the memory fails the stream.
+	/// </summary>
+	class MemoryOutputBuffer : public std::streambuf
+	{
+	public:
+		MemoryOutputBuffer(uint8_t* data, const size_t length)
+		{
+			auto* first = reinterpret_cast<char*>(data);
+			setp(first, first + length);
+		}
+
+		auto Written() const noexcept -> size_t { return static_cast<size_t>(pptr() - pbase()); }
+	};
+
+	/// <summary>
+	/// Appends decoded characters to a container.
+	/// </summary>
+	struct VectorSink
+	{
+		std::vector<uint8_t>& m_Output;
+
+		auto Put(const uint8_t character) -> void { m_Output.push_back(character); }
+	};
+
+	/// <summary>
+	/// Writes decoded characters into memory, until m_WriteEnd.
+	/// </summary>
+	struct MemorySink
+	{
+		uint8_t* m_WritePos;
+		uint8_t* m_WriteEnd;
+
+		auto Put(const uint8_t character) -> void
+		{
+			if (m_WritePos == m_WriteEnd)
+			{
+				throw std::runtime_error("Decode: Output overflow");
+			}
+			*m_WritePos++ = character;
+		}
+	};
+
+	using CodecStats = HuffmanEncoder::CodecStats;
+
+	/// <summary>
+	/// Adds the wall time since the last lap to a phase of stats, doing nothing without stats.
+	/// </summary>
+	class PhaseClock
+	{
+	public:
+		explicit PhaseClock(CodecStats* stats) noexcept
+			: m_Stats(stats)
+		{
+		}
+
+		auto Lap(CodecStats::Duration CodecStats::* phase) noexcept -> void
+		{
+			if (m_Stats)
+			{
+				const auto now = std::chrono::steady_clock::now();
+				m_Stats->*phase += std::chrono::duration_cast<CodecStats::Duration>(now - m_LapStart);
+				m_LapStart = now;
+			}
+		}
+
+		/// <summary>
+		/// Start the next lap now, the time since the last lap is recorded by the clocks of callees.
+		/// </summary>
+		auto SkipLap() noexcept -> void
+		{
+			if (m_Stats)
+			{
+				m_LapStart = std::chrono::steady_clock::now();
+			}
+		}
+
+		/// <summary>
+		/// Set the total time, since the clock started.
+		/// </summary>
+		auto Stop() noexcept -> void
+		{
+			if (m_Stats)
+			{
+				m_Stats->m_TotalTime = std::chrono::duration_cast<CodecStats::Duration>(
+					std::chrono::steady_clock::now() - m_Start);
+			}
+		}
+
+	private:
+		CodecStats* m_Stats;
+		std::chrono::steady_clock::time_point m_Start{std::chrono::steady_clock::now()};
+		std::chrono::steady_clock::time_point m_LapStart{m_Start};
+	};
+
+	/// <summary>
+	/// Clear stats for a new encode or decode, and start its clock.
+	/// </summary>
+	auto StartStats(CodecStats* stats) -> PhaseClock
+	{
+		if (stats)
+		{
+			*stats = CodecStats{};
+		}
+		return PhaseClock{stats};
+	}
+
+	auto SetCounters(CodecStats* stats,
+	                 const uint64_t bytesIn,
+	                 const uint64_t bytesOut,
+	                 const uint64_t characterCount,
+	                 const uint64_t payloadBitLength) noexcept -> void
+	{
+		if (stats)
+		{
+			stats->m_BytesIn           = bytesIn;
+			stats->m_BytesOut          = bytesOut;
+			stats->m_AverageCodeLength = characterCount
+				                             ? static_cast<double>(payloadBitLength) / static_cast<double>(characterCount)
+				                             : 0.0;
+		}
+	}
+
+	/// <summary>
+	/// Shannon entropy of the characters counted, in bits per character.
+	/// </summary>
+	auto Entropy(const HuffmanEncoder::FrequencyContainer& frequency) -> double
+	{
+		uint64_t length{};
+		for (const auto& item : frequency)
+		{
+			length += item.second;
+		}
+		double entropy{};
+		for (const auto& item : frequency)
+		{
+			const auto probability = static_cast<double>(item.second) / static_cast<double>(length);
+			entropy -= probability * std::log2(probability);
+		}
+		return entropy;
+	}
+
+	auto SymbolCount(const HuffmanEncoder::HuffmanTableDecodeMap& huffmanTable) noexcept -> size_t
+	{
+		size_t count{};
+		for (const auto& item : huffmanTable)
+		{
+			count += item.second.size();
+		}
+		return count;
+	}
+
+	/// <summary>
+	/// Bytes from the position of a stream to its end, 0 if it can't be seeked.
+	/// </summary>
+	auto RemainingLength(std::istream& source) -> uint64_t
+	{
+		const auto position = source.tellg();
+		if (std::streampos(-1) == position)
+		{
+			return 0;
+		}
+		source.seekg(0, std::ios::end);
+		const auto end = source.tellg();
+		source.clear();
+		source.seekg(position);
+		return end > position ? static_cast<uint64_t>(end - position) : 0;
+	}
+}
+
+auto HuffmanEncoder::Progress::Advance(const uint64_t length) -> void
+{
+	Poll();
+	if (m_OnProgress && length)
+	{
+		const auto done = m_Done.fetch_add(length) + length;
+		if ((done - length) / m_Interval != done / m_Interval)
+		{
+			Report(done);
+		}
+	}
+}
+
+auto HuffmanEncoder::Progress::Poll() const -> void
+{
+	if (m_Cancellation && m_Cancellation->load(std::memory_order_relaxed))
+	{
+		throw CancelledError("Cancelled");
+	}
+}
+
+auto HuffmanEncoder::Progress::Finish() -> void
+{
+	if (m_OnProgress)
+	{
+		Report(m_Done);
+	}
+}
+
+auto HuffmanEncoder::Progress::Report(const uint64_t done) -> void
+{
+	// Threads may report out of order, the bytes done never go backwards.
+	std::lock_guard<std::mutex> lock{m_ReportMutex};
+	if (done > m_Reported)
+	{
+		m_Reported = done;
+		(*m_OnProgress)(done, m_Total);
+	}
+}
+
+template <typename Process>
+auto HuffmanEncoder::ForEachPiece(const uint8_t* first,
+                                  const uint8_t* last,
+                                  Progress& progress,
+                                  const bool isCounted,
+                                  const Process& process) -> void
+{
+	while (first != last)
+	{
+		const auto pieceLast = first + (std::min)(kProgressChunkSize, static_cast<size_t>(last - first));
+		process(first, pieceLast);
+		progress.Advance(isCounted ? static_cast<uint64_t>(pieceLast - first) : 0);
+		first = pieceLast;
+	}
+}
+
 auto HuffmanEncoder::Encode(const std::string& sourceFilename, const std::string& destination) -> void
 {
+	Encode(sourceFilename, destination, EncodeOptions{});
+}
+
+auto HuffmanEncoder::Encode(std::istream& source, std::ostream& destination) -> void
+{
+	Encode(source, destination, EncodeOptions{});
+}
+
+auto HuffmanEncoder::Encode(const std::string& sourceFilename,
+                            const std::string& destination,
+                            const EncodeOptions& options) -> void
+{
+	Workspace workspace;
+	Encode(sourceFilename, destination, options, workspace);
+}
+
+auto HuffmanEncoder::Encode(std::istream& source, std::ostream& destination, const EncodeOptions& options) -> void
+{
+	Workspace workspace;
+	Encode(source, destination, options, workspace);
+}
+
+auto HuffmanEncoder::Encode(const std::string& sourceFilename,
+                            const std::string& destination,
+                            const EncodeOptions& options,
+                            Workspace& workspace) -> void
+{
+#ifdef MAPPED_FILE_SUPPORTED
+	EncodeMapped(sourceFilename, destination, options, workspace);
+#else
 	std::ifstream fs{sourceFilename, std::ios::in | std::ios::binary};
 	std::ofstream output{destination, std::ios::out | std::ios::binary};
 	if (!fs.is_open())
@@ -21,64 +319,242 @@ auto HuffmanEncoder::Encode(const std::string& sourceFilename, const std::string
 	{
 		throw std::runtime_error("Encode: Can't open output file");
 	}
-	Encode(fs, output);
+	Encode(fs, output, options, workspace);
+#endif
 }
 
-auto HuffmanEncoder::Encode(std::istream& source, std::ostream& destination) -> void
+auto HuffmanEncoder::Encode(std::istream& source,
+                            std::ostream& destination,
+                            const EncodeOptions& options,
+                            Workspace& workspace) -> void
 {
-	auto [hash, frequency] = GetFrequencyAndHash(source);
-	auto huffmanTable      = GenerateTreeFromFrequency(frequency);
+	auto clock             = StartStats(options.m_Stats);
+	auto progress          = Progress{options, options.m_OnProgress ? 2 * RemainingLength(source) : 0};
+	auto [hash, frequency] = GetFrequencyAndHash(source, workspace.m_ReadBuffer, options, progress);
+	uint64_t sourceLength{};
+	for (const auto& item : frequency)
+	{
+		sourceLength += item.second;
+	}
+	clock.Lap(&CodecStats::m_FrequencyAndHashTime);
+
+	auto huffmanTable      = GenerateHuffmanTable(frequency, options);
+	const auto encodeTable = BuildEncodeTable(huffmanTable);
+	clock.Lap(&CodecStats::m_TreeBuildTime);
 
 	// Reset the status of file.
 	source.clear();
 	source.seekg(std::ios::beg);
 
 	// Prepare meta data.
-	auto serializedTable     = SerializeHuffmanTable(huffmanTable);
-	auto metaData            = SerializedHuffmanTableMetaData{};
-	metaData.m_TableLength   = serializedTable.size();
-	metaData.m_RedundancyBit = 0;
-	std::copy(hash.begin(), hash.end(), metaData.m_FileHash);
+	auto serializedTable     = TableFormat::Canonical == options.m_TableFormat
+		                           ? SerializeCanonicalHuffmanTable(huffmanTable)
+		                           : SerializeHuffmanTable(huffmanTable);
+	auto metaData            = MakeMetaData(hash, sourceLength, serializedTable.size(), options);
 
 	destination.write(reinterpret_cast<const char*>(&metaData), sizeof(metaData));
 
 	// Write Huffman table
 	destination.write(reinterpret_cast<const char*>(serializedTable.data()), serializedTable.size());
+	clock.Lap(&CodecStats::m_TableSerializeTime);
 
 	// Encode
-	auto writeBuffer  = std::vector<uint8_t>();
-	auto bitCollector = BitCollector(writeBuffer);
-	auto endPos       = std::istreambuf_iterator<char>();
-	for (auto readPos{std::istreambuf_iterator<char>(source)}; readPos != endPos; ++readPos)
+	if (options.m_BlockSize)
 	{
-		auto it = huffmanTable.find(*readPos);
-		if (it == huffmanTable.end())
-		{
-			throw std::runtime_error("Unknown character");
-		}
-		const auto& [bitLength, encode] = it->second;
-
-		bitCollector.Push(encode, 0, bitLength);
-
-		if (writeBuffer.size() >= 512)
+		metaData.m_PayloadBitLength =
+			EncodeBlocks(source, destination, encodeTable, sourceLength, options, workspace, progress);
+	}
+	else
+	{
+		const size_t readSize = 64 * 1024;
+		auto& readBuffer      = workspace.m_ReadBuffer;
+		auto& writeBuffer     = workspace.m_WriteBuffer;
+		readBuffer.resize(readSize);
+		writeBuffer.clear();
+		writeBuffer.reserve(readSize * 2);
+		auto bitWriter = BitWriter(writeBuffer);
+		uint64_t payloadLength{};
+		while (source)
 		{
+			source.read(reinterpret_cast<char*>(readBuffer.data()), readSize);
+			const auto actualSize = static_cast<size_t>(source.gcount());
+			EncodeChunk(encodeTable, bitWriter, readBuffer.data(), readBuffer.data() + actualSize);
 			destination.write(reinterpret_cast<const char*>(writeBuffer.data()), writeBuffer.size());
+			payloadLength += writeBuffer.size();
 			writeBuffer.clear();
+			progress.Advance(actualSize);
+		}
+		bitWriter.Flush();
+		payloadLength += writeBuffer.size();
+		if (bitWriter.RedundancyBit())
+		{
+			writeBuffer.push_back(bitWriter.Unpacked());
 		}
+		destination.write(reinterpret_cast<const char*>(writeBuffer.data()), writeBuffer.size());
+		metaData.m_RedundancyBit    = static_cast<uint8_t>(bitWriter.RedundancyBit());
+		metaData.m_PayloadBitLength = payloadLength * CHAR_BIT + bitWriter.RedundancyBit();
 	}
-	writeBuffer.push_back(bitCollector.Unpacked());
-	destination.write(reinterpret_cast<const char*>(writeBuffer.data()), writeBuffer.size());
-	writeBuffer.clear();
+	clock.Lap(&CodecStats::m_PayloadTime);
 
 	// Update meta data.
-	metaData.m_RedundancyBit = static_cast<uint8_t>(bitCollector.RedundancyBit());
+	if (options.m_Stats)
+	{
+		// The block index is rewritten before the end of payload.
+		destination.seekp(0, std::ios::end);
+		SetCounters(options.m_Stats,
+		            sourceLength,
+		            static_cast<uint64_t>(destination.tellp()),
+		            sourceLength,
+		            metaData.m_PayloadBitLength);
+		options.m_Stats->m_SymbolCount = huffmanTable.size();
+		options.m_Stats->m_Entropy     = Entropy(frequency);
+	}
 	destination.seekp(std::ios::beg);
 	destination.write(reinterpret_cast<const char*>(&metaData), sizeof(metaData));
+	destination.flush();
+	clock.Lap(&CodecStats::m_FlushTime);
+	clock.Stop();
+	progress.Finish();
+}
+
+auto HuffmanEncoder::EncodeStream(std::istream& source,
+                                  std::ostream& destination,
+                                  const EncodeOptions& options) -> void
+{
+	Workspace workspace;
+	EncodeStream(source, destination, options, workspace);
+}
+
+auto HuffmanEncoder::EncodeStream(std::istream& source,
+                                  std::ostream& destination,
+                                  const EncodeOptions& options,
+                                  Workspace& workspace) -> void
+{
+	const uint64_t frameSize = options.m_BlockSize ? options.m_BlockSize : 1024 * 1024;
+	if (frameSize > kMaxFrameSize)
+	{
+		throw std::invalid_argument("EncodeStream: Frame is too large");
+	}
+	auto frameOptions          = options;
+	frameOptions.m_TableFormat = TableFormat::Canonical;
+
+	auto clock    = StartStats(options.m_Stats);
+	auto progress = Progress{options, 0};
+	destination.write(kStreamMagic, sizeof(kStreamMagic));
+
+	Digest hasher{options.m_DigestAlgorithm};
+	auto& readBuffer  = workspace.m_ReadBuffer;
+	auto& writeBuffer = workspace.m_WriteBuffer;
+	readBuffer.resize(static_cast<size_t>(frameSize));
+	uint64_t sourceLength{}, encodedLength{sizeof(kStreamMagic)}, payloadBitLength{};
+	size_t symbolCount{};
+	double entropySum{};
+	while (source)
+	{
+		source.read(reinterpret_cast<char*>(readBuffer.data()), readBuffer.size());
+		const auto actualSize = static_cast<size_t>(source.gcount());
+		if (0 == actualSize)
+		{
+			break;
+		}
+		const auto first = readBuffer.data();
+		const auto last  = readBuffer.data() + actualSize;
+		UpdateDigest(hasher, first, last, options.m_ThreadCount, progress);
+		FrequencyCounts counts{};
+		ForEachPiece(first, last, progress, false, [&counts](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+		{
+			CountFrequency(pieceFirst, pieceLast, counts);
+		});
+		const auto frequency = MakeFrequency(counts);
+		clock.Lap(&CodecStats::m_FrequencyAndHashTime);
+
+		const auto huffmanTable = GenerateHuffmanTable(frequency, frameOptions);
+		const auto encodeTable  = BuildEncodeTable(huffmanTable);
+		clock.Lap(&CodecStats::m_TreeBuildTime);
+
+		const auto serializedTable = SerializeCanonicalHuffmanTable(huffmanTable);
+		clock.Lap(&CodecStats::m_TableSerializeTime);
+
+		writeBuffer.clear();
+		auto frameHeader              = SerializedFrameHeader{};
+		frameHeader.m_SourceLength    = actualSize;
+		frameHeader.m_BitLength       = EncodeBlock(encodeTable, first, last, writeBuffer, progress);
+		frameHeader.m_TableLength     = static_cast<uint32_t>(serializedTable.size());
+		frameHeader.m_DigestAlgorithm = options.m_DigestAlgorithm;
+		destination.write(reinterpret_cast<const char*>(&frameHeader), sizeof(frameHeader));
+		destination.write(reinterpret_cast<const char*>(serializedTable.data()), serializedTable.size());
+		destination.write(reinterpret_cast<const char*>(writeBuffer.data()), writeBuffer.size());
+		clock.Lap(&CodecStats::m_PayloadTime);
+
+		if (options.m_Stats)
+		{
+			sourceLength += actualSize;
+			encodedLength += sizeof(frameHeader) + serializedTable.size() + writeBuffer.size();
+			payloadBitLength += frameHeader.m_BitLength;
+			symbolCount = (std::max)(symbolCount, huffmanTable.size());
+			// Every frame has its own table, so the entropy of every frame bounds its codes.
+			entropySum += Entropy(frequency) * static_cast<double>(actualSize);
+		}
+	}
+	if (source.bad())
+	{
+		throw std::runtime_error("EncodeStream: Can't read source");
+	}
+
+	const auto digest                = hasher.Finish();
+	auto endFrameHeader              = SerializedFrameHeader{};
+	endFrameHeader.m_DigestAlgorithm = options.m_DigestAlgorithm;
+	destination.write(reinterpret_cast<const char*>(&endFrameHeader), sizeof(endFrameHeader));
+	destination.write(reinterpret_cast<const char*>(digest.data()), digest.size());
+	destination.flush();
+	clock.Lap(&CodecStats::m_FlushTime);
+
+	if (options.m_Stats)
+	{
+		encodedLength += sizeof(endFrameHeader) + digest.size();
+		SetCounters(options.m_Stats, sourceLength, encodedLength, sourceLength, payloadBitLength);
+		options.m_Stats->m_SymbolCount = symbolCount;
+		options.m_Stats->m_Entropy     = sourceLength ? entropySum / static_cast<double>(sourceLength) : 0.0;
+	}
+	clock.Stop();
+	progress.Finish();
 }
 
 auto HuffmanEncoder::Decode(const std::string& sourceFilename,
                             const std::string& destination) -> std::vector<unsigned char>
 {
+	return Decode(sourceFilename, destination, DecodeOptions{});
+}
+
+auto HuffmanEncoder::Decode(std::istream& source, std::ostream& destination) -> std::vector<unsigned char>
+{
+	return Decode(source, destination, DecodeOptions{});
+}
+
+auto HuffmanEncoder::Decode(const std::string& sourceFilename,
+                            const std::string& destination,
+                            const DecodeOptions& options) -> std::vector<unsigned char>
+{
+	Workspace workspace;
+	return Decode(sourceFilename, destination, options, workspace);
+}
+
+auto HuffmanEncoder::Decode(std::istream& source,
+                            std::ostream& destination,
+                            const DecodeOptions& options) -> std::vector<unsigned char>
+{
+	Workspace workspace;
+	return Decode(source, destination, options, workspace);
+}
+
+auto HuffmanEncoder::Decode(const std::string& sourceFilename,
+                            const std::string& destination,
+                            const DecodeOptions& options,
+                            Workspace& workspace) -> std::vector<unsigned char>
+{
+#ifdef MAPPED_FILE_SUPPORTED
+	return DecodeMapped(sourceFilename, destination, options, workspace);
+#else
 	std::ifstream fs{sourceFilename, std::ios::in | std::ios::binary};
 	std::ofstream output{destination, std::ios::out | std::ios::binary};
 	if (!fs.is_open())
@@ -89,276 +565,1854 @@ auto HuffmanEncoder::Decode(const std::string& sourceFilename,
 	{
 		throw std::runtime_error("Decode: Can't open output file");
 	}
-	return Decode(fs, output);
+	return Decode(fs, output, options, workspace);
+#endif
 }
 
-auto HuffmanEncoder::Decode(std::istream& source, std::ostream& destination) -> std::vector<unsigned char>
+auto HuffmanEncoder::Decode(std::istream& source,
+                            std::ostream& destination,
+                            const DecodeOptions& options,
+                            Workspace& workspace) -> std::vector<unsigned char>
 {
-	source.seekg(-1, std::ios::end);
-	const auto lastBytePos = source.tellg();
-	source.seekg(std::ios::beg);
-
-	// Get meta data
+	// Get meta data, unless it is a framed stream.
+	auto clock    = StartStats(options.m_Stats);
+	auto progress = Progress{options, options.m_OnProgress ? RemainingLength(source) : 0};
 	SerializedHuffmanTableMetaData metaData{};
-	source.read(reinterpret_cast<char*>(&metaData), sizeof(metaData));
+	source.read(reinterpret_cast<char*>(&metaData), sizeof(kStreamMagic));
+	if (std::equal(std::begin(kStreamMagic), std::end(kStreamMagic), reinterpret_cast<const char*>(&metaData)))
+	{
+		progress.Advance(sizeof(kStreamMagic));
+		auto digest = DecodeStream(source, destination, options, workspace, progress);
+		clock.Stop();
+		progress.Finish();
+		return digest;
+	}
+	ReadMetaData(source, metaData, sizeof(kStreamMagic));
+	StartOutputDigest(metaData.m_DigestAlgorithm, workspace);
 
 	// UnSerialize huffman table
-	std::vector<uint8_t> huffmanTableBuffer(metaData.m_TableLength);
+	auto& huffmanTableBuffer = workspace.m_TableBuffer;
+	auto& huffmanTable       = workspace.m_DecodeTable;
+	huffmanTableBuffer.resize(metaData.m_TableLength);
 	source.read(reinterpret_cast<char*>(huffmanTableBuffer.data()), metaData.m_TableLength);
-	auto huffmanTable = UnSerializeDecodeHuffmanTable(huffmanTableBuffer);
+	const auto decodeMap = UnSerializeDecodeHuffmanTable(metaData.m_TableFormat, huffmanTableBuffer);
+	clock.Lap(&CodecStats::m_TableSerializeTime);
+	BuildDecodeTable(decodeMap, huffmanTable);
+	clock.Lap(&CodecStats::m_TreeBuildTime);
+
+	// Decode file
+	uint64_t encodedLength = MetaDataLength(metaData) + metaData.m_TableLength;
+	uint64_t payloadBitLength{};
+	progress.Advance(encodedLength);
+	if (metaData.m_Flags & kBlockIndexFlag)
+	{
+		auto [indexHeader, index] = ReadBlockIndex(source);
+		const auto checksums      = ReadBlockChecksums(source, metaData, index.size());
+		// Older files don't record the length of source, their last damaged block is reported whole.
+		const bool isLengthRecorded = metaData.m_Flags & kPayloadLengthFlag;
+		const auto sourceLength     = isLengthRecorded ? metaData.m_SourceLength : indexHeader.m_BlockSize * index.size();
+		clock.Lap(&CodecStats::m_TableSerializeTime);
+		const auto indexLength = sizeof(indexHeader) + index.size() * sizeof(SerializedBlockIndexItem)
+		                         + checksums.size() * sizeof(uint32_t);
+		progress.Advance(indexLength);
+		DecodeBlocks(source,
+		             destination,
+		             huffmanTable,
+		             indexHeader,
+		             index,
+		             checksums,
+		             sourceLength,
+		             isLengthRecorded,
+		             options,
+		             workspace,
+		             progress);
+		encodedLength += indexLength;
+		for (const auto& item : index)
+		{
+			encodedLength += (item.m_BitLength + CHAR_BIT - 1) / CHAR_BIT;
+			payloadBitLength += item.m_BitLength;
+		}
+	}
+	else
+	{
+		const size_t readSize = 64 * 1024;
+		auto& readBuffer      = workspace.m_ReadBuffer;
+		auto& writeBuffer     = workspace.m_WriteBuffer;
+		auto state            = DecodeState{};
+		readBuffer.resize(readSize);
+		writeBuffer.clear();
+		if (metaData.m_Flags & kPayloadLengthFlag)
+		{
+			state.m_BitsLeft = metaData.m_PayloadBitLength;
+		}
+		else
+		{
+			// Older files: the last byte only holds m_RedundancyBit valid bits.
+			const auto payloadPos = source.tellg();
+			source.seekg(-1, std::ios::end);
+			const auto lastBytePos = source.tellg();
+			source.seekg(payloadPos);
+			if (lastBytePos >= payloadPos)
+			{
+				state.m_BitsLeft = static_cast<uint64_t>(lastBytePos - payloadPos) * CHAR_BIT + metaData.m_RedundancyBit;
+			}
+		}
+		payloadBitLength = state.m_BitsLeft;
+		while (source && state.m_BitsLeft)
+		{
+			source.read(reinterpret_cast<char*>(readBuffer.data()), readSize);
+			const auto actualSize = static_cast<size_t>(source.gcount());
+			DecodeChunk(huffmanTable, state, readBuffer.data(), readBuffer.data() + actualSize, writeBuffer);
+			WriteDecoded(destination, writeBuffer, workspace);
+			writeBuffer.clear();
+			encodedLength += actualSize;
+			progress.Advance(actualSize);
+		}
+		if ((metaData.m_Flags & kPayloadLengthFlag) && state.m_BitsLeft)
+		{
+			throw std::runtime_error("Decode: Truncated payload");
+		}
+	}
+	clock.Lap(&CodecStats::m_PayloadTime);
+
+	destination.flush();
+	clock.Lap(&CodecStats::m_FlushTime);
+	if (options.m_Stats)
+	{
+		SetCounters(options.m_Stats, encodedLength, workspace.m_DecodedLength, workspace.m_DecodedLength, payloadBitLength);
+		options.m_Stats->m_SymbolCount = SymbolCount(decodeMap);
+	}
+	clock.Stop();
+	progress.Finish();
+	return GetDigest(metaData);
+}
+
+auto HuffmanEncoder::DecodeAndVerify(const std::string& sourceFilename,
+                                     const std::string& destination,
+                                     const DecodeOptions& options) -> bool
+{
+	Workspace workspace;
+	return DecodeAndVerify(sourceFilename, destination, options, workspace);
+}
+
+auto HuffmanEncoder::DecodeAndVerify(std::istream& source,
+                                     std::ostream& destination,
+                                     const DecodeOptions& options) -> bool
+{
+	Workspace workspace;
+	return DecodeAndVerify(source, destination, options, workspace);
+}
+
+template <typename Decoder>
+auto HuffmanEncoder::DecodeVerified(Workspace& workspace, const Decoder& decode) -> bool
+{
+	workspace.m_DigestOutput = true;
+	workspace.m_OutputDigest = Digest{Digest::Algorithm::None};
+	std::vector<unsigned char> digest;
+	try
+	{
+		digest = decode();
+	}
+	catch (...)
+	{
+		workspace.m_DigestOutput = false;
+		throw;
+	}
+	workspace.m_DigestOutput = false;
+	return digest == workspace.m_OutputDigest.Finish();
+}
+
+auto HuffmanEncoder::DecodeAndVerify(const std::string& sourceFilename,
+                                     const std::string& destination,
+                                     const DecodeOptions& options,
+                                     Workspace& workspace) -> bool
+{
+	return DecodeVerified(workspace, [&]() { return Decode(sourceFilename, destination, options, workspace); });
+}
+
+auto HuffmanEncoder::DecodeAndVerify(std::istream& source,
+                                     std::ostream& destination,
+                                     const DecodeOptions& options,
+                                     Workspace& workspace) -> bool
+{
+	return DecodeVerified(workspace, [&]() { return Decode(source, destination, options, workspace); });
+}
+
+auto HuffmanEncoder::StartOutputDigest(const Digest::Algorithm algorithm, Workspace& workspace) -> void
+{
+	workspace.m_OutputDigest  = Digest{workspace.m_DigestOutput ? algorithm : Digest::Algorithm::None};
+	workspace.m_DecodedLength = 0;
+}
+
+auto HuffmanEncoder::WriteDecoded(std::ostream& destination,
+                                  const std::vector<uint8_t>& characters,
+                                  Workspace& workspace) -> void
+{
+	destination.write(reinterpret_cast<const char*>(characters.data()), characters.size());
+	workspace.m_OutputDigest.Update(characters.data(), characters.data() + characters.size());
+	workspace.m_DecodedLength += characters.size();
+}
+
+auto HuffmanEncoder::Verify(const std::string& sourceFilename, const std::vector<unsigned char>& digest) -> bool
+{
+	auto options = VerifyOptions{};
+	try
+	{
+		options.m_DigestAlgorithm = Digest::FromLength(digest.size());
+	}
+	catch (const std::invalid_argument&)
+	{
+		return false;
+	}
+	return Verify(sourceFilename, digest, options);
+}
+
+auto HuffmanEncoder::Verify(std::istream& source, const std::vector<unsigned char>& digest) -> bool
+{
+	auto options = VerifyOptions{};
+	try
+	{
+		options.m_DigestAlgorithm = Digest::FromLength(digest.size());
+	}
+	catch (const std::invalid_argument&)
+	{
+		return false;
+	}
+	return Verify(source, digest, options);
+}
+
+auto HuffmanEncoder::Verify(const std::string& sourceFilename,
+                            const std::vector<unsigned char>& digest,
+                            const VerifyOptions& options) -> bool
+{
+#ifdef MAPPED_FILE_SUPPORTED
+	const auto source = MappedFile::OpenRead(sourceFilename);
+	if (!Digest::IsKnown(options.m_DigestAlgorithm) || digest.size() != Digest::Length(options.m_DigestAlgorithm))
+	{
+		return false;
+	}
+	Digest hasher{options.m_DigestAlgorithm};
+	UpdateDigest(hasher, source.Data(), source.Data() + source.Size(), options.m_ThreadCount);
+	return digest == hasher.Finish();
+#else
+	std::ifstream fs{sourceFilename, std::ios::in | std::ios::binary};
+	if (!fs.is_open())
+	{
+		throw std::runtime_error("Verify: Can't open file");
+	}
+	return Verify(fs, digest, options);
+#endif
+}
+
+auto HuffmanEncoder::Verify(std::istream& source,
+                            const std::vector<unsigned char>& digest,
+                            const VerifyOptions& options) -> bool
+{
+	if (!Digest::IsKnown(options.m_DigestAlgorithm) || digest.size() != Digest::Length(options.m_DigestAlgorithm))
+	{
+		return false;
+	}
+	// A chunk holds a few leaves for every thread.
+	const bool isTree = Digest::Algorithm::Sha256Tree == options.m_DigestAlgorithm;
+	Digest hasher{options.m_DigestAlgorithm};
+	std::vector<uint8_t> buffer(isTree
+		                            ? ThreadPool::ResolveThreadCount(options.m_ThreadCount) * 4 * Digest::kTreeLeafSize
+		                            : 1024 * 1024);
+	while (source)
+	{
+		source.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+		UpdateDigest(hasher, buffer.data(), buffer.data() + source.gcount(), options.m_ThreadCount);
+	}
+	return digest == hasher.Finish();
+}
+
+auto HuffmanEncoder::UpdateDigest(Digest& digest,
+                                  const uint8_t* first,
+                                  const uint8_t* last,
+                                  const size_t threadCount) -> void
+{
+	const auto leafSize = Digest::kTreeLeafSize;
+	if (Digest::Algorithm::Sha256Tree != digest.GetAlgorithm() || ThreadPool::ResolveThreadCount(threadCount) <= 1)
+	{
+		digest.Update(first, last);
+		return;
+	}
+	// Up to a leaf boundary first, then the whole leaves concurrently and the rest.
+	const auto headLength = static_cast<size_t>((leafSize - digest.GetLength() % leafSize) % leafSize);
+	const auto leafFirst  = first + (std::min)(headLength, static_cast<size_t>(last - first));
+	digest.Update(first, leafFirst);
+	const auto leafCount = static_cast<size_t>(last - leafFirst) / leafSize;
+	std::vector<Digest::TreeHash> leaves(leafCount);
+	ThreadPool::ParallelFor(leafCount, threadCount, [&leaves, leafFirst, leafSize](const size_t leaf)
+	{
+		leaves[leaf] = Digest::TreeLeaf(leafFirst + leaf * leafSize, leafFirst + (leaf + 1) * leafSize);
+	});
+	for (const auto& leaf : leaves)
+	{
+		digest.AppendLeaf(leaf, leafSize);
+	}
+	digest.Update(leafFirst + leafCount * leafSize, last);
+}
+
+auto HuffmanEncoder::UpdateDigest(Digest& digest,
+                                  const uint8_t* first,
+                                  const uint8_t* last,
+                                  const size_t threadCount,
+                                  Progress& progress) -> void
+{
+	const auto pieceLength = ThreadPool::ResolveThreadCount(threadCount) * Digest::kTreeLeafSize;
+	while (first != last)
+	{
+		const auto pieceLast = first + (std::min)(pieceLength, static_cast<size_t>(last - first));
+		UpdateDigest(digest, first, pieceLast, threadCount);
+		progress.Poll();
+		first = pieceLast;
+	}
+}
+
+auto HuffmanEncoder::GetDigest(const SerializedHuffmanTableMetaData& metaData) -> std::vector<unsigned char>
+{
+	if (!Digest::IsKnown(metaData.m_DigestAlgorithm))
+	{
+		throw std::runtime_error("Unknown digest algorithm");
+	}
+	return std::vector<unsigned char>{
+		metaData.m_FileHash,
+		metaData.m_FileHash + Digest::Length(metaData.m_DigestAlgorithm)
+	};
+}
+
+auto HuffmanEncoder::GetMetaData(std::istream& source) -> std::tuple<SerializedHuffmanTableMetaData, HuffmanTableMap>
+{
+	auto result                    = std::make_tuple(SerializedHuffmanTableMetaData{}, HuffmanTableMap{});
+	auto& [metaData, huffmanTable] = result;
+
+	// Get meta data
+	source.read(reinterpret_cast<char*>(&metaData), sizeof(kStreamMagic));
+	if (std::equal(std::begin(kStreamMagic), std::end(kStreamMagic), reinterpret_cast<const char*>(&metaData)))
+	{
+		throw std::runtime_error("GetMetaData: Framed stream has no file metadata");
+	}
+	ReadMetaData(source, metaData, sizeof(kStreamMagic));
+
+	// UnSerialize huffman table
+	std::vector<uint8_t> huffmanTableBuffer(metaData.m_TableLength);
+	source.read(reinterpret_cast<char*>(huffmanTableBuffer.data()), metaData.m_TableLength);
+	huffmanTable = UnSerializeHuffmanTable(metaData.m_TableFormat, huffmanTableBuffer);
+
+	return result;
+}
+
+auto HuffmanEncoder::GetMetaData(
+	const std::string& filename) -> std::tuple<SerializedHuffmanTableMetaData, HuffmanTableMap>
+{
+	std::ifstream fs(filename, std::ios::in | std::ios::binary);
+	if (!fs.is_open())
+	{
+		throw std::runtime_error("GetMetaData: Can't open file");
+	}
+	return GetMetaData(fs);
+}
+
+auto HuffmanEncoder::GetFrequencyAndHash(
+	std::istream& fileStream,
+	std::vector<uint8_t>& buffer,
+	const EncodeOptions& options,
+	Progress& progress) -> std::tuple<std::vector<unsigned char>, FrequencyContainer>
+{
+	const size_t chunkSize{Digest::kTreeLeafSize}; // A chunk is a leaf of Sha256Tree.
+	auto result = std::make_tuple(std::vector<unsigned char>(), FrequencyContainer());
+	auto& [digest, frequency] = result;
+
+	FrequencyCounts counts{};
+	Digest hasher{options.m_DigestAlgorithm};
+	const bool isTree      = Digest::Algorithm::Sha256Tree == options.m_DigestAlgorithm;
+	const auto workerCount = ThreadPool::ResolveThreadCount(options.m_ThreadCount);
+	if (workerCount <= 1)
+	{
+		// Count a chunk while it is in cache, then hash it.
+		buffer.resize(chunkSize);
+		while (fileStream)
+		{
+			fileStream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(chunkSize));
+			const auto actualSize = static_cast<size_t>(fileStream.gcount());
+			CountFrequency(buffer.data(), buffer.data() + actualSize, counts);
+			hasher.Update(buffer.data(), buffer.data() + actualSize);
+			progress.Advance(actualSize);
+		}
+	}
+	else
+	{
+		// Hashing is sequential and slower than counting, a few counting threads keep up with it.
+		// The leaves of Sha256Tree are hashed by the counting threads instead.
+		const size_t kMaxCountThreadCount{4};
+		const auto countThreadCount = isTree ? workerCount : (std::min)(workerCount - 1, kMaxCountThreadCount);
+
+		// A slot is refilled once both the hash thread and a counting thread are done with it,
+		// every slot counts into its own histogram.
+		struct Slot
+		{
+			FrequencyCounts m_Counts{};
+			Digest::TreeHash m_Leaf{};
+			size_t m_Length{};
+			std::future<void> m_Hashed;
+			std::future<void> m_Counted;
+		};
+		std::vector<Slot> slots(countThreadCount + 2);
+		buffer.resize(slots.size() * chunkSize);
+		// Slots are finished in the order they were filled, which is the order of leaves.
+		const auto finishSlot = [&hasher, &progress, isTree](Slot& slot)
+		{
+			if (!slot.m_Counted.valid())
+			{
+				return;
+			}
+			if (slot.m_Hashed.valid())
+			{
+				slot.m_Hashed.get();
+			}
+			slot.m_Counted.get();
+			if (isTree)
+			{
+				hasher.AppendLeaf(slot.m_Leaf, slot.m_Length);
+			}
+			progress.Advance(slot.m_Length);
+		};
+
+		// Declared after everything the tasks touch, so pending tasks finish first when unwinding.
+		ThreadPool hashThread{1};
+		ThreadPool countThreads{countThreadCount};
+		size_t slotPos{};
+		for (; fileStream; slotPos = (slotPos + 1) % slots.size())
+		{
+			auto& slot = slots[slotPos];
+			finishSlot(slot);
+			const auto chunk = buffer.data() + slotPos * chunkSize;
+			fileStream.read(reinterpret_cast<char*>(chunk), static_cast<std::streamsize>(chunkSize));
+			const auto actualSize = static_cast<size_t>(fileStream.gcount());
+			if (0 == actualSize)
+			{
+				break;
+			}
+			slot.m_Length = actualSize;
+			if (!isTree)
+			{
+				slot.m_Hashed = hashThread.Submit([&hasher, chunk, actualSize]() { hasher.Update(chunk, chunk + actualSize); });
+			}
+			slot.m_Counted = countThreads.Submit([&slot, isTree, chunk, actualSize]()
+			{
+				CountFrequency(chunk, chunk + actualSize, slot.m_Counts);
+				if (isTree)
+				{
+					slot.m_Leaf = Digest::TreeLeaf(chunk, chunk + actualSize);
+				}
+			});
+		}
+		for (size_t i{}; i < slots.size(); ++i)
+		{
+			auto& slot = slots[(slotPos + i) % slots.size()];
+			finishSlot(slot);
+			for (size_t character{}; character < counts.size(); ++character)
+			{
+				counts[character] += slot.m_Counts[character];
+			}
+		}
+	}
+	digest = hasher.Finish();
+
+	frequency = MakeFrequency(counts);
+	return result;
+}
+
+auto HuffmanEncoder::GetFrequencyAndHash(const uint8_t* first,
+                                         const uint8_t* last,
+                                         const EncodeOptions& options,
+                                         Progress& progress) -> std::tuple<std::vector<unsigned char>, FrequencyContainer>
+{
+	const size_t chunkSize{1024 * 1024};
+	auto result = std::make_tuple(std::vector<unsigned char>(), FrequencyContainer());
+	auto& [digest, frequency] = result;
+
+	FrequencyCounts counts{};
+	std::vector<FrequencyCounts> sliceCounts;
+	Digest hasher{options.m_DigestAlgorithm};
+	const auto length      = static_cast<size_t>(last - first);
+	const auto workerCount = ThreadPool::ResolveThreadCount(options.m_ThreadCount);
+	if (workerCount <= 1 || length < 2 * chunkSize)
+	{
+		// Count a chunk while it is in cache, then hash it.
+		for (auto chunkPos = first; chunkPos != last;)
+		{
+			const auto chunkLast = chunkPos + (std::min)(chunkSize, static_cast<size_t>(last - chunkPos));
+			CountFrequency(chunkPos, chunkLast, counts);
+			hasher.Update(chunkPos, chunkLast);
+			progress.Advance(static_cast<uint64_t>(chunkLast - chunkPos));
+			chunkPos = chunkLast;
+		}
+	}
+	else if (Digest::Algorithm::Sha256Tree == options.m_DigestAlgorithm)
+	{
+		// Every thread counts and hashes the leaves of a slice, each leaf while it is in cache.
+		const auto leafSize       = Digest::kTreeLeafSize;
+		const auto leafCount      = (length + leafSize - 1) / leafSize;
+		const auto sliceCount     = (std::min)(workerCount, leafCount);
+		const auto leavesPerSlice = (leafCount + sliceCount - 1) / sliceCount;
+		std::vector<Digest::TreeHash> leaves(leafCount);
+		sliceCounts.resize(sliceCount);
+		ThreadPool::ParallelFor(sliceCount, sliceCount, [&](const size_t slicePos)
+		{
+			const auto sliceLast = (std::min)((slicePos + 1) * leavesPerSlice, leafCount);
+			for (auto leaf = slicePos * leavesPerSlice; leaf < sliceLast; ++leaf)
+			{
+				const auto leafFirst = first + leaf * leafSize;
+				const auto leafLast  = first + (std::min)((leaf + 1) * leafSize, length);
+				CountFrequency(leafFirst, leafLast, sliceCounts[slicePos]);
+				leaves[leaf] = Digest::TreeLeaf(leafFirst, leafLast);
+				progress.Advance(static_cast<uint64_t>(leafLast - leafFirst));
+			}
+		});
+		for (size_t leaf{}; leaf < leafCount; ++leaf)
+		{
+			hasher.AppendLeaf(leaves[leaf], (std::min)(leafSize, length - leaf * leafSize));
+		}
+	}
+	else
+	{
+		// The hash thread goes through the whole buffer while the other threads count a slice each.
+		// Hashing is the slower one, so it advances progress.
+		const auto sliceCount  = (std::min)(workerCount - 1, length / chunkSize);
+		const auto sliceLength = (length + sliceCount - 1) / sliceCount;
+		sliceCounts.resize(sliceCount);
+
+		ThreadPool hashThread{1};
+		auto hashed = hashThread.Submit([&hasher, &progress, first, last]()
+		{
+			ForEachPiece(first, last, progress, true, [&hasher](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+			{
+				hasher.Update(pieceFirst, pieceLast);
+			});
+		});
+		ThreadPool::ParallelFor(sliceCount, sliceCount, [&](const size_t slicePos)
+		{
+			const auto sliceFirst = first + slicePos * sliceLength;
+			const auto sliceLast  = first + (std::min)((slicePos + 1) * sliceLength, length);
+			ForEachPiece(sliceFirst, sliceLast, progress, false, [&](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+			{
+				CountFrequency(pieceFirst, pieceLast, sliceCounts[slicePos]);
+			});
+		});
+		hashed.get();
+	}
+	for (const auto& slice : sliceCounts)
+	{
+		for (size_t character{}; character < counts.size(); ++character)
+		{
+			counts[character] += slice[character];
+		}
+	}
+	digest = hasher.Finish();
+
+	frequency = MakeFrequency(counts);
+	return result;
+}
+
+auto HuffmanEncoder::GetFrequency(const uint8_t* first, const uint8_t* last) -> FrequencyContainer
+{
+	FrequencyCounts counts{};
+	CountFrequency(first, last, counts);
+	return MakeFrequency(counts);
+}
+
+auto HuffmanEncoder::CountFrequency(const uint8_t* first, const uint8_t* last, FrequencyCounts& counts) -> void
+{
+	// Clearing the sub-histograms costs more than it saves on short buffers.
+	const size_t kMinSplitLength{4096};
+	if (static_cast<size_t>(last - first) < kMinSplitLength)
+	{
+		for (auto readPos = first; readPos != last; ++readPos)
+		{
+			++counts[*readPos];
+		}
+		return;
+	}
+
+	// Every word of eight characters is spread over four sub-histograms.
+	std::array<FrequencyCounts, 4> subCounts{};
+	auto readPos = first;
+	for (; static_cast<size_t>(last - readPos) >= sizeof(uint64_t); readPos += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, readPos, sizeof(word));
+		++subCounts[0][word & 0xFF];
+		++subCounts[1][(word >> 8) & 0xFF];
+		++subCounts[2][(word >> 16) & 0xFF];
+		++subCounts[3][(word >> 24) & 0xFF];
+		++subCounts[0][(word >> 32) & 0xFF];
+		++subCounts[1][(word >> 40) & 0xFF];
+		++subCounts[2][(word >> 48) & 0xFF];
+		++subCounts[3][word >> 56];
+	}
+	for (; readPos != last; ++readPos)
+	{
+		++subCounts[0][*readPos];
+	}
+	for (size_t character{}; character < counts.size(); ++character)
+	{
+		counts[character] += subCounts[0][character] + subCounts[1][character]
+			+ subCounts[2][character] + subCounts[3][character];
+	}
+}
+
+auto HuffmanEncoder::MakeFrequency(const FrequencyCounts& counts) -> FrequencyContainer
+{
+	FrequencyContainer frequency;
+	for (size_t character{}; character < counts.size(); ++character)
+	{
+		if (counts[character])
+		{
+			frequency[static_cast<char>(character)] = counts[character];
+		}
+	}
+	return frequency;
+}
+
+auto HuffmanEncoder::GenerateTreeFromFrequency(const FrequencyContainer& frequency) -> HuffmanTableMap
+{
+	// Leaves take the front of the node array sorted by frequency, and every merged node is
+	// appended after them. Merged nodes are created in ascending frequency, so the two smallest
+	// nodes are always at the front of either the leaves or the merged nodes.
+	std::array<HuffmanTreeNode, 2 * 256 - 1> nodes{};
+	size_t leafCount{};
+	for (const auto& [character, count] : frequency)
+	{
+		nodes[leafCount++] = HuffmanTreeNode{count, 0, 0, character};
+	}
+	if (0 == leafCount)
+	{
+		return {};
+	}
+	if (1 == leafCount)
+	{
+		// A single character still needs one bit to be decodable.
+		return {{nodes[0].m_Character, std::make_tuple(size_t{1}, 0u)}};
+	}
+	std::sort(nodes.begin(), nodes.begin() + leafCount, [](const HuffmanTreeNode& lhs, const HuffmanTreeNode& rhs)
+	{
+		return std::make_tuple(lhs.m_Frequency, static_cast<uint8_t>(lhs.m_Character))
+		       < std::make_tuple(rhs.m_Frequency, static_cast<uint8_t>(rhs.m_Character));
+	});
+
+	size_t leafPos{}, mergedPos{leafCount}, nodeCount{leafCount};
+	const auto popSmallest = [&]() -> uint16_t
+	{
+		// On equal frequency the leaf goes first, which keeps the tree shallow.
+		if (leafPos < leafCount && (mergedPos == nodeCount || nodes[leafPos].m_Frequency <= nodes[mergedPos].m_Frequency))
+		{
+			return static_cast<uint16_t>(leafPos++);
+		}
+		return static_cast<uint16_t>(mergedPos++);
+	};
+	while (leafCount - leafPos + nodeCount - mergedPos > 1)
+	{
+		const auto left    = popSmallest();
+		const auto right   = popSmallest();
+		nodes[nodeCount++] = HuffmanTreeNode{nodes[left].m_Frequency + nodes[right].m_Frequency, left, right, 0};
+	}
+
+	// Parents always follow their children, so walking from the root down visits every parent
+	// before its children. The bit of depth i is bit i of the reversed encode.
+	std::array<uint32_t, 2 * 256 - 1> encodes{};
+	std::array<uint8_t, 2 * 256 - 1> bitLengths{};
+	for (size_t nodePos = nodeCount; nodePos-- > leafCount;)
+	{
+		const auto& node     = nodes[nodePos];
+		const auto bitLength = bitLengths[nodePos];
+		const auto rightBit  = bitLength < sizeof(uint32_t) * CHAR_BIT ? uint32_t{1} << bitLength : 0;
+		encodes[node.m_LeftChild]     = encodes[nodePos];
+		encodes[node.m_RightChild]    = encodes[nodePos] | rightBit;
+		bitLengths[node.m_LeftChild]  = static_cast<uint8_t>(bitLength + 1);
+		bitLengths[node.m_RightChild] = static_cast<uint8_t>(bitLength + 1);
+	}
+
+	HuffmanTableMap huffmanTable;
+	huffmanTable.reserve(leafCount);
+	for (size_t leaf{}; leaf < leafCount; ++leaf)
+	{
+		huffmanTable[nodes[leaf].m_Character] = std::make_tuple(size_t{bitLengths[leaf]}, unsigned{encodes[leaf]});
+	}
+	return huffmanTable;
+}
+
+auto HuffmanEncoder::GenerateHuffmanTable(const FrequencyContainer& frequency,
+                                          const EncodeOptions& options) -> HuffmanTableMap
+{
+	if (0 == options.m_MaxBitLength || options.m_MaxBitLength > sizeof(uint32_t) * CHAR_BIT)
+	{
+		throw std::invalid_argument("Encode: Invalid max bit length");
+	}
+	auto huffmanTable = GenerateTreeFromFrequency(frequency);
+	for (const auto& item : huffmanTable)
+	{
+		if (std::get<0>(item.second) > options.m_MaxBitLength)
+		{
+			return GenerateLengthLimitedTable(frequency, options.m_MaxBitLength);
+		}
+	}
+	if (TableFormat::Canonical == options.m_TableFormat)
+	{
+		huffmanTable = GenerateCanonicalTable(huffmanTable);
+	}
+	return huffmanTable;
+}
+
+auto HuffmanEncoder::GenerateLengthLimitedTable(const FrequencyContainer& frequency,
+                                                const size_t maxBitLength) -> HuffmanTableMap
+{
+	std::vector<std::tuple<uint64_t, char>> leaves;
+	leaves.reserve(frequency.size());
+	for (const auto& item : frequency)
+	{
+		leaves.emplace_back(item.second, item.first);
+	}
+	std::sort(leaves.begin(), leaves.end());
+
+	if (leaves.size() <= 2)
+	{
+		// Every character takes one bit.
+		HuffmanTableMap huffmanTable;
+		for (const auto& leaf : leaves)
+		{
+			huffmanTable[std::get<1>(leaf)] = std::make_tuple(size_t{1}, 0u);
+		}
+		return GenerateCanonicalTable(huffmanTable);
+	}
+	if (maxBitLength >= sizeof(size_t) * CHAR_BIT || (size_t{1} << maxBitLength) < leaves.size())
+	{
+		throw std::invalid_argument("Max bit length is too short for the characters");
+	}
+
+	// levels[i] flags which items of the list at depth (maxBitLength - i) are leaves.
+	// Each list merges the leaves with the packages of adjacent pairs of the deeper list.
+	std::vector<std::vector<bool>> levels{std::vector<bool>(leaves.size(), true)};
+	std::vector<uint64_t> weights;
+	for (const auto& leaf : leaves)
+	{
+		weights.push_back(std::get<0>(leaf));
+	}
+	for (size_t depth{1}; depth < maxBitLength; ++depth)
+	{
+		std::vector<uint64_t> merged;
+		std::vector<bool> isLeaf;
+		merged.reserve(leaves.size() + weights.size() / 2);
+		size_t leafPos{}, packagePos{};
+		while (leafPos < leaves.size() || packagePos + 1 < weights.size())
+		{
+			const bool takeLeaf = packagePos + 1 >= weights.size()
+			                      || (leafPos < leaves.size()
+			                          && std::get<0>(leaves[leafPos]) <= weights[packagePos] + weights[packagePos + 1]);
+			if (takeLeaf)
+			{
+				merged.push_back(std::get<0>(leaves[leafPos++]));
+			}
+			else
+			{
+				merged.push_back(weights[packagePos] + weights[packagePos + 1]);
+				packagePos += 2;
+			}
+			isLeaf.push_back(takeLeaf);
+		}
+		weights = std::move(merged);
+		levels.push_back(std::move(isLeaf));
+	}
+
+	// Select the first 2n-2 items of the shallowest list, every selected package selects two items
+	// of the deeper list. A character's bit length is the number of lists its leaf is selected in,
+	// and the selected leaves of a list are always the lightest ones.
+	std::vector<size_t> bitLengths(leaves.size());
+	size_t selected = 2 * leaves.size() - 2;
+	for (auto level = levels.rbegin(); level != levels.rend() && selected; ++level)
+	{
+		size_t leafCount{};
+		for (size_t i{}; i < selected; ++i)
+		{
+			leafCount += (*level)[i] ? 1 : 0;
+		}
+		for (size_t i{}; i < leafCount; ++i)
+		{
+			++bitLengths[i];
+		}
+		selected = 2 * (selected - leafCount);
+	}
+
+	HuffmanTableMap huffmanTable;
+	for (size_t i{}; i < leaves.size(); ++i)
+	{
+		huffmanTable[std::get<1>(leaves[i])] = std::make_tuple(bitLengths[i], 0u);
+	}
+	return GenerateCanonicalTable(huffmanTable);
+}
+
+auto HuffmanEncoder::SerializeHuffmanTable(const HuffmanTableMap& huffmanTable) -> std::vector<uint8_t>
+{
+	std::vector<uint8_t> buffer;
+	buffer.reserve(sizeof(SerializedHuffmanTableItem) * huffmanTable.size());
+	SerializedHuffmanTableItem huffmanTableItem{};
+
+	for (const auto& item : huffmanTable)
+	{
+		const auto& [character, pair]   = item;
+		const auto& [bitLength, encode] = pair;
+		huffmanTableItem.m_Character    = character;
+		if (bitLength > (std::numeric_limits<uint8_t>::max)())
+		{
+			throw(std::overflow_error("Huffman bitLength overflow."));
+		}
+		huffmanTableItem.m_BitLength = static_cast<uint8_t>(bitLength);
+
+		if (encode > (std::numeric_limits<uint16_t>::max)())
+		{
+			throw(std::overflow_error("Huffman encode overflow."));
+		}
+		huffmanTableItem.m_Encode = static_cast<uint16_t>(encode);
+
+		std::copy(reinterpret_cast<uint8_t*>(&huffmanTableItem),
+		          reinterpret_cast<uint8_t*>(&huffmanTableItem) + sizeof(SerializedHuffmanTableItem),
+		          std::back_inserter(buffer));
+	}
+
+	return buffer;
+}
+
+auto HuffmanEncoder::BuildEncodeTable(const HuffmanTableMap& huffmanTable) -> EncodeTable
+{
+	EncodeTable table{};
+	for (const auto& [character, pair] : huffmanTable)
+	{
+		const auto& [bitLength, encode] = pair;
+		if (0 == bitLength || bitLength > sizeof(uint32_t) * CHAR_BIT)
+		{
+			throw std::invalid_argument("Invalid huffman code length");
+		}
+		table[static_cast<uint8_t>(character)] = EncodeTableItem{encode, static_cast<uint32_t>(bitLength)};
+	}
+	return table;
+}
+
+auto HuffmanEncoder::EncodeChunk(const EncodeTable& table,
+                                 BitWriter& bitWriter,
+                                 const uint8_t* first,
+                                 const uint8_t* last) -> void
+{
+	for (auto readPos = first; readPos != last; ++readPos)
+	{
+		const auto& item = table[*readPos];
+		if (0 == item.m_BitLength)
+		{
+			throw std::runtime_error("Unknown character");
+		}
+		bitWriter.Push(item.m_Encode, item.m_BitLength);
+	}
+}
+
+auto HuffmanEncoder::EncodeBlock(const EncodeTable& table,
+                                 const uint8_t* first,
+                                 const uint8_t* last,
+                                 std::vector<uint8_t>& output,
+                                 Progress& progress) -> uint64_t
+{
+	const auto outputPos = output.size();
+	auto bitWriter       = BitWriter(output);
+	ForEachPiece(first, last, progress, true, [&](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+	{
+		EncodeChunk(table, bitWriter, pieceFirst, pieceLast);
+	});
+	bitWriter.Flush();
+
+	const auto bitLength = static_cast<uint64_t>(output.size() - outputPos) * CHAR_BIT + bitWriter.RedundancyBit();
+	if (bitWriter.RedundancyBit())
+	{
+		output.push_back(bitWriter.Unpacked());
+	}
+	return bitLength;
+}
+
+auto HuffmanEncoder::EncodeBlocks(std::istream& source,
+                                  std::ostream& destination,
+                                  const EncodeTable& table,
+                                  const uint64_t sourceLength,
+                                  const EncodeOptions& options,
+                                  Workspace& workspace,
+                                  Progress& progress) -> uint64_t
+{
+	auto indexHeader         = SerializedBlockIndexHeader{};
+	indexHeader.m_BlockSize  = options.m_BlockSize;
+	indexHeader.m_BlockCount = (sourceLength + options.m_BlockSize - 1) / options.m_BlockSize;
+	auto index               = std::vector<SerializedBlockIndexItem>(indexHeader.m_BlockCount);
+	auto checksums           = std::vector<uint32_t>(options.m_BlockChecksum ? index.size() : 0);
+
+	// Reserve the block index and checksums, they are rewritten once every block is written.
+	const auto indexPos   = destination.tellp();
+	const auto writeIndex = [&]()
+	{
+		destination.write(reinterpret_cast<const char*>(&indexHeader), sizeof(indexHeader));
+		destination.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(SerializedBlockIndexItem));
+		destination.write(reinterpret_cast<const char*>(checksums.data()), checksums.size() * sizeof(uint32_t));
+	};
+	writeIndex();
+
+	// Blocks of a batch are encoded concurrently while the next batch is read.
+	// The buffers outlive the pool, so pending tasks are safe when an exception unwinds.
+	const auto batchSize = ThreadPool::ResolveThreadCount(options.m_ThreadCount) * 2;
+	auto& readBuffers    = workspace.m_BatchReadBuffers;
+	auto& writeBuffers   = workspace.m_BatchWriteBuffers;
+	auto batchChecksums  = std::vector<uint32_t>(batchSize);
+	readBuffers[0].resize(batchSize);
+	readBuffers[1].resize(batchSize);
+	writeBuffers.resize(batchSize);
+	ThreadPool threadPool{options.m_ThreadCount};
+	const auto readBatch = [&](std::vector<std::vector<uint8_t>>& buffers) -> size_t
+	{
+		size_t count{};
+		for (; count < batchSize && source; ++count)
+		{
+			buffers[count].resize(options.m_BlockSize);
+			source.read(reinterpret_cast<char*>(buffers[count].data()), options.m_BlockSize);
+			buffers[count].resize(static_cast<size_t>(source.gcount()));
+			if (buffers[count].empty())
+			{
+				break;
+			}
+		}
+		return count;
+	};
+
+	uint64_t blockPos{}, offset{}, payloadBitLength{};
+	auto count = readBatch(readBuffers[0]);
+	for (size_t batch{}; count; ++batch)
+	{
+		auto& buffers = readBuffers[batch % 2];
+		std::vector<std::future<uint64_t>> bitLengths;
+		for (size_t i{}; i < count; ++i)
+		{
+			bitLengths.push_back(threadPool.Submit([&, i]()
+			{
+				const auto first = buffers[i].data();
+				const auto last  = first + buffers[i].size();
+				if (options.m_BlockChecksum)
+				{
+					batchChecksums[i] = Digest::Crc32c(first, last);
+				}
+				writeBuffers[i].clear();
+				return EncodeBlock(table, first, last, writeBuffers[i], progress);
+			}));
+		}
+		const auto nextCount = readBatch(readBuffers[(batch + 1) % 2]);
+
+		for (size_t i{}; i < count; ++i, ++blockPos)
+		{
+			const auto bitLength = bitLengths[i].get();
+			if (blockPos >= index.size())
+			{
+				throw std::runtime_error("Encode: Source changed while encoding");
+			}
+			index[blockPos] = SerializedBlockIndexItem{offset, bitLength};
+			if (options.m_BlockChecksum)
+			{
+				checksums[blockPos] = batchChecksums[i];
+			}
+			payloadBitLength += bitLength;
+			destination.write(reinterpret_cast<const char*>(writeBuffers[i].data()), writeBuffers[i].size());
+			offset += writeBuffers[i].size();
+		}
+		count = nextCount;
+	}
+	if (blockPos != index.size())
+	{
+		throw std::runtime_error("Encode: Source changed while encoding");
+	}
+
+	destination.seekp(indexPos);
+	writeIndex();
+	return payloadBitLength;
+}
+
+auto HuffmanEncoder::DecodeBlocks(std::istream& source,
+                                  std::ostream& destination,
+                                  const DecodeTable& table,
+                                  const SerializedBlockIndexHeader& indexHeader,
+                                  const std::vector<SerializedBlockIndexItem>& index,
+                                  const std::vector<uint32_t>& checksums,
+                                  const uint64_t sourceLength,
+                                  const bool isLengthRecorded,
+                                  const DecodeOptions& options,
+                                  Workspace& workspace,
+                                  Progress& progress) -> void
+{
+	// Blocks of a batch are decoded concurrently while the next batch is read, and written in order.
+	// The buffers outlive the pool, so pending tasks are safe when an exception unwinds.
+	const auto batchSize = ThreadPool::ResolveThreadCount(options.m_ThreadCount) * 2;
+	auto& readBuffers    = workspace.m_BatchReadBuffers;
+	auto& writeBuffers   = workspace.m_BatchWriteBuffers;
+	readBuffers[0].resize(batchSize);
+	readBuffers[1].resize(batchSize);
+	writeBuffers.resize(batchSize);
+	const auto blockLength = [](const SerializedBlockIndexItem& item)
+	{
+		return item.m_BitLength / CHAR_BIT + (0 != item.m_BitLength % CHAR_BIT);
+	};
+	// The bit lengths come from the file, a seekable source tells up front if the blocks don't fit in it.
+	if (std::streampos(-1) != source.tellg())
+	{
+		auto bytesLeft = RemainingLength(source);
+		for (const auto& item : index)
+		{
+			if (blockLength(item) > bytesLeft)
+			{
+				throw std::runtime_error("Decode: Truncated block");
+			}
+			bytesLeft -= blockLength(item);
+		}
+	}
+
+	ThreadPool threadPool{options.m_ThreadCount};
+	const auto readBatch = [&](std::vector<std::vector<uint8_t>>& buffers, const size_t firstBlock) -> size_t
+	{
+		const auto count = static_cast<size_t>((std::min)(static_cast<uint64_t>(batchSize), index.size() - firstBlock));
+		for (size_t i{}; i < count; ++i)
+		{
+			// Grow with the stream instead of trusting the bit length, a pipe can't tell its length up front.
+			const auto length = blockLength(index[firstBlock + i]);
+			auto& buffer      = buffers[i];
+			buffer.clear();
+			while (buffer.size() < length)
+			{
+				const auto readPos    = buffer.size();
+				const auto readLength = static_cast<size_t>((std::min)(uint64_t{kProgressChunkSize}, length - readPos));
+				buffer.resize(readPos + readLength);
+				source.read(reinterpret_cast<char*>(buffer.data() + readPos), static_cast<std::streamsize>(readLength));
+				if (static_cast<size_t>(source.gcount()) != readLength)
+				{
+					throw std::runtime_error("Decode: Truncated block");
+				}
+			}
+		}
+		return count;
+	};
+
+	size_t blockPos{};
+	auto count = readBatch(readBuffers[0], blockPos);
+	for (size_t batch{}; count; ++batch)
+	{
+		auto& buffers = readBuffers[batch % 2];
+		std::vector<std::future<bool>> results;
+		for (size_t i{}; i < count; ++i)
+		{
+			results.push_back(threadPool.Submit([&, i, block = blockPos + i]()
+			{
+				auto state       = DecodeState{};
+				state.m_BitsLeft = index[block].m_BitLength;
+				auto& output     = writeBuffers[i];
+				output.clear();
+				// The block size comes from the file, every code is one bit at least, which bounds it by the bits read.
+				output.reserve(static_cast<size_t>((std::min)(indexHeader.m_BlockSize, index[block].m_BitLength)));
+				const auto first = buffers[i].data();
+				ForEachPiece(first, first + buffers[i].size(), progress, true,
+				             [&](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+				             {
+					             DecodeChunk(table, state, pieceFirst, pieceLast, output);
+				             });
+				// Every block but the last one holds exactly m_BlockSize characters,
+				// the last one holds the rest of source where its length is recorded.
+				const bool isLastBlock = block + 1 == index.size();
+				const auto offset      = block * indexHeader.m_BlockSize;
+				const auto lastLength  = offset < sourceLength ? (std::min)(indexHeader.m_BlockSize, sourceLength - offset) : 0;
+				if (output.size() > indexHeader.m_BlockSize
+					|| (!isLastBlock && output.size() != indexHeader.m_BlockSize)
+					|| (isLastBlock && isLengthRecorded && output.size() != lastLength))
+				{
+					return false;
+				}
+				return checksums.empty() || Digest::Crc32c(output.data(), output.data() + output.size()) == checksums[block];
+			}));
+		}
+		const auto nextCount = readBatch(readBuffers[(batch + 1) % 2], blockPos + count);
+
+		for (size_t i{}; i < count; ++i, ++blockPos)
+		{
+			auto isIntact = false;
+			try
+			{
+				isIntact = results[i].get();
+			}
+			catch (const CancelledError&)
+			{
+				throw;
+			}
+			catch (const std::runtime_error&)
+			{
+				// A code beyond the block is damage of the block too.
+			}
+			if (!isIntact)
+			{
+				if (!options.m_OnDamagedBlock)
+				{
+					throw std::runtime_error("Decode: Damaged block");
+				}
+				// Zero filled, so the blocks after it keep their place.
+				const auto offset = blockPos * indexHeader.m_BlockSize;
+				const auto length = offset < sourceLength ? (std::min)(indexHeader.m_BlockSize, sourceLength - offset) : 0;
+				options.m_OnDamagedBlock(offset, length);
+				writeBuffers[i].assign(static_cast<size_t>(length), 0);
+			}
+			WriteDecoded(destination, writeBuffers[i], workspace);
+		}
+		count = nextCount;
+	}
+}
+
+auto HuffmanEncoder::DecodeStream(std::istream& source,
+                                  std::ostream& destination,
+                                  const DecodeOptions& options,
+                                  Workspace& workspace,
+                                  Progress& progress) -> std::vector<unsigned char>
+{
+	auto clock        = PhaseClock{options.m_Stats};
+	auto& readBuffer  = workspace.m_ReadBuffer;
+	auto& writeBuffer = workspace.m_WriteBuffer;
+	auto& table       = workspace.m_DecodeTable;
+	uint64_t encodedLength{sizeof(kStreamMagic)}, payloadBitLength{};
+	size_t symbolCount{};
+	SerializedFrameHeader frameHeader{};
+	for (bool isFirstFrame{true};; isFirstFrame = false)
+	{
+		source.read(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader));
+		if (!source)
+		{
+			throw std::runtime_error("Decode: Truncated stream");
+		}
+		if (!Digest::IsKnown(frameHeader.m_DigestAlgorithm))
+		{
+			throw std::runtime_error("Decode: Unknown digest algorithm");
+		}
+		if (isFirstFrame)
+		{
+			StartOutputDigest(frameHeader.m_DigestAlgorithm, workspace);
+		}
+		if (0 == frameHeader.m_SourceLength)
+		{
+			break;
+		}
+		// Codes are 32 bits at most, anything larger is a damaged header.
+		if (frameHeader.m_SourceLength > kMaxFrameSize
+			|| frameHeader.m_BitLength > frameHeader.m_SourceLength * sizeof(uint32_t) * CHAR_BIT
+			|| frameHeader.m_TableLength > 256)
+		{
+			throw std::runtime_error("Decode: Corrupted frame");
+		}
+
+		readBuffer.resize(frameHeader.m_TableLength);
+		source.read(reinterpret_cast<char*>(readBuffer.data()), readBuffer.size());
+		const auto decodeMap = UnSerializeDecodeHuffmanTable(TableFormat::Canonical, readBuffer);
+		clock.Lap(&CodecStats::m_TableSerializeTime);
+		BuildDecodeTable(decodeMap, table);
+		clock.Lap(&CodecStats::m_TreeBuildTime);
+
+		// Read and decode in pieces, the header can't size a buffer and a pipe can't tell if the frame is all there.
+		const size_t readSize  = 64 * 1024;
+		const auto frameLength = frameHeader.m_BitLength / CHAR_BIT + (0 != frameHeader.m_BitLength % CHAR_BIT);
+		auto state             = DecodeState{};
+		state.m_BitsLeft       = frameHeader.m_BitLength;
+		uint64_t bytesLeft{frameLength}, frameOutput{};
+		readBuffer.resize(readSize);
+		progress.Advance(sizeof(frameHeader) + frameHeader.m_TableLength);
+		while (bytesLeft)
+		{
+			const auto readLength = static_cast<size_t>((std::min)(uint64_t{readSize}, bytesLeft));
+			source.read(reinterpret_cast<char*>(readBuffer.data()), static_cast<std::streamsize>(readLength));
+			if (static_cast<size_t>(source.gcount()) != readLength)
+			{
+				throw std::runtime_error("Decode: Truncated stream");
+			}
+			writeBuffer.clear();
+			DecodeChunk(table, state, readBuffer.data(), readBuffer.data() + readLength, writeBuffer);
+			frameOutput += writeBuffer.size();
+			if (frameOutput > frameHeader.m_SourceLength)
+			{
+				throw std::runtime_error("Decode: Corrupted frame");
+			}
+			WriteDecoded(destination, writeBuffer, workspace);
+			bytesLeft -= readLength;
+			progress.Advance(readLength);
+		}
+		if (frameOutput != frameHeader.m_SourceLength)
+		{
+			throw std::runtime_error("Decode: Corrupted frame");
+		}
+		clock.Lap(&CodecStats::m_PayloadTime);
+
+		encodedLength += sizeof(frameHeader) + frameHeader.m_TableLength + frameLength;
+		payloadBitLength += frameHeader.m_BitLength;
+		symbolCount = (std::max)(symbolCount, SymbolCount(decodeMap));
+	}
+
+	std::vector<unsigned char> digest(Digest::Length(frameHeader.m_DigestAlgorithm));
+	source.read(reinterpret_cast<char*>(digest.data()), digest.size());
+	if (!source)
+	{
+		throw std::runtime_error("Decode: Truncated stream");
+	}
+	progress.Advance(sizeof(frameHeader) + digest.size());
+	destination.flush();
+	clock.Lap(&CodecStats::m_FlushTime);
+
+	if (options.m_Stats)
+	{
+		encodedLength += sizeof(frameHeader) + digest.size();
+		SetCounters(options.m_Stats, encodedLength, workspace.m_DecodedLength, workspace.m_DecodedLength, payloadBitLength);
+		options.m_Stats->m_SymbolCount = symbolCount;
+	}
+	return digest;
+}
+
+auto HuffmanEncoder::EncodeBound(const uint64_t sourceLength, const EncodeOptions& options) noexcept -> uint64_t
+{
+	// No code is longer than m_MaxBitLength, and every block may end with a partial byte.
+	const uint64_t maxBitLength   = options.m_MaxBitLength ? options.m_MaxBitLength : sizeof(uint32_t) * CHAR_BIT;
+	const uint64_t blockCount     = options.m_BlockSize ? (sourceLength + options.m_BlockSize - 1) / options.m_BlockSize : 1;
+	const uint64_t tableLength    = 256 * sizeof(SerializedHuffmanTableItem);
+	const uint64_t indexLength    =
+		options.m_BlockSize ? sizeof(SerializedBlockIndexHeader) + blockCount * sizeof(SerializedBlockIndexItem) : 0;
+	const uint64_t checksumLength = options.m_BlockSize && options.m_BlockChecksum ? blockCount * sizeof(uint32_t) : 0;
+	return sizeof(SerializedHuffmanTableMetaData) + tableLength + indexLength + checksumLength
+	       + (sourceLength * maxBitLength + CHAR_BIT - 1) / CHAR_BIT + blockCount;
+}
+
+auto HuffmanEncoder::EncodeBuffer(const uint8_t* source,
+                                  const size_t sourceLength,
+                                  uint8_t* output,
+                                  const size_t outputLength,
+                                  const EncodeOptions& options) -> size_t
+{
+	Workspace workspace;
+	return EncodeBuffer(source, sourceLength, output, outputLength, options, workspace);
+}
+
+auto HuffmanEncoder::EncodeBuffer(const uint8_t* source,
+                                  const size_t sourceLength,
+                                  uint8_t* output,
+                                  const size_t outputLength,
+                                  const EncodeOptions& options,
+                                  Workspace& workspace) -> size_t
+{
+	auto clock    = StartStats(options.m_Stats);
+	auto progress = Progress{options, 2 * uint64_t{sourceLength}};
+	auto& layout  = workspace.m_EncodeLayout;
+	PrepareEncodeLayout(source, source + sourceLength, options, layout, progress);
+	if (layout.m_EncodedLength > outputLength)
+	{
+		throw std::length_error("EncodeBuffer: Output buffer is too small");
+	}
+	EncodeMemory(source, layout, output, options, progress);
+	SetCounters(options.m_Stats, sourceLength, layout.m_EncodedLength, sourceLength, layout.m_MetaData.m_PayloadBitLength);
+	clock.Stop();
+	progress.Finish();
+	return static_cast<size_t>(layout.m_EncodedLength);
+}
+
+auto HuffmanEncoder::DecodeBound(const uint8_t* source, const size_t sourceLength) -> uint64_t
+{
+	MemoryDecodeLayout layout{};
+	if (ReadDecodeLayout(source, sourceLength, layout, nullptr))
+	{
+		return layout.m_MetaData.m_SourceLength;
+	}
+	// Every code is one bit at least.
+	return uint64_t{sourceLength} * CHAR_BIT;
+}
+
+auto HuffmanEncoder::DecodeBuffer(const uint8_t* source,
+                                  const size_t sourceLength,
+                                  uint8_t* output,
+                                  const size_t outputLength,
+                                  const DecodeOptions& options) -> std::tuple<size_t, std::vector<unsigned char>>
+{
+	Workspace workspace;
+	return DecodeBuffer(source, sourceLength, output, outputLength, options, workspace);
+}
+
+auto HuffmanEncoder::DecodeBuffer(const uint8_t* source,
+                                  const size_t sourceLength,
+                                  uint8_t* output,
+                                  const size_t outputLength,
+                                  const DecodeOptions& options,
+                                  Workspace& workspace) -> std::tuple<size_t, std::vector<unsigned char>>
+{
+	auto clock   = StartStats(options.m_Stats);
+	auto& layout = workspace.m_DecodeLayout;
+	if (!ReadDecodeLayout(source, sourceLength, layout, options.m_Stats))
+	{
+		// The length of output is unknown up front, decode through streams over both buffers.
+		auto sourceBuffer      = MemoryBuffer{source, sourceLength};
+		auto destinationBuffer = MemoryOutputBuffer{output, outputLength};
+		auto sourceStream      = std::istream{&sourceBuffer};
+		auto destinationStream = std::ostream{&destinationBuffer};
+		auto digest            = Decode(sourceStream, destinationStream, options, workspace);
+		if (!destinationStream)
+		{
+			throw std::length_error("DecodeBuffer: Output buffer is too small");
+		}
+		return std::make_tuple(destinationBuffer.Written(), std::move(digest));
+	}
+	const auto& metaData = layout.m_MetaData;
+	if (metaData.m_SourceLength > outputLength)
+	{
+		throw std::length_error("DecodeBuffer: Output buffer is too small");
+	}
+	auto progress = Progress{options, sourceLength};
+	progress.Advance(static_cast<uint64_t>(layout.m_Payload - source));
+	DecodeMemory(layout, output, options, progress);
+	SetCounters(options.m_Stats, sourceLength, metaData.m_SourceLength, metaData.m_SourceLength, metaData.m_PayloadBitLength);
+	clock.Stop();
+	progress.Finish();
+	return std::make_tuple(static_cast<size_t>(metaData.m_SourceLength), GetDigest(metaData));
+}
+
+auto HuffmanEncoder::PrepareEncodeLayout(const uint8_t* first,
+                                         const uint8_t* last,
+                                         const EncodeOptions& options,
+                                         MemoryEncodeLayout& layout,
+                                         Progress& progress) -> void
+{
+	auto clock              = PhaseClock{options.m_Stats};
+	auto [hash, frequency]  = GetFrequencyAndHash(first, last, options, progress);
+	const auto sourceLength = static_cast<uint64_t>(last - first);
+	clock.Lap(&CodecStats::m_FrequencyAndHashTime);
+
+	const auto huffmanTable = GenerateHuffmanTable(frequency, options);
+	layout.m_EncodeTable    = BuildEncodeTable(huffmanTable);
+	clock.Lap(&CodecStats::m_TreeBuildTime);
+
+	layout.m_SerializedTable = TableFormat::Canonical == options.m_TableFormat
+		                           ? SerializeCanonicalHuffmanTable(huffmanTable)
+		                           : SerializeHuffmanTable(huffmanTable);
+	auto& metaData = layout.m_MetaData;
+	metaData       = MakeMetaData(hash, sourceLength, layout.m_SerializedTable.size(), options);
+	clock.Lap(&CodecStats::m_TableSerializeTime);
+	if (options.m_Stats)
+	{
+		options.m_Stats->m_SymbolCount = huffmanTable.size();
+		options.m_Stats->m_Entropy     = Entropy(frequency);
+	}
+
+	const uint64_t blockSize = options.m_BlockSize ? options.m_BlockSize : (std::max)(sourceLength, uint64_t{1});
+	layout.m_IndexHeader     = SerializedBlockIndexHeader{blockSize, (sourceLength + blockSize - 1) / blockSize};
+	auto& index              = layout.m_Index;
+	index.assign(static_cast<size_t>(layout.m_IndexHeader.m_BlockCount), SerializedBlockIndexItem{});
+	auto& checksums = layout.m_Checksums;
+	checksums.assign(options.m_BlockSize && options.m_BlockChecksum ? index.size() : 0, 0);
+
+	// The bit length of every block places the blocks in output.
+	if (options.m_BlockSize)
+	{
+		const auto& encodeTable = layout.m_EncodeTable;
+		ThreadPool::ParallelFor(index.size(), options.m_ThreadCount, [&, first, blockSize](const size_t block)
+		{
+			const auto blockFirst = first + block * blockSize;
+			const auto blockLast  = first + (std::min)((block + 1) * blockSize, sourceLength);
+			if (!checksums.empty())
+			{
+				checksums[block] = Digest::Crc32c(blockFirst, blockLast);
+			}
+			uint64_t bitLength{};
+			ForEachPiece(blockFirst, blockLast, progress, false, [&](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+			{
+				for (auto readPos = pieceFirst; readPos != pieceLast; ++readPos)
+				{
+					bitLength += encodeTable[*readPos].m_BitLength;
+				}
+			});
+			index[block].m_BitLength = bitLength;
+		});
+	}
+	else if (!index.empty())
+	{
+		for (const auto& [character, count] : frequency)
+		{
+			index[0].m_BitLength += uint64_t{count} * layout.m_EncodeTable[static_cast<uint8_t>(character)].m_BitLength;
+		}
+	}
+	uint64_t payloadLength{};
+	for (auto& item : index)
+	{
+		item.m_Offset = payloadLength;
+		payloadLength += (item.m_BitLength + CHAR_BIT - 1) / CHAR_BIT;
+		metaData.m_PayloadBitLength += item.m_BitLength;
+	}
+	if (!options.m_BlockSize)
+	{
+		// Bits used in the last byte, as the stream path writes it, a full last byte is 8.
+		const auto lastBits      = static_cast<uint8_t>(metaData.m_PayloadBitLength % CHAR_BIT);
+		metaData.m_RedundancyBit = lastBits ? lastBits : metaData.m_PayloadBitLength ? uint8_t{CHAR_BIT} : uint8_t{0};
+	}
+
+	const size_t indexLength =
+		options.m_BlockSize ? sizeof(SerializedBlockIndexHeader) + index.size() * sizeof(SerializedBlockIndexItem) : 0;
+	layout.m_HeaderLength  = sizeof(metaData) + layout.m_SerializedTable.size() + indexLength
+	                         + checksums.size() * sizeof(uint32_t);
+	layout.m_EncodedLength = layout.m_HeaderLength + payloadLength;
+	// Counting the bit length of blocks is the first half of encoding them.
+	clock.Lap(&CodecStats::m_PayloadTime);
+}
+
+auto HuffmanEncoder::EncodeMemory(const uint8_t* first,
+                                  const MemoryEncodeLayout& layout,
+                                  uint8_t* output,
+                                  const EncodeOptions& options,
+                                  Progress& progress) -> void
+{
+	auto clock = PhaseClock{options.m_Stats};
+	auto write = [writePos = output](const void* data, const size_t length) mutable
+	{
+		writePos = std::copy_n(static_cast<const uint8_t*>(data), length, writePos);
+	};
+	write(&layout.m_MetaData, sizeof(layout.m_MetaData));
+	write(layout.m_SerializedTable.data(), layout.m_SerializedTable.size());
+	if (options.m_BlockSize)
+	{
+		write(&layout.m_IndexHeader, sizeof(layout.m_IndexHeader));
+		write(layout.m_Index.data(), layout.m_Index.size() * sizeof(SerializedBlockIndexItem));
+		write(layout.m_Checksums.data(), layout.m_Checksums.size() * sizeof(uint32_t));
+	}
+
+	// Blocks are encoded into disjoint ranges of output.
+	auto* payload           = output + layout.m_HeaderLength;
+	const auto blockSize    = layout.m_IndexHeader.m_BlockSize;
+	const auto sourceLength = layout.m_MetaData.m_SourceLength;
+	ThreadPool::ParallelFor(layout.m_Index.size(), options.m_ThreadCount, [&, first, payload](const size_t block)
+	{
+		const auto& item = layout.m_Index[block];
+		auto* blockFirst = payload + item.m_Offset;
+		auto* blockLast  = blockFirst + (item.m_BitLength + CHAR_BIT - 1) / CHAR_BIT;
+		auto bitWriter   = BitWriter(blockFirst, blockLast);
+		ForEachPiece(first + block * blockSize,
+		             first + (std::min)((block + 1) * blockSize, sourceLength),
+		             progress,
+		             true,
+		             [&](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+		             {
+			             EncodeChunk(layout.m_EncodeTable, bitWriter, pieceFirst, pieceLast);
+		             });
+		bitWriter.Flush();
+		if (bitWriter.RedundancyBit())
+		{
+			*(blockLast - 1) = bitWriter.Unpacked();
+		}
+	});
+	clock.Lap(&CodecStats::m_PayloadTime);
+}
+
+auto HuffmanEncoder::ReadDecodeLayout(const uint8_t* source,
+                                      const size_t length,
+                                      MemoryDecodeLayout& layout,
+                                      CodecStats* stats) -> bool
+{
+	auto clock        = PhaseClock{stats};
+	auto sourceBuffer = MemoryBuffer{source, length};
+	auto sourceStream = std::istream{&sourceBuffer};
+
+	auto& metaData = layout.m_MetaData;
+	metaData       = SerializedHuffmanTableMetaData{};
+	sourceStream.read(reinterpret_cast<char*>(&metaData), sizeof(kStreamMagic));
+	if (std::equal(std::begin(kStreamMagic), std::end(kStreamMagic), reinterpret_cast<const char*>(&metaData)))
+	{
+		return false;
+	}
+	ReadMetaData(sourceStream, metaData, sizeof(kStreamMagic));
+	if (!(metaData.m_Flags & kPayloadLengthFlag))
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> huffmanTableBuffer(metaData.m_TableLength);
+	sourceStream.read(reinterpret_cast<char*>(huffmanTableBuffer.data()), metaData.m_TableLength);
+	const auto decodeMap = UnSerializeDecodeHuffmanTable(metaData.m_TableFormat, huffmanTableBuffer);
+	clock.Lap(&CodecStats::m_TableSerializeTime);
+	BuildDecodeTable(decodeMap, layout.m_Table);
+	clock.Lap(&CodecStats::m_TreeBuildTime);
+	if (stats)
+	{
+		stats->m_SymbolCount = SymbolCount(decodeMap);
+	}
+
+	layout.m_IndexHeader = SerializedBlockIndexHeader{(std::max)(metaData.m_SourceLength, uint64_t{1}), 1};
+	layout.m_Index       = {SerializedBlockIndexItem{0, metaData.m_PayloadBitLength}};
+	layout.m_Checksums.clear();
+	if (metaData.m_Flags & kBlockIndexFlag)
+	{
+		std::tie(layout.m_IndexHeader, layout.m_Index) = ReadBlockIndex(sourceStream);
+		layout.m_Checksums = ReadBlockChecksums(sourceStream, metaData, layout.m_Index.size());
+	}
+	if (!sourceStream)
+	{
+		throw std::runtime_error("Decode: Truncated file");
+	}
+	layout.m_Payload          = source + static_cast<size_t>(sourceStream.tellg());
+	const auto payloadLength  = static_cast<uint64_t>(source + length - layout.m_Payload);
+	const auto& indexHeader   = layout.m_IndexHeader;
+	const auto expectedBlocks = (metaData.m_SourceLength + indexHeader.m_BlockSize - 1) / indexHeader.m_BlockSize;
+	// Every code is one bit at least, which bounds the output by the payload.
+	if (metaData.m_SourceLength > metaData.m_PayloadBitLength
+		|| metaData.m_PayloadBitLength > payloadLength * CHAR_BIT
+		|| (expectedBlocks != layout.m_Index.size() && metaData.m_SourceLength))
+	{
+		throw std::runtime_error("Decode: Corrupted file");
+	}
+	for (const auto& item : layout.m_Index)
+	{
+		if (item.m_Offset > payloadLength || (item.m_BitLength + CHAR_BIT - 1) / CHAR_BIT > payloadLength - item.m_Offset)
+		{
+			throw std::runtime_error("Decode: Truncated block");
+		}
+	}
+	// An empty source has no block.
+	layout.m_Index.resize(static_cast<size_t>(expectedBlocks));
+	clock.Lap(&CodecStats::m_TableSerializeTime);
+	return true;
+}
+
+HuffmanEncoder::OutputDigester::OutputDigester(Digest& digest,
+                                               const uint8_t* output,
+                                               const MemoryDecodeLayout& layout,
+                                               const size_t threadCount)
+	: m_Digest(digest)
+	, m_Output(output)
+	, m_Length(layout.m_MetaData.m_SourceLength)
+	, m_BlockSize(layout.m_IndexHeader.m_BlockSize)
+	, m_LeafThreadCount(1)
+	, m_IsDone(layout.m_Index.size())
+{
+	if (Digest::Algorithm::Sha256Tree != digest.GetAlgorithm())
+	{
+		return;
+	}
+	// Threads the blocks leave idle, a single block hashes its leaves on all of them.
+	const auto leafCount = static_cast<size_t>((m_Length + Digest::kTreeLeafSize - 1) / Digest::kTreeLeafSize);
+	m_LeafThreadCount    = (std::max)(ThreadPool::ResolveThreadCount(threadCount) / (std::max)(m_IsDone.size(), size_t{1}),
+	                                  size_t{1});
+	m_Leaves.resize(leafCount);
+	m_LeafBytesLeft.resize(leafCount, Digest::kTreeLeafSize);
+	if (leafCount)
+	{
+		m_LeafBytesLeft.back() = m_Length - (leafCount - 1) * Digest::kTreeLeafSize;
+	}
+}
 
-	// Decode file
-	const size_t unitSize        = 8;
-	auto writeBuffer             = std::vector<uint8_t>();
-	auto endPos                  = std::istreambuf_iterator<char>();
-	const uint8_t mask[unitSize] = {0x1, 0x3, 0x7, 0xF, 0x1f, 0x3f, 0x7f, 0xff};
-	uint8_t bitPos               = 0;
-	unsigned int encode          = 0;
-	size_t bitLength             = 1;
-	for (auto readPos{std::istreambuf_iterator<char>(source)}; readPos != endPos; ++readPos)
+auto HuffmanEncoder::OutputDigester::Done(const size_t block, Progress& progress) -> void
+{
+	const auto first = block * m_BlockSize;
+	const auto last  = (std::min)((block + 1) * m_BlockSize, m_Length);
+	if (!m_Leaves.empty())
 	{
-		const bool isLastByte = source.tellg() == lastBytePos;
-		const uint8_t current = *readPos;
-		for (size_t i{}; i < (isLastByte ? metaData.m_RedundancyBit : unitSize); ++i)
+		std::vector<size_t> completed;
 		{
-			if (bitPos > sizeof(uint32_t) * CHAR_BIT)
-			{
-				throw std::runtime_error("Cannot support encode longer than 32 bit");
-			}
-			encode |= ((current >> i) & mask[0]) << bitPos;
-			auto lengthIt = huffmanTable.find(bitLength);
-			if (lengthIt == huffmanTable.end())
+			std::lock_guard<std::mutex> lock{m_Mutex};
+			for (auto leaf = static_cast<size_t>(first / Digest::kTreeLeafSize); leaf * Digest::kTreeLeafSize < last; ++leaf)
 			{
-				++bitLength;
-				++bitPos;
-				continue;
-			}
-			auto it = lengthIt->second.find(encode);
-			if (it == lengthIt->second.end())
-			{
-				++bitLength;
-				++bitPos;
-				continue;
+				const auto leafFirst = leaf * Digest::kTreeLeafSize;
+				const auto overlap   = (std::min)(last, leafFirst + Digest::kTreeLeafSize) - (std::max)(first, leafFirst);
+				if (0 == (m_LeafBytesLeft[leaf] -= overlap))
+				{
+					completed.push_back(leaf);
+				}
 			}
-			writeBuffer.push_back(it->second);
-			bitLength = 1;
-			bitPos    = 0;
-			encode    = 0;
 		}
+		ThreadPool::ParallelFor(completed.size(), m_LeafThreadCount, [&](const size_t i)
+		{
+			const auto leafFirst = completed[i] * Digest::kTreeLeafSize;
+			const auto leafLast  = (std::min)(leafFirst + Digest::kTreeLeafSize, m_Length);
+			m_Leaves[completed[i]] = Digest::TreeLeaf(m_Output + leafFirst, m_Output + leafLast);
+			progress.Poll();
+		});
+		return;
+	}
 
-		if (writeBuffer.size() >= 512)
+	// The thread finding no one digesting takes every block done in order, including those done meanwhile.
+	std::unique_lock<std::mutex> lock{m_Mutex};
+	m_IsDone[block] = 1;
+	if (m_IsDigesting)
+	{
+		return;
+	}
+	m_IsDigesting = true;
+	while (true)
+	{
+		auto frontier = m_Frontier;
+		while (frontier < m_IsDone.size() && m_IsDone[frontier])
 		{
-			destination.write(reinterpret_cast<const char*>(writeBuffer.data()), writeBuffer.size());
-			writeBuffer.clear();
+			++frontier;
+		}
+		if (frontier == m_Frontier)
+		{
+			break;
 		}
+		const auto digestFirst = m_Frontier * m_BlockSize;
+		const auto digestLast  = (std::min)(frontier * m_BlockSize, m_Length);
+		m_Frontier             = frontier;
+		lock.unlock();
+		ForEachPiece(m_Output + digestFirst, m_Output + digestLast, progress, false, [this](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+		{
+			m_Digest.Update(pieceFirst, pieceLast);
+		});
+		lock.lock();
 	}
-	destination.write(reinterpret_cast<const char*>(writeBuffer.data()), writeBuffer.size());
-
-	auto digest = std::vector<unsigned char>{
-		metaData.m_FileHash,
-		metaData.m_FileHash + picosha2::k_digest_size
-	};
-	return digest;
+	m_IsDigesting = false;
 }
 
-auto HuffmanEncoder::Verify(const std::string& sourceFilename, const std::vector<unsigned char>& digest) -> bool
+auto HuffmanEncoder::OutputDigester::Finish() -> void
 {
-	std::ifstream fs{sourceFilename, std::ios::in | std::ios::binary};
-	if (!fs.is_open())
+	for (size_t leaf{}; leaf < m_Leaves.size(); ++leaf)
 	{
-		throw std::runtime_error("Verify: Can't open file");
+		const auto leafFirst = leaf * Digest::kTreeLeafSize;
+		m_Digest.AppendLeaf(m_Leaves[leaf], static_cast<size_t>((std::min)(leafFirst + Digest::kTreeLeafSize, m_Length) - leafFirst));
 	}
-	return Verify(fs, digest);
 }
 
-auto HuffmanEncoder::Verify(std::istream& source, const std::vector<unsigned char>& digest) -> bool
+auto HuffmanEncoder::DecodeMemory(const MemoryDecodeLayout& layout,
+                                  uint8_t* output,
+                                  const DecodeOptions& options,
+                                  Progress& progress,
+                                  Digest* outputDigest) -> void
 {
-	if (digest.size() != picosha2::k_digest_size)
+	auto clock              = PhaseClock{options.m_Stats};
+	const auto blockSize    = layout.m_IndexHeader.m_BlockSize;
+	const auto sourceLength = layout.m_MetaData.m_SourceLength;
+	const auto& checksums   = layout.m_Checksums;
+	std::vector<uint8_t> isDamaged(layout.m_Index.size());
+	std::atomic<bool> hasFailed{false};
+	std::optional<OutputDigester> digester;
+	if (outputDigest)
 	{
-		return false;
+		digester.emplace(*outputDigest, output, layout, options.m_ThreadCount);
 	}
-	std::vector<unsigned char> actualDigest(picosha2::k_digest_size);
-	picosha2::hash256(std::istreambuf_iterator<char>(source),
-	                  std::istreambuf_iterator<char>(),
-	                  actualDigest.begin(),
-	                  actualDigest.end());
-	for (size_t i{}; i < picosha2::k_digest_size; ++i)
+	ThreadPool::ParallelFor(layout.m_Index.size(), options.m_ThreadCount, [&, output](const size_t block)
 	{
-		if (digest[i] != actualDigest[i])
+		// Failing fast, the blocks not started yet are left alone.
+		if (hasFailed)
+		{
+			return;
+		}
+		const auto& item  = layout.m_Index[block];
+		auto* outputFirst = output + block * blockSize;
+		auto* outputLast  = output + (std::min)((block + 1) * blockSize, sourceLength);
+		auto state        = DecodeState{};
+		state.m_BitsLeft  = item.m_BitLength;
+		const auto first  = layout.m_Payload + item.m_Offset;
+		const auto last   = first + (item.m_BitLength + CHAR_BIT - 1) / CHAR_BIT;
+		auto outputPos    = outputFirst;
+		auto isIntact     = false;
+		try
+		{
+			ForEachPiece(first, last, progress, true, [&](const uint8_t* pieceFirst, const uint8_t* pieceLast)
+			{
+				outputPos = DecodeChunk(layout.m_Table, state, pieceFirst, pieceLast, outputPos, outputLast);
+			});
+			isIntact = outputPos == outputLast
+			           && !state.m_BitsLeft
+			           && (checksums.empty() || Digest::Crc32c(outputFirst, outputLast) == checksums[block]);
+		}
+		catch (const CancelledError&)
+		{
+			hasFailed = true;
+			throw;
+		}
+		catch (const std::runtime_error&)
+		{
+			// A code beyond the block is damage of the block too.
+		}
+		if (!isIntact)
+		{
+			if (!options.m_OnDamagedBlock)
+			{
+				hasFailed = true;
+				throw std::runtime_error("Decode: Damaged block");
+			}
+			std::fill(outputFirst, outputLast, uint8_t{});
+			isDamaged[block] = 1;
+		}
+		if (digester)
 		{
-			return false;
+			digester->Done(block, progress);
 		}
+	});
+	if (digester)
+	{
+		digester->Finish();
 	}
-	return true;
-}
-
-auto HuffmanEncoder::GetMetaData(std::istream& source) -> std::tuple<SerializedHuffmanTableMetaData, HuffmanTableMap>
-{
-	auto result                    = std::make_tuple(SerializedHuffmanTableMetaData{}, HuffmanTableMap{});
-	auto& [metaData, huffmanTable] = result;
-
-	// Get meta data
-	source.read(reinterpret_cast<char*>(&metaData), sizeof(SerializedHuffmanTableMetaData));
-
-	// UnSerialize huffman table
-	std::vector<uint8_t> huffmanTableBuffer(metaData.m_TableLength);
-	source.read(reinterpret_cast<char*>(huffmanTableBuffer.data()), metaData.m_TableLength);
-	huffmanTable = UnSerializeHuffmanTable(huffmanTableBuffer);
 
-	return result;
+	// Reported in order, from the calling thread.
+	for (size_t block{}; block < isDamaged.size(); ++block)
+	{
+		if (isDamaged[block])
+		{
+			const auto offset = block * blockSize;
+			options.m_OnDamagedBlock(offset, (std::min)(blockSize, sourceLength - offset));
+		}
+	}
+	clock.Lap(&CodecStats::m_PayloadTime);
 }
 
-auto HuffmanEncoder::GetMetaData(
-	const std::string& filename) -> std::tuple<SerializedHuffmanTableMetaData, HuffmanTableMap>
+#ifdef MAPPED_FILE_SUPPORTED
+auto HuffmanEncoder::EncodeMapped(const std::string& sourceFilename,
+                                  const std::string& destination,
+                                  const EncodeOptions& options,
+                                  Workspace& workspace) -> void
 {
-	std::ifstream fs(filename, std::ios::in | std::ios::binary);
-	if (!fs.is_open())
+	auto clock        = StartStats(options.m_Stats);
+	const auto source = MappedFile::OpenRead(sourceFilename);
+	auto progress     = Progress{options, 2 * uint64_t{source.Size()}};
+	auto& layout      = workspace.m_EncodeLayout;
+	PrepareEncodeLayout(source.Data(), source.Data() + source.Size(), options, layout, progress);
 	{
-		throw std::runtime_error("GetMetaData: Can't open file");
+		auto output = MappedFile::Create(destination, layout.m_EncodedLength);
+		EncodeMemory(source.Data(), layout, output.Data(), options, progress);
+		clock.SkipLap();
 	}
-	return GetMetaData(fs);
+	clock.Lap(&CodecStats::m_FlushTime);
+	SetCounters(options.m_Stats, source.Size(), layout.m_EncodedLength, source.Size(), layout.m_MetaData.m_PayloadBitLength);
+	clock.Stop();
+	progress.Finish();
 }
 
-auto HuffmanEncoder::GetFrequencyAndHash(
-	std::istream& fileStream) -> std::tuple<std::vector<unsigned char>, FrequencyContainer>
+auto HuffmanEncoder::DecodeMapped(const std::string& sourceFilename,
+                                  const std::string& destination,
+                                  const DecodeOptions& options,
+                                  Workspace& workspace) -> std::vector<unsigned char>
 {
-	const size_t bufferSize{PICOSHA2_BUFFER_SIZE_FOR_INPUT_ITERATOR};
-	auto result = std::make_tuple(std::vector<unsigned char>(picosha2::k_digest_size), FrequencyContainer());
-	auto& [digest, frequency] = result;
-
-	std::vector<unsigned char> buffer(bufferSize);
-	picosha2::hash256_one_by_one hasher;
-	const auto end = std::istreambuf_iterator<char>();
-	for (auto readPos = std::istreambuf_iterator<char>(fileStream); readPos != end;)
+	auto clock        = StartStats(options.m_Stats);
+	const auto source = MappedFile::OpenRead(sourceFilename);
+	auto& layout      = workspace.m_DecodeLayout;
+	if (!ReadDecodeLayout(source.Data(), source.Size(), layout, options.m_Stats))
 	{
-		size_t actualSize{bufferSize};
-		for (size_t i{}; i != bufferSize; ++i, ++readPos)
+		// The length of destination is unknown up front.
+		auto sourceBuffer = MemoryBuffer{source.Data(), source.Size()};
+		auto sourceStream = std::istream{&sourceBuffer};
+		std::ofstream output{destination, std::ios::out | std::ios::binary};
+		if (!output.is_open())
 		{
-			if (end == readPos)
-			{
-				actualSize = i;
-				break;
-			}
-			frequency[*readPos] += 1; ///< Add frequency
-			buffer[i] = *readPos;
+			throw std::runtime_error("Decode: Can't open output file");
 		}
-		hasher.process(buffer.begin(), buffer.begin() + actualSize);
+		return Decode(sourceStream, output, options, workspace);
 	}
-	hasher.finish();
-	hasher.get_hash_bytes(digest.begin(), digest.end());
 
-	return result;
+	auto progress = Progress{options, source.Size()};
+	progress.Advance(static_cast<uint64_t>(layout.m_Payload - source.Data()));
+	{
+		auto output = MappedFile::Create(destination, layout.m_MetaData.m_SourceLength);
+		StartOutputDigest(layout.m_MetaData.m_DigestAlgorithm, workspace);
+		DecodeMemory(layout,
+		             output.Data(),
+		             options,
+		             progress,
+		             workspace.m_DigestOutput ? &workspace.m_OutputDigest : nullptr);
+		clock.SkipLap();
+	}
+	clock.Lap(&CodecStats::m_FlushTime);
+	const auto& metaData = layout.m_MetaData;
+	SetCounters(options.m_Stats, source.Size(), metaData.m_SourceLength, metaData.m_SourceLength, metaData.m_PayloadBitLength);
+	clock.Stop();
+	progress.Finish();
+	return GetDigest(metaData);
 }
+#endif
 
-auto HuffmanEncoder::GenerateTreeFromFrequency(const FrequencyContainer& frequency) -> HuffmanTableMap
+auto HuffmanEncoder::MakeMetaData(const std::vector<unsigned char>& hash,
+                                  const uint64_t sourceLength,
+                                  const size_t tableLength,
+                                  const EncodeOptions& options) -> SerializedHuffmanTableMetaData
 {
-	const auto comparison = [](const std::shared_ptr<HuffmanTreeNode>& lhs,
-	                           const std::shared_ptr<HuffmanTreeNode>& rhs)-> bool
-	{
-		return lhs->m_Frequency < rhs->m_Frequency;
-	};
-	std::multiset<std::shared_ptr<HuffmanTreeNode>, decltype(comparison)> frequencySet{comparison};
-	for (const auto& item : frequency)
+	auto metaData              = SerializedHuffmanTableMetaData{};
+	metaData.m_TableLength     = tableLength;
+	metaData.m_RedundancyBit   = 0;
+	metaData.m_TableFormat     = options.m_TableFormat;
+	metaData.m_Flags           = kPayloadLengthFlag | (options.m_BlockSize ? kBlockIndexFlag : 0);
+	if (options.m_BlockSize && options.m_BlockChecksum)
 	{
-		frequencySet.insert(std::make_shared<HuffmanTreeNode>(
-			HuffmanTreeNode{{}, {}, item.second, item.first}));
+		metaData.m_Flags |= kBlockChecksumFlag;
 	}
-	while (1 < frequencySet.size())
-	{
-		auto left = *frequencySet.begin();
-		frequencySet.erase(frequencySet.begin());
-		auto right = *frequencySet.begin();
-		frequencySet.erase(frequencySet.begin());
+	metaData.m_DigestAlgorithm = options.m_DigestAlgorithm;
+	metaData.m_SourceLength    = sourceLength;
+	std::copy(hash.begin(), hash.end(), metaData.m_FileHash);
+	return metaData;
+}
 
-		frequencySet.insert(std::make_shared<HuffmanTreeNode>(
-			HuffmanTreeNode{left, right, left->m_Frequency + right->m_Frequency, 0}));
-	}
-	auto rootNode = *frequencySet.begin();
+auto HuffmanEncoder::MetaDataLength(const SerializedHuffmanTableMetaData& metaData) noexcept -> size_t
+{
+	return metaData.m_Flags & kPayloadLengthFlag
+		       ? sizeof(SerializedHuffmanTableMetaData)
+		       : offsetof(SerializedHuffmanTableMetaData, m_SourceLength);
+}
 
-	HuffmanTableMap huffmanTable;
-	std::stack<std::tuple<std::shared_ptr<HuffmanTreeNode>, std::vector<unsigned char>>> stack;
-	std::vector<unsigned char> path;
-	auto node = rootNode;
-	while (node || !stack.empty())
+auto HuffmanEncoder::ReadMetaData(std::istream& source,
+                                  SerializedHuffmanTableMetaData& metaData,
+                                  const size_t skipLength) -> void
+{
+	const size_t legacyLength = offsetof(SerializedHuffmanTableMetaData, m_SourceLength);
+	auto* buffer              = reinterpret_cast<char*>(&metaData);
+	source.read(buffer + skipLength, legacyLength - skipLength);
+	source.read(buffer + legacyLength, MetaDataLength(metaData) - legacyLength);
+	if (!source)
 	{
-		while (node)
-		{
-			stack.push(std::make_tuple(node, path));
-			if (!node->m_LeftChild)
-			{
-				unsigned int encode{};
-				for (size_t i{0}; i != path.size(); ++i)
-				{
-					//encode |= path[i] << (path.size() - 1 - i);
-					encode |= path[i] << i; ///< Reversed huffman encode.
-				}
-				huffmanTable[node->m_Character] = std::make_tuple(path.size(), encode);
-			}
-			else
-			{
-				path.push_back(0);
-			}
-			node = node->m_LeftChild;
-		}
-
-		if (!stack.empty())
-		{
-			node = std::get<0>(stack.top());
-			path = std::get<1>(stack.top());
-			if (node->m_RightChild)
-			{
-				path.push_back(1);
-			}
-			node = node->m_RightChild;
-			stack.pop();
-		}
+		throw std::runtime_error("Truncated metadata");
 	}
-
-	return huffmanTable;
-#ifdef _DEBUG
-	for (const auto& item : huffmanTable)
+	if (!Digest::IsKnown(metaData.m_DigestAlgorithm))
 	{
-		std::cout << item.first << "\t";
-		auto [bitLength, encode] = item.second;
-		for (int i{static_cast<int>(bitLength) - 1}; i >= 0; --i)
-		{
-			std::cout << ((encode & (0 | (1 << i))) >> i);
-		}
-		std::cout << "\t" << encode;
-		std::cout << std::endl;
+		throw std::runtime_error("Unknown digest algorithm");
 	}
-#endif
 }
 
-auto HuffmanEncoder::SerializeHuffmanTable(const HuffmanTableMap& huffmanTable) -> std::vector<uint8_t>
+auto HuffmanEncoder::ReadBlockIndex(std::istream& source)
+-> std::tuple<SerializedBlockIndexHeader, std::vector<SerializedBlockIndexItem>>
 {
-	std::vector<uint8_t> buffer;
-	buffer.reserve(sizeof(SerializedHuffmanTableItem) * huffmanTable.size());
-	SerializedHuffmanTableItem huffmanTableItem{};
+	auto result                = std::make_tuple(SerializedBlockIndexHeader{}, std::vector<SerializedBlockIndexItem>{});
+	auto& [indexHeader, index] = result;
 
-	for (const auto& item : huffmanTable)
+	source.read(reinterpret_cast<char*>(&indexHeader), sizeof(indexHeader));
+	if (!source || 0 == indexHeader.m_BlockSize)
 	{
-		const auto& [character, pair]   = item;
-		const auto& [bitLength, encode] = pair;
-		huffmanTableItem.m_Character    = character;
-		if (bitLength > (std::numeric_limits<uint8_t>::max)())
+		throw std::runtime_error("Invalid block index");
+	}
+	// Grow with the stream instead of trusting the count, a damaged header must not allocate wildly.
+	for (uint64_t i{}; i < indexHeader.m_BlockCount; ++i)
+	{
+		SerializedBlockIndexItem item{};
+		source.read(reinterpret_cast<char*>(&item), sizeof(item));
+		if (!source)
 		{
-			throw(std::overflow_error("Huffman bitLength overflow."));
+			throw std::runtime_error("Invalid block index");
 		}
-		huffmanTableItem.m_BitLength = static_cast<uint8_t>(bitLength);
+		index.push_back(item);
+	}
 
-		if (encode > (std::numeric_limits<uint16_t>::max)())
-		{
-			throw(std::overflow_error("Huffman encode overflow."));
-		}
-		huffmanTableItem.m_Encode = static_cast<uint16_t>(encode);
+	return result;
+}
 
-		std::copy(reinterpret_cast<uint8_t*>(&huffmanTableItem),
-		          reinterpret_cast<uint8_t*>(&huffmanTableItem) + sizeof(SerializedHuffmanTableItem),
-		          std::back_inserter(buffer));
+auto HuffmanEncoder::ReadBlockChecksums(std::istream& source,
+                                        const SerializedHuffmanTableMetaData& metaData,
+                                        const size_t blockCount) -> std::vector<uint32_t>
+{
+	std::vector<uint32_t> checksums;
+	if (!(metaData.m_Flags & kBlockChecksumFlag))
+	{
+		return checksums;
 	}
-
-	return buffer;
+	// The count is trusted, the block index has been read up to it.
+	checksums.resize(blockCount);
+	source.read(reinterpret_cast<char*>(checksums.data()), checksums.size() * sizeof(uint32_t));
+	if (!source)
+	{
+		throw std::runtime_error("Invalid block checksums");
+	}
+	return checksums;
 }
 
 auto HuffmanEncoder::UnSerializeHuffmanTable(const uint8_t* buffer, const size_t length) -> HuffmanTableMap
@@ -410,3 +2464,261 @@ auto HuffmanEncoder::UnSerializeDecodeHuffmanTable(const std::vector<uint8_t>& b
 {
 	return UnSerializeDecodeHuffmanTable(buffer.data(), buffer.size());
 }
+
+
+auto HuffmanEncoder::GenerateCanonicalTable(const HuffmanTableMap& huffmanTable) -> HuffmanTableMap
+{
+	std::vector<std::tuple<size_t, uint8_t>> characters;
+	characters.reserve(huffmanTable.size());
+	for (const auto& [character, pair] : huffmanTable)
+	{
+		const auto bitLength = std::get<0>(pair);
+		if (0 == bitLength || bitLength > sizeof(uint32_t) * CHAR_BIT)
+		{
+			throw std::overflow_error("Huffman bitLength overflow.");
+		}
+		characters.emplace_back(bitLength, static_cast<uint8_t>(character));
+	}
+	std::sort(characters.begin(), characters.end());
+
+	HuffmanTableMap canonicalTable;
+	uint64_t code{};
+	size_t lastBitLength{};
+	for (const auto& [bitLength, character] : characters)
+	{
+		code <<= bitLength - lastBitLength;
+		lastBitLength = bitLength;
+		if (code >> bitLength)
+		{
+			throw std::invalid_argument("Huffman bit lengths are not a prefix code");
+		}
+
+		// The stream starts with the most significant bit, so store the code reversed.
+		unsigned int encode{};
+		for (size_t i{}; i < bitLength; ++i)
+		{
+			encode |= static_cast<unsigned int>((code >> i) & 1) << (bitLength - 1 - i);
+		}
+		canonicalTable[static_cast<char>(character)] = std::make_tuple(bitLength, encode);
+		++code;
+	}
+
+	return canonicalTable;
+}
+
+auto HuffmanEncoder::SerializeCanonicalHuffmanTable(const HuffmanTableMap& huffmanTable) -> std::vector<uint8_t>
+{
+	const size_t characterCount = 256;
+
+	std::vector<uint8_t> buffer;
+	if (huffmanTable.size() < characterCount / 2)
+	{
+		buffer.reserve(huffmanTable.size() * 2);
+		for (const auto& [character, pair] : huffmanTable)
+		{
+			buffer.push_back(static_cast<uint8_t>(character));
+			buffer.push_back(static_cast<uint8_t>(std::get<0>(pair)));
+		}
+	}
+	else
+	{
+		buffer.assign(characterCount, 0);
+		for (const auto& [character, pair] : huffmanTable)
+		{
+			buffer[static_cast<uint8_t>(character)] = static_cast<uint8_t>(std::get<0>(pair));
+		}
+	}
+
+	return buffer;
+}
+
+auto HuffmanEncoder::UnSerializeCanonicalHuffmanTable(const uint8_t* buffer, const size_t length) -> HuffmanTableMap
+{
+	const size_t characterCount = 256;
+
+	HuffmanTableMap huffmanTable;
+	if (characterCount == length)
+	{
+		for (size_t i{}; i < characterCount; ++i)
+		{
+			if (0 != buffer[i])
+			{
+				huffmanTable[static_cast<char>(i)] = std::make_tuple(size_t{buffer[i]}, 0u);
+			}
+		}
+	}
+	else if (0 == length % 2 && length < characterCount)
+	{
+		for (size_t i{}; i < length; i += 2)
+		{
+			huffmanTable[static_cast<char>(buffer[i])] = std::make_tuple(size_t{buffer[i + 1]}, 0u);
+		}
+	}
+	else
+	{
+		throw std::invalid_argument("Invalid huffman table buffer");
+	}
+
+	try
+	{
+		return GenerateCanonicalTable(huffmanTable);
+	}
+	catch (const std::exception&)
+	{
+		throw std::invalid_argument("Invalid huffman table buffer");
+	}
+}
+
+auto HuffmanEncoder::UnSerializeHuffmanTable(const TableFormat format,
+                                             const std::vector<uint8_t>& buffer) -> HuffmanTableMap
+{
+	switch (format)
+	{
+	case TableFormat::Explicit:
+		return UnSerializeHuffmanTable(buffer);
+	case TableFormat::Canonical:
+		return UnSerializeCanonicalHuffmanTable(buffer.data(), buffer.size());
+	default:
+		throw std::invalid_argument("Unknown huffman table format");
+	}
+}
+
+auto HuffmanEncoder::UnSerializeDecodeHuffmanTable(const TableFormat format,
+                                                   const std::vector<uint8_t>& buffer) -> HuffmanTableDecodeMap
+{
+	if (TableFormat::Explicit == format)
+	{
+		return UnSerializeDecodeHuffmanTable(buffer);
+	}
+
+	HuffmanTableDecodeMap decodeTable;
+	for (const auto& [character, pair] : UnSerializeHuffmanTable(format, buffer))
+	{
+		const auto& [bitLength, encode] = pair;
+		decodeTable[bitLength].insert(std::make_pair(encode, character));
+	}
+	return decodeTable;
+}
+
+auto HuffmanEncoder::BuildDecodeTable(const HuffmanTableDecodeMap& huffmanTable) -> DecodeTable
+{
+	DecodeTable table{};
+	BuildDecodeTable(huffmanTable, table);
+	return table;
+}
+
+auto HuffmanEncoder::BuildDecodeTable(const HuffmanTableDecodeMap& huffmanTable, DecodeTable& table) -> void
+{
+	const size_t maxLookupBit = 12;
+
+	table.m_MaxBitLength = 0;
+	table.m_LongCodes.clear();
+	for (const auto& item : huffmanTable)
+	{
+		table.m_MaxBitLength = (std::max)(table.m_MaxBitLength, item.first);
+	}
+	table.m_LookupBit = (std::min)(table.m_MaxBitLength, maxLookupBit);
+	table.m_Entries.assign(size_t{1} << table.m_LookupBit, 0);
+
+	for (const auto& [bitLength, codes] : huffmanTable)
+	{
+		if (0 == bitLength)
+		{
+			continue;
+		}
+		if (bitLength > table.m_LookupBit)
+		{
+			table.m_LongCodes.insert(std::make_pair(bitLength, codes));
+			continue;
+		}
+		for (const auto& [encode, character] : codes)
+		{
+			if (encode >> bitLength)
+			{
+				throw std::invalid_argument("Invalid huffman table buffer");
+			}
+			// Every index whose low bitLength bits equal the code resolves to it.
+			const auto entry = static_cast<uint16_t>(bitLength << 8 | static_cast<uint8_t>(character));
+			for (size_t index = encode; index < table.m_Entries.size(); index += size_t{1} << bitLength)
+			{
+				table.m_Entries[index] = entry;
+			}
+		}
+	}
+}
+
+template <typename Sink>
+auto HuffmanEncoder::DecodeChunkTo(const DecodeTable& table,
+                                   DecodeState& state,
+                                   const uint8_t* first,
+                                   const uint8_t* last,
+                                   Sink& sink) -> void
+{
+	const uint64_t lookupMask = (uint64_t{1} << table.m_LookupBit) - 1;
+	auto readPos              = first;
+	while (true)
+	{
+		while (state.m_BitCount <= 56 && readPos != last)
+		{
+			state.m_BitBuffer |= static_cast<uint64_t>(*readPos++) << state.m_BitCount;
+			state.m_BitCount += CHAR_BIT;
+		}
+		const auto available = (std::min)(static_cast<uint64_t>(state.m_BitCount), state.m_BitsLeft);
+
+		const auto entry = table.m_Entries[state.m_BitBuffer & lookupMask];
+		size_t bitLength = entry >> 8;
+		auto character   = static_cast<uint8_t>(entry);
+		if (0 == bitLength)
+		{
+			for (bitLength = table.m_LookupBit + 1; bitLength <= available; ++bitLength)
+			{
+				if (bitLength > table.m_MaxBitLength)
+				{
+					throw std::runtime_error("Invalid huffman code");
+				}
+				auto lengthIt = table.m_LongCodes.find(bitLength);
+				if (lengthIt == table.m_LongCodes.end())
+				{
+					continue;
+				}
+				auto it = lengthIt->second.find(
+					static_cast<unsigned int>(state.m_BitBuffer & ((uint64_t{1} << bitLength) - 1)));
+				if (it != lengthIt->second.end())
+				{
+					character = static_cast<uint8_t>(it->second);
+					break;
+				}
+			}
+		}
+		if (bitLength > available)
+		{
+			// Wait for the next chunk, or the stream is over.
+			return;
+		}
+		sink.Put(character);
+		state.m_BitBuffer >>= bitLength;
+		state.m_BitCount -= bitLength;
+		state.m_BitsLeft -= bitLength;
+	}
+}
+auto HuffmanEncoder::DecodeChunk(const DecodeTable& table,
+                                 DecodeState& state,
+                                 const uint8_t* first,
+                                 const uint8_t* last,
+                                 std::vector<uint8_t>& output) -> void
+{
+	auto sink = VectorSink{output};
+	DecodeChunkTo(table, state, first, last, sink);
+}
+
+auto HuffmanEncoder::DecodeChunk(const DecodeTable& table,
+                                 DecodeState& state,
+                                 const uint8_t* first,
+                                 const uint8_t* last,
+                                 uint8_t* output,
+                                 uint8_t* outputLast) -> uint8_t*
+{
+	auto sink = MemorySink{output, outputLast};
+	DecodeChunkTo(table, state, first, last, sink);
+	return sink.m_WritePos;
+}
@@ -2,12 +2,23 @@
 #define HUFFMAN_ENCODER_H
 #pragma once
 
+#include "Digest.h"
+#include "MappedFile.h"
 #include "Sha256.h"
 
-#include <memory>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
 #include <vector>
 #include <unordered_map>
 
+class BitWriter;
+class HuffmanCodec;
+class HuffmanDecoder;
+
 #ifndef FRIEND_TEST
 #define FRIEND_TEST(x,y)
 #endif
@@ -19,14 +30,33 @@ class HuffmanEncoder
 {
 	FRIEND_TEST(GeneralTest, HuffmanTableBuilderTest);
 	FRIEND_TEST(GeneralTest, HuffmanTableSerializeTest);
+	FRIEND_TEST(GeneralTest, DecodeTableTest);
+	FRIEND_TEST(GeneralTest, EncodeTableTest);
+	FRIEND_TEST(GeneralTest, CanonicalTableTest);
+	FRIEND_TEST(GeneralTest, LengthLimitedTableTest);
+	FRIEND_TEST(GeneralTest, BlockEncodeTest);
+	FRIEND_TEST(GeneralTest, StreamEncodeTest);
+	FRIEND_TEST(GeneralTest, FrequencyCountTest);
+	friend class HuffmanCodec;
+	friend class HuffmanDecoder;
+	friend class HuffmanBenchmark;
 
 public:
 	HuffmanEncoder() = delete;
 
-	using FrequencyContainer = std::unordered_map<char, unsigned int>;
+	using FrequencyContainer = std::unordered_map<char, uint64_t>;
 	using HuffmanTableMap = std::unordered_map<char, std::tuple<size_t, unsigned int>>;
 	using HuffmanTableDecodeMap = std::unordered_map<size_t, std::unordered_map<unsigned int, char>>;
 
+	/// <summary>
+	/// Layout of the serialized huffman table.
+	/// </summary>
+	enum class TableFormat : uint8_t
+	{
+		Explicit  = 0, ///< {character, bitLength, encode} for every character.
+		Canonical = 1, ///< Bit lengths only, encodes are rebuilt as canonical huffman codes.
+	};
+
 	/// <summary>
 	/// The metadata of compressed file.
 	/// </summary>
@@ -34,7 +64,169 @@ public:
 	{
 		uint64_t m_TableLength;
 		uint8_t m_RedundancyBit;
-		uint8_t m_FileHash[picosha2::k_digest_size];
+		uint8_t m_FileHash[Digest::kMaxLength]; ///< Digest of source, a shorter digest is followed by zeros.
+		TableFormat m_TableFormat;              ///< Occupies former padding, which older files left zeroed.
+		uint8_t m_Flags;                        ///< Combination of k*Flag, occupies former padding too.
+		Digest::Algorithm m_DigestAlgorithm;    ///< Occupies former padding too, so older files are SHA-256.
+		uint64_t m_SourceLength;                ///< Present with kPayloadLengthFlag, older files end before it.
+		uint64_t m_PayloadBitLength;            ///< Total bit length of codes in payload, block padding excluded.
+	};
+
+	/// <summary>
+	/// The payload is split into independent blocks, and a block index follows the huffman table.
+	/// </summary>
+	static constexpr uint8_t kBlockIndexFlag = 0x1;
+
+	/// <summary>
+	/// m_SourceLength and m_PayloadBitLength are present, so the end of payload is known up front.
+	/// </summary>
+	static constexpr uint8_t kPayloadLengthFlag = 0x2;
+
+	/// <summary>
+	/// The block index is followed by a uint32_t CRC32C of the source characters of every block.
+	/// </summary>
+	static constexpr uint8_t kBlockChecksumFlag = 0x4;
+
+	/// <summary>
+	/// Header of the block index.
+	/// Every block but the last one holds m_BlockSize characters of source.
+	/// </summary>
+	struct SerializedBlockIndexHeader
+	{
+		uint64_t m_BlockSize;
+		uint64_t m_BlockCount;
+	};
+
+	/// <summary>
+	/// Item of the block index, one for every block.
+	/// Blocks start at byte boundary, m_Offset is relative to the begin of the payload.
+	/// </summary>
+	struct SerializedBlockIndexItem
+	{
+		uint64_t m_Offset;
+		uint64_t m_BitLength;
+	};
+
+	/// <summary>
+	/// Leading bytes of a framed stream, written by EncodeStream.
+	/// A framed stream is a sequence of frames, each with its own canonical huffman table,
+	/// closed by a frame of zero characters and the digest of the whole source.
+	/// </summary>
+	static constexpr char kStreamMagic[8] = {'H', 'U', 'F', 'F', 'S', 'T', 'R', 'M'};
+
+	/// <summary>
+	/// Largest frame of a framed stream, in characters.
+	/// </summary>
+	static constexpr uint64_t kMaxFrameSize = uint64_t{1} << 30;
+
+	/// <summary>
+	/// Header of a frame, followed by the canonical huffman table and payload of the frame.
+	/// </summary>
+	struct SerializedFrameHeader
+	{
+		uint64_t m_SourceLength;             ///< Characters in frame, 0 closes the stream.
+		uint64_t m_BitLength;                ///< Bit length of payload, which is padded to byte boundary.
+		uint32_t m_TableLength;
+		Digest::Algorithm m_DigestAlgorithm; ///< Of the digest after the end frame, zero (SHA-256) in older streams.
+		uint8_t m_Reserved[3];
+	};
+
+	/// <summary>
+	/// Wall time of the phases of an encode or decode, and counters of what it did.
+	/// Phases include the reads and writes done in them and add up over the frames of a framed stream.
+	/// Phases a path doesn't have are left zero, and m_TotalTime also holds the time between phases.
+	/// </summary>
+	struct CodecStats
+	{
+		using Duration = std::chrono::nanoseconds;
+
+		Duration m_FrequencyAndHashTime{}; ///< Counting frequency and digesting source, encode only.
+		Duration m_TreeBuildTime{};        ///< Building the huffman tree, and the encode or decode table.
+		Duration m_TableSerializeTime{};   ///< Writing or reading the metadata, huffman table and block index.
+		Duration m_PayloadTime{};          ///< Encoding or decoding the payload.
+		Duration m_FlushTime{};            ///< Completing the output, the digest of mapped decode too.
+		Duration m_TotalTime{};
+		uint64_t m_BytesIn{};
+		uint64_t m_BytesOut{};
+		size_t m_SymbolCount{};            ///< Characters with a code, the most of any frame in a framed stream.
+		double m_AverageCodeLength{};      ///< Payload bits per character, padding excluded.
+		double m_Entropy{};                ///< Bits per character of source by its frequency, encode only.
+	};
+
+	/// <summary>
+	/// Thrown by an encode or decode cancelled through its options, leaving its output incomplete.
+	/// </summary>
+	class CancelledError : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	/// <summary>
+	/// Options of encoding.
+	/// </summary>
+	struct EncodeOptions
+	{
+		TableFormat m_TableFormat{TableFormat::Canonical};
+		size_t m_MaxBitLength{12}; ///< Longest code allowed, 1 to 32.
+		size_t m_BlockSize{0};     ///< Characters per independent block (or frame), 0 for a single stream.
+		size_t m_ThreadCount{0};   ///< Threads counting frequency and encoding blocks, 0 for the count of hardware threads.
+		Digest::Algorithm m_DigestAlgorithm{Digest::Algorithm::Sha256}; ///< Digest of source recorded in file.
+		bool m_BlockChecksum{false}; ///< Record a CRC32C of every block, ignored without blocks and in framed streams.
+		CodecStats* m_Stats{nullptr}; ///< Filled in by every encode if set, from the calling thread.
+
+		/// <summary>
+		/// Called with the bytes done and the bytes to do, whenever another m_ProgressInterval bytes are done.
+		/// Bytes are of source, counted once by both passes, the pass of counting and the pass of encoding,
+		/// so the bytes to do are twice the length of source. They are 0 for framed streams, which are not
+		/// read in advance. It may be called from the threads of the encode, but never concurrently.
+		/// </summary>
+		std::function<void(uint64_t done, uint64_t total)> m_OnProgress;
+		uint64_t m_ProgressInterval{1024 * 1024};
+
+		/// <summary>
+		/// Polled while encoding, once it is set the encode throws CancelledError.
+		/// </summary>
+		const std::atomic<bool>* m_Cancellation{nullptr};
+	};
+
+	/// <summary>
+	/// Options of decoding.
+	/// </summary>
+	struct DecodeOptions
+	{
+		size_t m_ThreadCount{0}; ///< Threads decoding blocks, 0 for the count of hardware threads.
+
+		/// <summary>
+		/// Without it, the first damaged block of a block indexed file fails the decode.
+		/// With it, damaged blocks are zero filled and reported by their offset and length in source.
+		/// A block is damaged if it doesn't decode to its length, or to its checksum where kBlockChecksumFlag is set.
+		/// </summary>
+		std::function<void(uint64_t offset, uint64_t length)> m_OnDamagedBlock;
+
+		CodecStats* m_Stats{nullptr}; ///< Filled in by every decode if set, from the calling thread.
+
+		/// <summary>
+		/// Called with the bytes done and the bytes to do, whenever another m_ProgressInterval bytes are done.
+		/// Bytes are of the encoded source, the bytes to do are 0 if the source can't be seeked to its end.
+		/// It may be called from the threads of the decode, but never concurrently.
+		/// </summary>
+		std::function<void(uint64_t done, uint64_t total)> m_OnProgress;
+		uint64_t m_ProgressInterval{1024 * 1024};
+
+		/// <summary>
+		/// Polled while decoding, once it is set the decode throws CancelledError.
+		/// </summary>
+		const std::atomic<bool>* m_Cancellation{nullptr};
+	};
+
+	/// <summary>
+	/// Options of verifying.
+	/// </summary>
+	struct VerifyOptions
+	{
+		Digest::Algorithm m_DigestAlgorithm{Digest::Algorithm::Sha256}; ///< Algorithm of digest, as recorded in file.
+		size_t m_ThreadCount{0}; ///< Threads hashing leaves of Sha256Tree, 0 for the count of hardware threads.
 	};
 
 	/// <summary>
@@ -53,6 +245,62 @@ public:
 	/// <returns>void</returns>
 	static auto Encode(std::istream& source, std::ostream& destination) -> void;
 
+	/// <summary>
+	/// Encoding a file.
+	/// Where MAPPED_FILE_SUPPORTED, both files are memory mapped and blocks are encoded in place.
+	/// </summary>
+	/// <param name="sourceFilename">Filename of source file</param>
+	/// <param name="destination">Destination of encoded file</param>
+	/// <param name="options">Encode options</param>
+	/// <returns>void</returns>
+	static auto Encode(const std::string& sourceFilename,
+	                   const std::string& destination,
+	                   const EncodeOptions& options) -> void;
+
+	/// <summary>
+	/// Encoding a stream.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <param name="options">Encode options</param>
+	/// <returns>void</returns>
+	static auto Encode(std::istream& source, std::ostream& destination, const EncodeOptions& options) -> void;
+
+	/// <summary>
+	/// Encoding a stream in a single pass as a framed stream.
+	/// Neither source nor destination is seeked, so both can be pipes or sockets.
+	/// Every frame of m_BlockSize characters (1 MiB if 0) is buffered and gets its own huffman table.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <param name="options">Encode options, m_TableFormat and m_ThreadCount are ignored</param>
+	/// <returns>void</returns>
+	static auto EncodeStream(std::istream& source, std::ostream& destination, const EncodeOptions& options) -> void;
+
+	/// <summary>
+	/// Largest encoded length of a source, to preallocate the output of EncodeBuffer.
+	/// </summary>
+	/// <param name="sourceLength">Length of source</param>
+	/// <param name="options">Encode options</param>
+	/// <returns>Bytes needed by EncodeBuffer at most</returns>
+	static auto EncodeBound(const uint64_t sourceLength, const EncodeOptions& options) noexcept -> uint64_t;
+
+	/// <summary>
+	/// Encoding a buffer into a buffer, without any stream or copy of source.
+	/// The result is the same file as Encode writes.
+	/// </summary>
+	/// <param name="source">Begin of source</param>
+	/// <param name="sourceLength">Length of source</param>
+	/// <param name="output">Begin of output</param>
+	/// <param name="outputLength">Length of output, EncodeBound(sourceLength, options) is always enough</param>
+	/// <param name="options">Encode options</param>
+	/// <returns>Length of encoded data in output</returns>
+	static auto EncodeBuffer(const uint8_t* source,
+	                         const size_t sourceLength,
+	                         uint8_t* output,
+	                         const size_t outputLength,
+	                         const EncodeOptions& options) -> size_t;
+
 	/// <summary>
 	/// Decode a file.
 	/// </summary>
@@ -70,21 +318,119 @@ public:
 	static auto Decode(std::istream& source, std::ostream& destination) -> std::vector<unsigned char>;
 
 	/// <summary>
-	/// Verify a file with SHA-256 digest.
+	/// Decode a file.
+	/// Where MAPPED_FILE_SUPPORTED, the source is memory mapped, and so is the destination if
+	/// the file records its source length.
+	/// </summary>
+	/// <param name="sourceFilename">File name of source file</param>
+	/// <param name="destination">Destination of decoded file</param>
+	/// <param name="options">Decode options</param>
+	/// <returns>Digest of the source recorded in file</returns>
+	static auto Decode(const std::string& sourceFilename,
+	                   const std::string& destination,
+	                   const DecodeOptions& options) -> std::vector<unsigned char>;
+
+	/// <summary>
+	/// Decode a stream.
+	/// Files encoded as blocks are decoded concurrently, framed streams are decoded without seeking.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <param name="options">Decode options</param>
+	/// <returns>Digest of the source recorded in file</returns>
+	static auto Decode(std::istream& source,
+	                   std::ostream& destination,
+	                   const DecodeOptions& options) -> std::vector<unsigned char>;
+
+	/// <summary>
+	/// Largest decoded length of an encoded buffer, to preallocate the output of DecodeBuffer.
+	/// It is exact for files recording their source length.
+	/// </summary>
+	/// <param name="source">Begin of encoded data</param>
+	/// <param name="sourceLength">Length of encoded data</param>
+	/// <returns>Bytes needed by DecodeBuffer at most</returns>
+	static auto DecodeBound(const uint8_t* source, const size_t sourceLength) -> uint64_t;
+
+	/// <summary>
+	/// Decode a buffer into a buffer, without any stream or copy of source.
+	/// Blocks are decoded concurrently into their places in output.
+	/// </summary>
+	/// <param name="source">Begin of encoded data</param>
+	/// <param name="sourceLength">Length of encoded data</param>
+	/// <param name="output">Begin of output</param>
+	/// <param name="outputLength">Length of output, DecodeBound(source, sourceLength) is always enough</param>
+	/// <param name="options">Decode options</param>
+	/// <returns>{decodedLength, digest}</returns>
+	static auto DecodeBuffer(const uint8_t* source,
+	                         const size_t sourceLength,
+	                         uint8_t* output,
+	                         const size_t outputLength,
+	                         const DecodeOptions& options) -> std::tuple<size_t, std::vector<unsigned char>>;
+
+	/// <summary>
+	/// Decode a file, digesting the decoded characters as they are written.
+	/// Unlike Decode followed by Verify, the destination is never read back.
+	/// </summary>
+	/// <param name="sourceFilename">File name of source file</param>
+	/// <param name="destination">Destination of decoded file</param>
+	/// <param name="options">Decode options</param>
+	/// <returns>True if the decoded characters match the digest recorded in file, or no digest is recorded</returns>
+	static auto DecodeAndVerify(const std::string& sourceFilename,
+	                            const std::string& destination,
+	                            const DecodeOptions& options) -> bool;
+
+	/// <summary>
+	/// Decode a stream, digesting the decoded characters as they are written.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="destination">Output destination</param>
+	/// <param name="options">Decode options</param>
+	/// <returns>True if the decoded characters match the digest recorded in stream, or no digest is recorded</returns>
+	static auto DecodeAndVerify(std::istream& source, std::ostream& destination, const DecodeOptions& options) -> bool;
+
+	/// <summary>
+	/// Verify a file with a digest as returned by Decode, its algorithm is told by its length.
+	/// An empty digest, of a file encoded without digest, verifies anything.
 	/// </summary>
 	/// <param name="sourceFilename">The file to verify</param>
-	/// <param name="digest">SHA-256 digest</param>
+	/// <param name="digest">Digest</param>
 	/// <returns>True if the input file's digest and input digest are same</returns>
 	static auto Verify(const std::string& sourceFilename, const std::vector<unsigned char>& digest) -> bool;
 
 	/// <summary>
-	/// Verify a stream content with SHA-256 digest.
+	/// Verify a stream content with a digest as returned by Decode, its algorithm is told by its length.
 	/// </summary>
 	/// <param name="source">Stream source</param>
-	/// <param name="digest">SHA-256 digest</param>
+	/// <param name="digest">Digest</param>
 	/// <returns>True if the input file's digest and input digest are same</returns>
 	static auto Verify(std::istream& source, const std::vector<unsigned char>& digest) -> bool;
 
+	/// <summary>
+	/// Verify a file with a digest of options.m_DigestAlgorithm, such as Sha256Tree which its length doesn't tell.
+	/// The leaves of Sha256Tree are hashed concurrently.
+	/// </summary>
+	/// <param name="sourceFilename">The file to verify</param>
+	/// <param name="digest">Digest</param>
+	/// <param name="options">Verify options</param>
+	/// <returns>True if the input file's digest and input digest are same</returns>
+	static auto Verify(const std::string& sourceFilename,
+	                   const std::vector<unsigned char>& digest,
+	                   const VerifyOptions& options) -> bool;
+
+	/// <summary>
+	/// Verify a stream content with a digest of options.m_DigestAlgorithm.
+	/// </summary>
+	/// <param name="source">Stream source</param>
+	/// <param name="digest">Digest</param>
+	/// <param name="options">Verify options</param>
+	/// <returns>True if the input file's digest and input digest are same</returns>
+	static auto Verify(std::istream& source, const std::vector<unsigned char>& digest, const VerifyOptions& options) -> bool;
+
+	/// <summary>
+	/// Digest of the source recorded in metadata.
+	/// </summary>
+	static auto GetDigest(const SerializedHuffmanTableMetaData& metaData) -> std::vector<unsigned char>;
+
 	/// <summary>
 	/// Return the metadata from stream.
 	/// </summary>
@@ -100,29 +446,160 @@ public:
 	static auto GetMetaData(const std::string& filename)->std::tuple<SerializedHuffmanTableMetaData, HuffmanTableMap>;
 
 private:
+	struct Workspace;
+
+	/// <summary>
+	/// Progress of an encode or decode, reported and polled for cancellation as its options tell.
+	/// The default one reports nothing and is never cancelled.
+	/// </summary>
+	class Progress
+	{
+	public:
+		Progress() = default;
+
+		template <typename Options>
+		Progress(const Options& options, const uint64_t total)
+			: m_OnProgress(options.m_OnProgress ? &options.m_OnProgress : nullptr)
+			, m_Interval(options.m_ProgressInterval ? options.m_ProgressInterval : 1)
+			, m_Cancellation(options.m_Cancellation)
+			, m_Total(total)
+		{
+		}
+
+		Progress(const Progress&) = delete;
+		Progress& operator=(const Progress&) = delete;
+
+		/// <summary>
+		/// Add bytes done from any thread, reporting them if another interval is done.
+		/// Throws CancelledError once cancelled.
+		/// </summary>
+		auto Advance(const uint64_t length) -> void;
+
+		/// <summary>
+		/// Throws CancelledError once cancelled.
+		/// </summary>
+		auto Poll() const -> void;
+
+		/// <summary>
+		/// Report the bytes done at the end of call, unless they were reported already.
+		/// </summary>
+		auto Finish() -> void;
+
+	private:
+		const std::function<void(uint64_t, uint64_t)>* m_OnProgress{};
+		uint64_t m_Interval{1};
+		const std::atomic<bool>* m_Cancellation{};
+		uint64_t m_Total{};
+		std::atomic<uint64_t> m_Done{};
+		uint64_t m_Reported{};     ///< Bytes done as last reported, guarded by m_ReportMutex.
+		std::mutex m_ReportMutex;
+
+		auto Report(const uint64_t done) -> void;
+	};
+
+	/// <summary>
+	/// Bytes of memory between polls of Progress, by the loops over a whole block or source.
+	/// </summary>
+	static constexpr size_t kProgressChunkSize = 1024 * 1024;
+
+	/// <summary>
+	/// Call process(pieceFirst, pieceLast) on pieces of kProgressChunkSize bytes from first to last.
+	/// Every piece advances progress if isCounted, otherwise it only polls progress.
+	/// </summary>
+	template <typename Process>
+	static auto ForEachPiece(const uint8_t* first,
+	                         const uint8_t* last,
+	                         Progress& progress,
+	                         const bool isCounted,
+	                         const Process& process) -> void;
 
 	/// <summary>
 	/// Get frequency table and hash of a file.
 	/// In order to avoid unnecessary access of file..
+	/// With more than one thread, chunks are read into a ring of buffers while the hash thread
+	/// hashes them in order and counting threads count them.
 	/// </summary>
 	/// <param name="fileStream">Source stream</param>
+	/// <param name="buffer">Read buffer, holding the ring of buffers</param>
+	/// <param name="options">Encode options, m_ThreadCount and m_DigestAlgorithm are used</param>
+	/// <param name="progress">Advanced by the bytes read</param>
 	/// <returns>{digest, frequencyTable}</returns>
-	static auto GetFrequencyAndHash(std::istream& fileStream)
+	static auto GetFrequencyAndHash(std::istream& fileStream,
+	                                std::vector<uint8_t>& buffer,
+	                                const EncodeOptions& options,
+	                                Progress& progress)
 	-> std::tuple<std::vector<unsigned char>, FrequencyContainer>;
 
 	/// <summary>
-	/// The huffman tree node struct
+	/// Get frequency table and hash of a buffer in one pass.
+	/// With more than one thread, the buffer is hashed on its own thread while the others count disjoint slices.
+	/// </summary>
+	/// <param name="first">Begin of buffer</param>
+	/// <param name="last">End of buffer</param>
+	/// <param name="options">Encode options, m_ThreadCount and m_DigestAlgorithm are used</param>
+	/// <param name="progress">Advanced by the bytes hashed</param>
+	/// <returns>{digest, frequencyTable}</returns>
+	static auto GetFrequencyAndHash(const uint8_t* first,
+	                                const uint8_t* last,
+	                                const EncodeOptions& options,
+	                                Progress& progress)
+	-> std::tuple<std::vector<unsigned char>, FrequencyContainer>;
+
+	/// <summary>
+	/// The huffman tree node struct, children are indexes into the flat node array.
 	/// </summary>
 	struct HuffmanTreeNode
 	{
-		std::shared_ptr<HuffmanTreeNode> m_LeftChild;
-		std::shared_ptr<HuffmanTreeNode> m_RightChild;
-		unsigned int m_Frequency;
+		uint64_t m_Frequency;
+		uint16_t m_LeftChild;
+		uint16_t m_RightChild;
 		char m_Character;
 	};
 
+	/// <summary>
+	/// Get frequency table of a buffer.
+	/// </summary>
+	static auto GetFrequency(const uint8_t* first, const uint8_t* last) -> FrequencyContainer;
+
+	using FrequencyCounts = std::array<uint64_t, 256>; ///< Count of every character, indexed by its byte value
+
+	/// <summary>
+	/// Add the count of every character of a buffer to counts.
+	/// Neighbouring characters are counted into separate sub-histograms merged at the end,
+	/// so a run of one character doesn't wait on the increment of the same counter.
+	/// </summary>
+	/// <param name="first">Begin of buffer</param>
+	/// <param name="last">End of buffer</param>
+	/// <param name="counts">Counts to add to</param>
+	/// <returns>void</returns>
+	static auto CountFrequency(const uint8_t* first, const uint8_t* last, FrequencyCounts& counts) -> void;
+
+	/// <summary>
+	/// Frequency table of the characters counted at least once.
+	/// </summary>
+	static auto MakeFrequency(const FrequencyCounts& counts) -> FrequencyContainer;
+
+	/// <summary>
+	/// Build the huffman tree with two queues over a flat node array, without any allocation but the result.
+	/// </summary>
 	static auto GenerateTreeFromFrequency(const FrequencyContainer& frequency) -> HuffmanTableMap;
 
+	/// <summary>
+	/// Generate the huffman table of a frequency table as requested by options.
+	/// </summary>
+	static auto GenerateHuffmanTable(const FrequencyContainer& frequency,
+	                                 const EncodeOptions& options) -> HuffmanTableMap;
+
+	/// <summary>
+	/// Generate a canonical huffman table whose codes are not longer than maxBitLength.
+	/// Bit lengths are optimal under the limit, computed with the package-merge algorithm.
+	/// </summary>
+	/// <param name="frequency">Frequency table</param>
+	/// <param name="maxBitLength">Longest code allowed</param>
+	/// <returns>Canonical huffman table</returns>
+	static auto GenerateLengthLimitedTable(const FrequencyContainer& frequency,
+	                                       const size_t maxBitLength) -> HuffmanTableMap;
+
 	struct SerializedHuffmanTableItem
 	{
 		uint8_t m_Character;
@@ -139,6 +616,463 @@ private:
 	static auto UnSerializeDecodeHuffmanTable(const uint8_t* buffer, const size_t length) -> HuffmanTableDecodeMap;
 
 	static auto UnSerializeDecodeHuffmanTable(const std::vector<uint8_t>& buffer) -> HuffmanTableDecodeMap;
+
+	/// <summary>
+	/// Reassign the encodes of a table as canonical huffman codes, keeping every bit length.
+	/// Characters are ordered by (bitLength, character), and the first bit of the stream is the
+	/// most significant bit of the canonical code.
+	/// </summary>
+	/// <param name="huffmanTable">Huffman table</param>
+	/// <returns>Canonical huffman table</returns>
+	static auto GenerateCanonicalTable(const HuffmanTableMap& huffmanTable) -> HuffmanTableMap;
+
+	/// <summary>
+	/// Serialize the bit lengths of a table.
+	/// Tables with less than 128 characters are stored as {character, bitLength} pairs,
+	/// the others as 256 bit lengths indexed by character.
+	/// </summary>
+	static auto SerializeCanonicalHuffmanTable(const HuffmanTableMap& huffmanTable) -> std::vector<uint8_t>;
+
+	static auto UnSerializeCanonicalHuffmanTable(const uint8_t* buffer, const size_t length) -> HuffmanTableMap;
+
+	static auto UnSerializeHuffmanTable(const TableFormat format, const std::vector<uint8_t>& buffer) -> HuffmanTableMap;
+
+	static auto UnSerializeDecodeHuffmanTable(const TableFormat format,
+	                                          const std::vector<uint8_t>& buffer) -> HuffmanTableDecodeMap;
+
+	/// <summary>
+	/// Item of the encode table, a zero bit length marks a character absent from the source.
+	/// </summary>
+	struct EncodeTableItem
+	{
+		uint32_t m_Encode;
+		uint32_t m_BitLength;
+	};
+
+	/// <summary>
+	/// Encode table indexed by the byte value of character.
+	/// </summary>
+	using EncodeTable = std::array<EncodeTableItem, 256>;
+
+	static auto BuildEncodeTable(const HuffmanTableMap& huffmanTable) -> EncodeTable;
+
+	/// <summary>
+	/// Append the codes of a chunk of source to bitWriter.
+	/// </summary>
+	static auto EncodeChunk(const EncodeTable& table,
+	                        BitWriter& bitWriter,
+	                        const uint8_t* first,
+	                        const uint8_t* last) -> void;
+
+	/// <summary>
+	/// Encode an independent block, which is padded to byte boundary, advancing progress by its length.
+	/// </summary>
+	/// <returns>Bit length of the block</returns>
+	static auto EncodeBlock(const EncodeTable& table,
+	                        const uint8_t* first,
+	                        const uint8_t* last,
+	                        std::vector<uint8_t>& output,
+	                        Progress& progress) -> uint64_t;
+
+	/// <summary>
+	/// Encode the source as blocks on a thread pool and write the block index and payload.
+	/// </summary>
+	/// <param name="source">Stream source, positioned at the begin</param>
+	/// <param name="destination">Output destination, positioned after the huffman table</param>
+	/// <param name="table">Encode table</param>
+	/// <param name="sourceLength">Length of source</param>
+	/// <param name="options">Encode options</param>
+	/// <param name="workspace">Buffers of the batches</param>
+	/// <param name="progress">Advanced by the bytes encoded</param>
+	/// <returns>Total bit length of the blocks, padding excluded</returns>
+	static auto EncodeBlocks(std::istream& source,
+	                         std::ostream& destination,
+	                         const EncodeTable& table,
+	                         const uint64_t sourceLength,
+	                         const EncodeOptions& options,
+	                         Workspace& workspace,
+	                         Progress& progress) -> uint64_t;
+
+	/// <summary>
+	/// Metadata of a file to be encoded, m_RedundancyBit and m_PayloadBitLength are left zero.
+	/// </summary>
+	static auto MakeMetaData(const std::vector<unsigned char>& hash,
+	                         const uint64_t sourceLength,
+	                         const size_t tableLength,
+	                         const EncodeOptions& options) -> SerializedHuffmanTableMetaData;
+
+	/// <summary>
+	/// Serialized length of metadata, files without kPayloadLengthFlag have a shorter one.
+	/// </summary>
+	static auto MetaDataLength(const SerializedHuffmanTableMetaData& metaData) noexcept -> size_t;
+
+	/// <summary>
+	/// Read the metadata following its first skipLength bytes, which are already in metaData.
+	/// </summary>
+	static auto ReadMetaData(std::istream& source, SerializedHuffmanTableMetaData& metaData, const size_t skipLength) -> void;
+
+	static auto ReadBlockIndex(std::istream& source)
+	-> std::tuple<SerializedBlockIndexHeader, std::vector<SerializedBlockIndexItem>>;
+
+	/// <summary>
+	/// Digest bytes from first to last, hashing the whole leaves of Sha256Tree concurrently.
+	/// </summary>
+	static auto UpdateDigest(Digest& digest, const uint8_t* first, const uint8_t* last, const size_t threadCount) -> void;
+
+	/// <summary>
+	/// Digest bytes from first to last in pieces of a leaf for every thread, polling progress between pieces.
+	/// </summary>
+	static auto UpdateDigest(Digest& digest,
+	                         const uint8_t* first,
+	                         const uint8_t* last,
+	                         const size_t threadCount,
+	                         Progress& progress) -> void;
+
+	/// <summary>
+	/// Read the checksums following the block index, empty without kBlockChecksumFlag.
+	/// </summary>
+	static auto ReadBlockChecksums(std::istream& source,
+	                               const SerializedHuffmanTableMetaData& metaData,
+	                               const size_t blockCount) -> std::vector<uint32_t>;
+
+	/// <summary>
+	/// Lookup table of the decoder.
+	/// Indexed by the next m_LookupBit bits of the stream, every entry holds (bitLength << 8 | character).
+	/// Entries with zero bit length belong to codes longer than m_LookupBit, which are kept in m_LongCodes.
+	/// </summary>
+	struct DecodeTable
+	{
+		std::vector<uint16_t> m_Entries;
+		size_t m_LookupBit;
+		size_t m_MaxBitLength;
+		HuffmanTableDecodeMap m_LongCodes;
+	};
+
+	/// <summary>
+	/// Bit reader state of the decoder, kept between input chunks.
+	/// </summary>
+	struct DecodeState
+	{
+		uint64_t m_BitBuffer;
+		size_t m_BitCount;
+		uint64_t m_BitsLeft; ///< Valid bits of the stream not consumed yet, including m_BitBuffer.
+	};
+
+	static auto BuildDecodeTable(const HuffmanTableDecodeMap& huffmanTable) -> DecodeTable;
+
+	/// <summary>
+	/// Build the decode table into table, reusing its memory.
+	/// </summary>
+	static auto BuildDecodeTable(const HuffmanTableDecodeMap& huffmanTable, DecodeTable& table) -> void;
+
+	/// <summary>
+	/// Decode a chunk of the bit stream.
+	/// Bits of an incomplete code are kept in state until the next chunk arrives.
+	/// </summary>
+	/// <param name="table">Decode table</param>
+	/// <param name="state">Bit reader state</param>
+	/// <param name="first">Begin of the chunk</param>
+	/// <param name="last">End of the chunk</param>
+	/// <param name="output">Decoded characters are appended to it</param>
+	/// <returns>void</returns>
+	static auto DecodeChunk(const DecodeTable& table,
+	                        DecodeState& state,
+	                        const uint8_t* first,
+	                        const uint8_t* last,
+	                        std::vector<uint8_t>& output) -> void;
+
+	/// <summary>
+	/// Decode a chunk of the bit stream into memory, decoding beyond outputLast throws.
+	/// </summary>
+	/// <returns>End of the decoded characters</returns>
+	static auto DecodeChunk(const DecodeTable& table,
+	                        DecodeState& state,
+	                        const uint8_t* first,
+	                        const uint8_t* last,
+	                        uint8_t* output,
+	                        uint8_t* outputLast) -> uint8_t*;
+
+	/// <summary>
+	/// Decode a chunk of the bit stream into a sink providing Put(character).
+	/// </summary>
+	template <typename Sink>
+	static auto DecodeChunkTo(const DecodeTable& table,
+	                          DecodeState& state,
+	                          const uint8_t* first,
+	                          const uint8_t* last,
+	                          Sink& sink) -> void;
+
+	/// <summary>
+	/// Decode the blocks of payload on a thread pool and write them in order.
+	/// </summary>
+	/// <param name="source">Stream source, positioned at the begin of payload</param>
+	/// <param name="destination">Output destination</param>
+	/// <param name="table">Decode table</param>
+	/// <param name="indexHeader">Header of block index</param>
+	/// <param name="index">Block index</param>
+	/// <param name="checksums">Checksums of blocks, empty if none</param>
+	/// <param name="sourceLength">Length of source, which places damaged blocks</param>
+	/// <param name="isLengthRecorded">Whether the file records sourceLength, which fixes the length of the last block too</param>
+	/// <param name="options">Decode options</param>
+	/// <param name="workspace">Buffers of the batches</param>
+	/// <param name="progress">Advanced by the bytes of blocks decoded</param>
+	/// <returns>void</returns>
+	static auto DecodeBlocks(std::istream& source,
+	                         std::ostream& destination,
+	                         const DecodeTable& table,
+	                         const SerializedBlockIndexHeader& indexHeader,
+	                         const std::vector<SerializedBlockIndexItem>& index,
+	                         const std::vector<uint32_t>& checksums,
+	                         const uint64_t sourceLength,
+	                         const bool isLengthRecorded,
+	                         const DecodeOptions& options,
+	                         Workspace& workspace,
+	                         Progress& progress) -> void;
+
+	/// <summary>
+	/// Decode the frames of a framed stream.
+	/// </summary>
+	/// <param name="source">Stream source, positioned after kStreamMagic</param>
+	/// <param name="destination">Output destination</param>
+	/// <param name="options">Decode options, m_Stats is used</param>
+	/// <param name="workspace">Buffers and table of the frames</param>
+	/// <param name="progress">Advanced by the bytes of frames decoded</param>
+	/// <returns>Digest of the source recorded in stream</returns>
+	static auto DecodeStream(std::istream& source,
+	                         std::ostream& destination,
+	                         const DecodeOptions& options,
+	                         Workspace& workspace,
+	                         Progress& progress) -> std::vector<unsigned char>;
+
+	/// <summary>
+	/// Everything of a file encoded from memory but its payload.
+	/// A single stream is kept as one block without index.
+	/// </summary>
+	struct MemoryEncodeLayout
+	{
+		SerializedHuffmanTableMetaData m_MetaData;
+		std::vector<uint8_t> m_SerializedTable;
+		EncodeTable m_EncodeTable;
+		SerializedBlockIndexHeader m_IndexHeader;
+		std::vector<SerializedBlockIndexItem> m_Index;
+		std::vector<uint32_t> m_Checksums; ///< Checksums of blocks, empty without options.m_BlockChecksum.
+		size_t m_HeaderLength;             ///< Metadata, table, block index and checksums.
+		uint64_t m_EncodedLength;          ///< Header and payload.
+	};
+
+	/// <summary>
+	/// Build the table of a source in memory and count the bit length of every block.
+	/// Progress is advanced by the bytes counted, and polled while the bit lengths are counted.
+	/// </summary>
+	static auto PrepareEncodeLayout(const uint8_t* first,
+	                                const uint8_t* last,
+	                                const EncodeOptions& options,
+	                                MemoryEncodeLayout& layout,
+	                                Progress& progress) -> void;
+
+	/// <summary>
+	/// Write the file of a prepared source, every block is encoded concurrently into its place.
+	/// </summary>
+	/// <param name="first">Begin of source</param>
+	/// <param name="layout">Layout prepared from the same source</param>
+	/// <param name="output">Output of layout.m_EncodedLength bytes</param>
+	/// <param name="options">Encode options</param>
+	/// <param name="progress">Advanced by the bytes encoded</param>
+	/// <returns>void</returns>
+	static auto EncodeMemory(const uint8_t* first,
+	                         const MemoryEncodeLayout& layout,
+	                         uint8_t* output,
+	                         const EncodeOptions& options,
+	                         Progress& progress) -> void;
+
+	/// <summary>
+	/// Everything of a file in memory needed to decode its payload.
+	/// A single stream is kept as one block without index.
+	/// </summary>
+	struct MemoryDecodeLayout
+	{
+		SerializedHuffmanTableMetaData m_MetaData;
+		DecodeTable m_Table;
+		SerializedBlockIndexHeader m_IndexHeader;
+		std::vector<SerializedBlockIndexItem> m_Index;
+		std::vector<uint32_t> m_Checksums; ///< Checksums of blocks, empty without kBlockChecksumFlag.
+		const uint8_t* m_Payload;
+	};
+
+	/// <summary>
+	/// Parse and check a file in memory.
+	/// </summary>
+	/// <param name="source">Begin of file</param>
+	/// <param name="length">Length of file</param>
+	/// <param name="layout">Parsed layout</param>
+	/// <param name="stats">Stats given the time of reading and building the table, null for none</param>
+	/// <returns>False for framed streams and files without kPayloadLengthFlag, which can't be decoded in place</returns>
+	static auto ReadDecodeLayout(const uint8_t* source,
+	                             const size_t length,
+	                             MemoryDecodeLayout& layout,
+	                             CodecStats* stats) -> bool;
+
+	/// <summary>
+	/// Digest of the output of DecodeMemory, taking every block as soon as it is decoded,
+	/// so the output isn't read again once it may have left memory.
+	/// Sha256Tree hashes a leaf on the thread decoding the last of its bytes,
+	/// the other algorithms take the blocks in order, one thread at a time.
+	/// </summary>
+	class OutputDigester
+	{
+	public:
+		/// <param name="digest">Digest not updated yet</param>
+		/// <param name="output">Output of DecodeMemory</param>
+		/// <param name="layout">Layout of the decode</param>
+		/// <param name="threadCount">Threads of the decode, 0 for the count of hardware threads</param>
+		OutputDigester(Digest& digest, const uint8_t* output, const MemoryDecodeLayout& layout, size_t threadCount);
+
+		OutputDigester(const OutputDigester&) = delete;
+		OutputDigester& operator=(const OutputDigester&) = delete;
+
+		/// <summary>
+		/// Take a block once its bytes are final, from any thread.
+		/// </summary>
+		auto Done(size_t block, Progress& progress) -> void;
+
+		/// <summary>
+		/// Append the leaves of Sha256Tree once every block is done.
+		/// </summary>
+		auto Finish() -> void;
+
+	private:
+		Digest& m_Digest;
+		const uint8_t* m_Output;
+		uint64_t m_Length;
+		uint64_t m_BlockSize;
+		size_t m_LeafThreadCount;               ///< Threads hashing the leaves completed by a block.
+		std::mutex m_Mutex;
+		std::vector<uint8_t> m_IsDone;          ///< Blocks decoded, guarded by m_Mutex.
+		size_t m_Frontier{0};                   ///< Blocks digested or being digested, guarded by m_Mutex.
+		bool m_IsDigesting{false};              ///< A thread is digesting from the frontier, guarded by m_Mutex.
+		std::vector<uint64_t> m_LeafBytesLeft;  ///< Bytes of every leaf not decoded yet, guarded by m_Mutex.
+		std::vector<Digest::TreeHash> m_Leaves;
+	};
+
+	/// <summary>
+	/// Decode every block concurrently into its place in output, which holds m_SourceLength bytes.
+	/// Damaged blocks are handled as options.m_OnDamagedBlock tells, progress is advanced by the bytes of blocks.
+	/// </summary>
+	/// <param name="outputDigest">Digest updated with the output as blocks are decoded, null for none</param>
+	static auto DecodeMemory(const MemoryDecodeLayout& layout,
+	                         uint8_t* output,
+	                         const DecodeOptions& options,
+	                         Progress& progress,
+	                         Digest* outputDigest = nullptr) -> void;
+
+	/// <summary>
+	/// Buffers and tables of codec calls.
+	/// The public static functions use a fresh one per call, HuffmanCodec keeps one across calls.
+	/// </summary>
+	struct Workspace
+	{
+		std::vector<uint8_t> m_ReadBuffer;
+		std::vector<uint8_t> m_WriteBuffer;
+		std::vector<uint8_t> m_TableBuffer;
+		std::vector<std::vector<uint8_t>> m_BatchReadBuffers[2];
+		std::vector<std::vector<uint8_t>> m_BatchWriteBuffers;
+		DecodeTable m_DecodeTable;
+		MemoryEncodeLayout m_EncodeLayout;
+		MemoryDecodeLayout m_DecodeLayout;
+		bool m_DigestOutput{false};                     ///< Set by DecodeAndVerify while decoding.
+		Digest m_OutputDigest{Digest::Algorithm::None}; ///< Digest of the decoded characters.
+		uint64_t m_DecodedLength{};                     ///< Characters written by WriteDecoded since StartOutputDigest.
+	};
+
+	/// <summary>
+	/// Start the digest and count of decoded characters, once the algorithm recorded in source is known.
+	/// </summary>
+	static auto StartOutputDigest(const Digest::Algorithm algorithm, Workspace& workspace) -> void;
+
+	/// <summary>
+	/// Write decoded characters to destination, and digest them if verifying.
+	/// </summary>
+	static auto WriteDecoded(std::ostream& destination, const std::vector<uint8_t>& characters, Workspace& workspace)
+	-> void;
+
+	/// <summary>
+	/// Run decode with the digest of decoded characters enabled.
+	/// </summary>
+	/// <param name="workspace">Workspace used by decode</param>
+	/// <param name="decode">Callable decoding through workspace, returning the recorded digest</param>
+	/// <returns>True if the recorded digest matches the decoded characters</returns>
+	template <typename Decoder>
+	static auto DecodeVerified(Workspace& workspace, const Decoder& decode) -> bool;
+
+	static auto Encode(const std::string& sourceFilename,
+	                   const std::string& destination,
+	                   const EncodeOptions& options,
+	                   Workspace& workspace) -> void;
+
+	static auto Encode(std::istream& source,
+	                   std::ostream& destination,
+	                   const EncodeOptions& options,
+	                   Workspace& workspace) -> void;
+
+	static auto EncodeStream(std::istream& source,
+	                         std::ostream& destination,
+	                         const EncodeOptions& options,
+	                         Workspace& workspace) -> void;
+
+	static auto EncodeBuffer(const uint8_t* source,
+	                         const size_t sourceLength,
+	                         uint8_t* output,
+	                         const size_t outputLength,
+	                         const EncodeOptions& options,
+	                         Workspace& workspace) -> size_t;
+
+	static auto Decode(const std::string& sourceFilename,
+	                   const std::string& destination,
+	                   const DecodeOptions& options,
+	                   Workspace& workspace) -> std::vector<unsigned char>;
+
+	static auto Decode(std::istream& source,
+	                   std::ostream& destination,
+	                   const DecodeOptions& options,
+	                   Workspace& workspace) -> std::vector<unsigned char>;
+
+	static auto DecodeBuffer(const uint8_t* source,
+	                         const size_t sourceLength,
+	                         uint8_t* output,
+	                         const size_t outputLength,
+	                         const DecodeOptions& options,
+	                         Workspace& workspace) -> std::tuple<size_t, std::vector<unsigned char>>;
+
+	static auto DecodeAndVerify(const std::string& sourceFilename,
+	                            const std::string& destination,
+	                            const DecodeOptions& options,
+	                            Workspace& workspace) -> bool;
+
+	static auto DecodeAndVerify(std::istream& source,
+	                            std::ostream& destination,
+	                            const DecodeOptions& options,
+	                            Workspace& workspace) -> bool;
+
+#ifdef MAPPED_FILE_SUPPORTED
+	/// <summary>
+	/// Encode a file through memory mappings.
+	/// The bit length of every block is counted first, so the destination is created at its final
+	/// length and every block is encoded concurrently into its place.
+	/// </summary>
+	static auto EncodeMapped(const std::string& sourceFilename,
+	                         const std::string& destination,
+	                         const EncodeOptions& options,
+	                         Workspace& workspace) -> void;
+
+	/// <summary>
+	/// Decode a file through memory mappings, blocks are decoded concurrently into their places.
+	/// Framed streams and files without kPayloadLengthFlag are decoded from the mapped source only.
+	/// </summary>
+	static auto DecodeMapped(const std::string& sourceFilename,
+	                         const std::string& destination,
+	                         const DecodeOptions& options,
+	                         Workspace& workspace) -> std::vector<unsigned char>;
+#endif
 };
 
 
@@ -0,0 +1,111 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+#ifdef MAPPED_FILE_SUPPORTED
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <utility>
+
+auto MappedFile::OpenRead(const std::string& filename) -> MappedFile
+{
+	MappedFile file;
+	file.m_File = open(filename.c_str(), O_RDONLY);
+	if (file.m_File < 0)
+	{
+		throw std::runtime_error("MappedFile: Can't open " + filename);
+	}
+	struct stat status{};
+	if (fstat(file.m_File, &status) != 0)
+	{
+		throw std::runtime_error("MappedFile: Can't stat " + filename);
+	}
+	file.m_Size = static_cast<size_t>(status.st_size);
+	if (0 == file.m_Size)
+	{
+		return file;
+	}
+	auto* data = mmap(nullptr, file.m_Size, PROT_READ, MAP_PRIVATE, file.m_File, 0);
+	if (MAP_FAILED == data)
+	{
+		throw std::runtime_error("MappedFile: Can't map " + filename);
+	}
+	file.m_Data = static_cast<uint8_t*>(data);
+	madvise(data, file.m_Size, MADV_SEQUENTIAL);
+	return file;
+}
+
+auto MappedFile::Create(const std::string& filename, const uint64_t length) -> MappedFile
+{
+	MappedFile file;
+	file.m_File = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file.m_File < 0)
+	{
+		throw std::runtime_error("MappedFile: Can't create " + filename);
+	}
+	if (ftruncate(file.m_File, static_cast<off_t>(length)) != 0)
+	{
+		throw std::runtime_error("MappedFile: Can't resize " + filename);
+	}
+	file.m_Size = static_cast<size_t>(length);
+	if (0 == file.m_Size)
+	{
+		return file;
+	}
+	auto* data = mmap(nullptr, file.m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, file.m_File, 0);
+	if (MAP_FAILED == data)
+	{
+		throw std::runtime_error("MappedFile: Can't map " + filename);
+	}
+	file.m_Data = static_cast<uint8_t*>(data);
+	return file;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: m_File(std::exchange(other.m_File, -1)),
+	  m_Data(std::exchange(other.m_Data, nullptr)),
+	  m_Size(std::exchange(other.m_Size, 0))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Release();
+		m_File = std::exchange(other.m_File, -1);
+		m_Data = std::exchange(other.m_Data, nullptr);
+		m_Size = std::exchange(other.m_Size, 0);
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	Release();
+}
+
+auto MappedFile::Data() const noexcept -> uint8_t* { return m_Data; }
+
+auto MappedFile::Size() const noexcept -> size_t { return m_Size; }
+
+auto MappedFile::Release() noexcept -> void
+{
+	if (m_Data)
+	{
+		munmap(m_Data, m_Size);
+		m_Data = nullptr;
+	}
+	m_Size = 0;
+	if (m_File >= 0)
+	{
+		close(m_File);
+		m_File = -1;
+	}
+}
+
+#endif // MAPPED_FILE_SUPPORTED
@@ -0,0 +1,57 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#if defined(__linux__)
+#define MAPPED_FILE_SUPPORTED
+#endif
+
+#ifdef MAPPED_FILE_SUPPORTED
+
+/// <summary>
+/// A file mapped into memory.
+/// </summary>
+class MappedFile
+{
+public:
+	/// <summary>
+	/// Map an existing file for reading.
+	/// </summary>
+	/// <param name="filename">File to map</param>
+	/// <returns>The mapping</returns>
+	static auto OpenRead(const std::string& filename) -> MappedFile;
+
+	/// <summary>
+	/// Create or truncate a file of length bytes and map it for writing.
+	/// </summary>
+	/// <param name="filename">File to create</param>
+	/// <param name="length">Length of file</param>
+	/// <returns>The mapping</returns>
+	static auto Create(const std::string& filename, const uint64_t length) -> MappedFile;
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	auto Data() const noexcept -> uint8_t*;
+
+	auto Size() const noexcept -> size_t;
+
+private:
+	MappedFile() = default;
+
+	int m_File{-1};
+	uint8_t* m_Data{};
+	size_t m_Size{};
+
+	auto Release() noexcept -> void;
+};
+
+#endif // MAPPED_FILE_SUPPORTED
+
+#endif // MAPPED_FILE_H
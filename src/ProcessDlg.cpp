@@ -5,11 +5,15 @@
 #include "Huffman.h"
 #include "ProcessDlg.h"
 #include "afxdialogex.h"
+#include "BatchScheduler.h"
 #include "HuffmanEncoder.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 #include "FileDetailDlg.h"
 #include "Sha256.h"
 
+#include <algorithm>
+#include <filesystem>
 #include <vector>
 #include <tuple>
 
@@ -34,39 +38,95 @@ ProcessDlg::~ProcessDlg()
 
 auto ProcessDlg::ProcessProc(ProcessDlg& dialog,
                              SafeQueue<ProcessUnit>& queue,
-                             const bool& cancellationFlag)
+                             const std::atomic<bool>& cancellationFlag)
 {
-	ProcessUnit unit;
-	short count = 0;
-	dialog.m_ProgressBar.SetRange(0, static_cast<short>(queue.Size()));
-	while (!queue.Empty() && !cancellationFlag)
+	// Every file is queued before the process starts, so all of them are scheduled at once, the largest first.
+	std::vector<ProcessUnit> units;
+	std::vector<uint64_t> sourceLengths;
+	ProcessUnit queued;
+	while (queue.TryPop(queued))
 	{
-		queue.WaitAndPop(unit, cancellationFlag);
+		std::error_code error;
+		const auto length = std::filesystem::file_size(queued.Source(), error);
+		sourceLengths.push_back(error ? 0 : length);
+		units.push_back(std::move(queued));
+	}
+
+	// Every file is a hundred steps of the bar, advanced by the progress of its encode or decode.
+	std::atomic<int> progress{0};
+	dialog.m_ProgressBar.SetRange32(0, static_cast<int>(units.size()) * 100);
+
+	// The hardware threads are shared by the files in flight.
+	auto batchOptions           = BatchScheduler::Options{};
+	batchOptions.m_WorkerCount  = dialog.m_WorkerCount;
+	batchOptions.m_MemoryBudget = dialog.m_MemoryBudget;
+	batchOptions.m_Cancellation = &cancellationFlag;
+	const auto workerCount = (std::max)((std::min)(ThreadPool::ResolveThreadCount(dialog.m_WorkerCount), units.size()),
+	                                    size_t{1});
+	const auto threadCount = (std::max)(ThreadPool::ResolveThreadCount(0) / workerCount, size_t{1});
+
+	BatchScheduler::Run(sourceLengths, batchOptions, [&](const size_t unitPos)
+	{
+		const auto& unit = units[unitPos];
 		auto index = ProcessDlg::FindListItem(dialog.m_ProcessList, 1, CString(unit.Source().c_str()));
 		dialog.m_ProcessList.SetItemText(index, kStatusColumn, _T("Processing..."));
 		dialog.m_TipText.SetWindowText(CString("Processing: ") + CString(GetFilenameFromPath(unit.Source()).c_str()));
 
-		if (unit.m_IsEncode)
+		// Called by one thread at a time for a file, so only the sum of files is shared.
+		// The bar is set by the UI thread, which keeps the largest sum posted.
+		int percentDone = 0;
+		const auto advance = [&dialog, &progress, &percentDone](const int percent)
+		{
+			dialog.PostMessage(WM_SET_PROGRESS, static_cast<WPARAM>(progress += percent - percentDone), 0);
+			percentDone = percent;
+		};
+		const auto onProgress = [&dialog, &advance, index](const uint64_t done, const uint64_t total)
+		{
+			const auto percent = static_cast<int>(total ? (std::min)(done * 100 / total, uint64_t{100}) : 0);
+			CString status;
+			status.Format(_T("Processing... %d%%"), percent);
+			dialog.m_ProcessList.SetItemText(index, kStatusColumn, status);
+			advance(percent);
+		};
+		try
+		{
+			if (unit.m_IsEncode)
+			{
+				HuffmanEncoder::CodecStats stats;
+				HuffmanEncoder::EncodeOptions options;
+				options.m_ThreadCount  = threadCount;
+				options.m_Stats        = &stats;
+				options.m_OnProgress   = onProgress;
+				options.m_Cancellation = &cancellationFlag;
+				HuffmanEncoder::Encode(unit.Source(), unit.Destination(), options);
+				auto compRatio = static_cast<int>(stats.m_BytesIn ? (stats.m_BytesOut * 100) / stats.m_BytesIn : 0);
+
+				CString ratio;
+				ratio.Format(_T("%d%%"), compRatio);
+				dialog.m_ProcessList.SetItemText(index, kCompressionRatioColumn, ratio);
+				dialog.m_ProcessList.SetItemText(index, kStatusColumn, _T("Encoded"));
+			}
+			else
+			{
+				HuffmanEncoder::DecodeOptions options;
+				options.m_ThreadCount  = threadCount;
+				options.m_OnProgress   = onProgress;
+				options.m_Cancellation = &cancellationFlag;
+				auto verify = HuffmanEncoder::DecodeAndVerify(unit.Source(), unit.Destination(), options);
+				dialog.m_ProcessList.SetItemText(index, kCompressionRatioColumn, _T("-"));
+				dialog.m_ProcessList.SetItemText(index, kStatusColumn, verify ? _T("Decoded") : _T("Verify failed"));
+			}
+		}
+		catch (const HuffmanEncoder::CancelledError&)
 		{
-			HuffmanEncoder::Encode(unit.Source(), unit.Destination());
-			auto sourceLength = GetFileLength(unit.Source());
-			auto destLength   = GetFileLength(unit.Destination());
-			auto compRatio    = (destLength * 100) / sourceLength;
-
-			CString ratio;
-			ratio.Format(_T("%d%%"), compRatio);
-			dialog.m_ProcessList.SetItemText(index, kCompressionRatioColumn, ratio);
-			dialog.m_ProcessList.SetItemText(index, kStatusColumn, _T("Encoded"));
+			dialog.m_ProcessList.SetItemText(index, kStatusColumn, _T("Cancelled"));
 		}
-		else
+		catch (const std::exception&)
 		{
-			auto digest = HuffmanEncoder::Decode(unit.Source(), unit.Destination());
-			auto verify = HuffmanEncoder::Verify(unit.Destination(), digest);
-			dialog.m_ProcessList.SetItemText(index, kCompressionRatioColumn, _T("-"));
-			dialog.m_ProcessList.SetItemText(index, kStatusColumn, verify ? _T("Decoded") : _T("Verify failed"));
+			dialog.m_ProcessList.SetItemText(index, kStatusColumn, _T("Failed"));
 		}
-		dialog.m_ProgressBar.SetPos(++count);
-	}
+		advance(100);
+	});
 	dialog.m_TipText.SetWindowText(_T("Done"));
 	dialog.m_BtnCancel.SetWindowText(_T("Done"));
 }
@@ -84,13 +144,6 @@ auto ProcessDlg::StartProcess() -> void
 		}));
 }
 
-auto ProcessDlg::GetFileLength(const std::string& filename) -> std::streampos
-{
-	std::ifstream f{filename, std::ios::in};
-	f.seekg(0, std::ios::end);
-	return f.tellg();
-}
-
 void ProcessDlg::DoDataExchange(CDataExchange* pDX)
 {
 	CDialogEx::DoDataExchange(pDX);
@@ -106,6 +159,7 @@ BEGIN_MESSAGE_MAP(ProcessDlg, CDialogEx)
 	ON_WM_NCDESTROY()
 	ON_WM_CLOSE()
 	ON_MESSAGE(WM_SAFE_DESTORY, OnSafeDestroy)
+	ON_MESSAGE(WM_SET_PROGRESS, OnSetProgress)
 	ON_BN_CLICKED(IDC_Detail, &ProcessDlg::OnBnClickedDetail)
 END_MESSAGE_MAP()
 
@@ -147,6 +201,13 @@ LRESULT ProcessDlg::OnSafeDestroy(WPARAM wParam, LPARAM lParam)
 	return 0;
 }
 
+LRESULT ProcessDlg::OnSetProgress(WPARAM wParam, LPARAM lParam)
+{
+	// Posted by several workers, a smaller sum may arrive after a larger one.
+	m_ProgressBar.SetPos((std::max)(m_ProgressBar.GetPos(), static_cast<int>(wParam)));
+	return 0;
+}
+
 void ProcessDlg::PostNcDestroy()
 {
 	CDialog::PostNcDestroy();
@@ -197,9 +258,10 @@ void ProcessDlg::OnBnClickedDetail()
 		auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(isEncode
 			                                                            ? csDest.GetString()
 			                                                            : csSource.GetString());
+		const auto digest = HuffmanEncoder::GetDigest(metaData);
 		details.push_back({
-			"SHA256",
-			picosha2::bytes_to_hex_string(metaData.m_FileHash, metaData.m_FileHash + sizeof(metaData.m_FileHash))
+			Digest::Name(metaData.m_DigestAlgorithm),
+			picosha2::bytes_to_hex_string(digest.begin(), digest.end())
 		});
 		for (size_t i{}; i < 3; ++i)details.push_back({"", ""});
 		details.push_back({"Character", "Encode"});
@@ -4,18 +4,22 @@
 #include "Queue.h"
 #include "Utils.h"
 
+#include <atomic>
 #include <mutex>
 
 // ProcessDlg dialog
 
 #define WM_SAFE_DESTORY (WM_USER+1)
+#define WM_SET_PROGRESS (WM_USER+2)
 
 class ProcessDlg : public CDialogEx
 {
 DECLARE_DYNAMIC(ProcessDlg)
 	SafeQueue<ProcessUnit> m_Queue;
 	std::shared_ptr<std::thread> m_Thread;
-	bool m_CancellationFlag{false};
+	std::atomic<bool> m_CancellationFlag{false}; ///< Polled by the queue and inside encodes and decodes.
+	size_t m_WorkerCount{0};                     ///< Files processed at once, 0 for the count of hardware threads.
+	uint64_t m_MemoryBudget{uint64_t{1} << 30};  ///< Bytes of the files in flight at most, 0 for no limit.
 public:
 	ProcessDlg(CWnd* pParent = nullptr); // standard constructor
 	virtual ~ProcessDlg();
@@ -39,7 +43,16 @@ public:
 
 	static auto ProcessProc(ProcessDlg& dialog,
 	                        SafeQueue<ProcessUnit>& queue,
-	                        const bool& cancellationFlag);
+	                        const std::atomic<bool>& cancellationFlag);
+
+	/// <summary>
+	/// Set the files processed at once and the bytes of their sources in flight at most, before StartProcess.
+	/// </summary>
+	auto SetConcurrency(const size_t workerCount, const uint64_t memoryBudget) -> void
+	{
+		m_WorkerCount  = workerCount;
+		m_MemoryBudget = memoryBudget;
+	}
 
 	auto StartProcess() -> void;
 
@@ -56,8 +69,6 @@ public:
 		return -1;
 	}
 
-	static auto GetFileLength(const std::string& filename) -> std::streampos;
-
 
 	// Dialog Data
 #ifdef AFX_DESIGN_TIME
@@ -75,6 +86,7 @@ public:
 	afx_msg void OnCancel() override;
 	afx_msg void OnBnClickedCancel();
 	afx_msg LRESULT OnSafeDestroy(WPARAM wParam, LPARAM lParam);
+	afx_msg LRESULT OnSetProgress(WPARAM wParam, LPARAM lParam);
 	afx_msg void PostNcDestroy() override;
 	afx_msg void OnClose();
 	CButton m_BtnCancel;
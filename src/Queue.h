@@ -2,6 +2,8 @@
 #define QUEUE_H
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -68,7 +70,7 @@ public:
      * 当队列中有元素时，从队列中取回并弹出元素，没有元素时等待新元素出现
      * @param outValue 弹出的元素
      */
-    void WaitAndPop(T& outValue, const bool& cancellatinFlag)
+    void WaitAndPop(T& outValue, const std::atomic<bool>& cancellatinFlag)
     {
         std::unique_lock<std::mutex> lock{ m_Mutex };
         m_DataCondition.wait(lock, [this, &cancellatinFlag]() { return !m_Queue.empty() || cancellatinFlag; });
@@ -85,7 +87,7 @@ public:
      * 当队列中有元素时，从队列中取回并弹出元素，没有元素时等待新元素出现
      * @return std::shared_ptr<T> 弹出元素的指针
      */
-    std::shared_ptr<T> WaitAndPop(const bool& cancellatinFlag)
+    std::shared_ptr<T> WaitAndPop(const std::atomic<bool>& cancellatinFlag)
     {
         std::unique_lock<std::mutex> lock{ m_Mutex };
         m_DataCondition.wait(lock, [this, &cancellatinFlag]() { return !m_Queue.empty() || cancellatinFlag; });
@@ -0,0 +1,312 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+/// <summary>
+/// Bounded multi-producer multi-consumer queue over a ring of cells.
+/// Pushing and popping claim a cell with a compare and swap of its position and never take a lock,
+/// every cell carries a sequence telling whether it is free to write or ready to read.
+/// The ring is allocated once by the constructor, so pushing and popping don't allocate.
+/// Blocking calls spin a while and then sleep, a lock is taken only to sleep and to wake sleepers.
+/// </summary>
+/// <typeparam name="T">Element type, default constructible and move assignable</typeparam>
+template <typename T>
+class RingQueue
+{
+public:
+	/// <summary>
+	/// Allocate the ring.
+	/// </summary>
+	/// <param name="capacity">Elements held at most, a power of two</param>
+	explicit RingQueue(const size_t capacity)
+		: m_Cells(new Cell[capacity])
+		, m_Mask(capacity - 1)
+	{
+		if (capacity < 2 || 0 != (capacity & (capacity - 1)))
+		{
+			throw std::invalid_argument("RingQueue: Capacity must be a power of two");
+		}
+		for (size_t i{}; i < capacity; ++i)
+		{
+			m_Cells[i].m_Sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	RingQueue(const RingQueue&) = delete;
+	RingQueue& operator=(const RingQueue&) = delete;
+
+	/// <summary>
+	/// Push a copy of an element unless the queue is full or closed.
+	/// </summary>
+	/// <returns>True if pushed</returns>
+	auto TryPush(const T& value) -> bool { return TryPushValue(value); }
+
+	/// <summary>
+	/// Move an element in unless the queue is full or closed.
+	/// </summary>
+	/// <returns>True if pushed, otherwise value is not moved from</returns>
+	auto TryPush(T&& value) -> bool { return TryPushValue(std::move(value)); }
+
+	/// <summary>
+	/// Push an element, waiting for room while the queue is full.
+	/// </summary>
+	/// <returns>False if the queue is closed, then the element is dropped</returns>
+	auto Push(T value) -> bool
+	{
+		if (!Wait(m_PushWaiters, m_NotFull, [this, &value]() { return TryEnqueue(std::move(value)); }))
+		{
+			return false;
+		}
+		Wake(m_PopWaiters, m_NotEmpty);
+		return true;
+	}
+
+	/// <summary>
+	/// Pop an element unless the queue is empty or cancelled.
+	/// </summary>
+	/// <returns>True if popped into outValue</returns>
+	auto TryPop(T& outValue) -> bool
+	{
+		if (!TryDequeue(outValue))
+		{
+			return false;
+		}
+		Wake(m_PushWaiters, m_NotFull);
+		return true;
+	}
+
+	/// <summary>
+	/// Pop an element, waiting for one while the queue is empty.
+	/// </summary>
+	/// <returns>False once the queue is closed and drained, or cancelled</returns>
+	auto Pop(T& outValue) -> bool
+	{
+		if (!Wait(m_PopWaiters, m_NotEmpty, [this, &outValue]() { return TryDequeue(outValue); }))
+		{
+			return false;
+		}
+		Wake(m_PushWaiters, m_NotFull);
+		return true;
+	}
+
+	/// <summary>
+	/// Fail pushes from now on and wake everyone waiting, pops drain the elements left.
+	/// Producers are expected to be done, a push racing with Close may still land.
+	/// </summary>
+	auto Close() -> void
+	{
+		m_IsClosed.store(true, std::memory_order_release);
+		WakeAll();
+	}
+
+	/// <summary>
+	/// Close the queue and fail pops from now on, the elements left are abandoned.
+	/// </summary>
+	auto Cancel() -> void
+	{
+		m_IsCancelled.store(true, std::memory_order_release);
+		Close();
+	}
+
+	auto IsClosed() const noexcept -> bool { return m_IsClosed.load(std::memory_order_acquire); }
+
+	/// <summary>
+	/// Count of elements, only a snapshot while other threads push or pop.
+	/// </summary>
+	auto Size() const noexcept -> size_t
+	{
+		const auto popPos  = m_PopPos.load(std::memory_order_acquire);
+		const auto pushPos = m_PushPos.load(std::memory_order_acquire);
+		return pushPos > popPos ? pushPos - popPos : 0;
+	}
+
+	auto Empty() const noexcept -> bool { return 0 == Size(); }
+
+	auto Capacity() const noexcept -> size_t { return m_Mask + 1; }
+
+private:
+	/// <summary>
+	/// A cell is free to write at position p when its sequence is p, and ready to read when it is p + 1.
+	/// Reading it frees it for position p + capacity.
+	/// </summary>
+	struct Cell
+	{
+		std::atomic<size_t> m_Sequence;
+		T m_Value;
+	};
+
+	static constexpr size_t kCacheLineSize = 64;
+	static constexpr int kSpinCount        = 64;
+
+	std::unique_ptr<Cell[]> m_Cells;
+	const size_t m_Mask;
+	alignas(kCacheLineSize) std::atomic<size_t> m_PushPos{0};
+	alignas(kCacheLineSize) std::atomic<size_t> m_PopPos{0};
+	alignas(kCacheLineSize) std::atomic<bool> m_IsClosed{false};
+	std::atomic<bool> m_IsCancelled{false};
+	std::atomic<size_t> m_PushWaiters{0}; ///< Threads sleeping or about to sleep on m_NotFull.
+	std::atomic<size_t> m_PopWaiters{0};  ///< Threads sleeping or about to sleep on m_NotEmpty.
+	std::mutex m_WaitMutex;
+	std::condition_variable m_NotFull;
+	std::condition_variable m_NotEmpty;
+
+	template <typename Value>
+	auto TryPushValue(Value&& value) -> bool
+	{
+		if (!TryEnqueue(std::forward<Value>(value)))
+		{
+			return false;
+		}
+		Wake(m_PopWaiters, m_NotEmpty);
+		return true;
+	}
+
+	template <typename Value>
+	auto TryEnqueue(Value&& value) -> bool
+	{
+		return !m_IsClosed.load(std::memory_order_acquire) && Enqueue(std::forward<Value>(value));
+	}
+
+	auto TryDequeue(T& outValue) -> bool
+	{
+		return !m_IsCancelled.load(std::memory_order_acquire) && Dequeue(outValue);
+	}
+
+	/// <summary>
+	/// Copy or move value into a free cell, value is only taken once a cell is claimed.
+	/// </summary>
+	template <typename Value>
+	auto Enqueue(Value&& value) -> bool
+	{
+		auto pos = m_PushPos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			auto& cell     = m_Cells[pos & m_Mask];
+			const auto seq = cell.m_Sequence.load(std::memory_order_acquire);
+			const auto lag = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+			if (0 == lag)
+			{
+				if (m_PushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.m_Value = std::forward<Value>(value);
+					cell.m_Sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (lag < 0)
+			{
+				// The cell still holds the element of a lap ago.
+				return false;
+			}
+			else
+			{
+				pos = m_PushPos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	auto Dequeue(T& outValue) -> bool
+	{
+		auto pos = m_PopPos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			auto& cell     = m_Cells[pos & m_Mask];
+			const auto seq = cell.m_Sequence.load(std::memory_order_acquire);
+			const auto lag = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+			if (0 == lag)
+			{
+				if (m_PopPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					outValue = std::move(cell.m_Value);
+					cell.m_Sequence.store(pos + m_Mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (lag < 0)
+			{
+				// The cell is not written yet.
+				return false;
+			}
+			else
+			{
+				pos = m_PopPos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Retry attempt until it succeeds or the queue is closed, spinning first and then sleeping on condition.
+	/// The attempt runs under m_WaitMutex once sleeping, so it must not wake anyone itself.
+	/// A waiter is counted before it checks again, and wakers check the count after their push or pop,
+	/// with both orders fenced, so either the waiter sees the change or the waker sees the waiter.
+	/// </summary>
+	template <typename Attempt>
+	auto Wait(std::atomic<size_t>& waiters, std::condition_variable& condition, const Attempt& attempt) -> bool
+	{
+		for (int spin{}; spin < kSpinCount; ++spin)
+		{
+			if (attempt())
+			{
+				return true;
+			}
+			if (IsClosed())
+			{
+				// Elements pushed before Close are still popped.
+				return attempt();
+			}
+			std::this_thread::yield();
+		}
+		std::unique_lock<std::mutex> lock{m_WaitMutex};
+		waiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while (true)
+		{
+			if (attempt())
+			{
+				waiters.fetch_sub(1);
+				return true;
+			}
+			if (IsClosed())
+			{
+				waiters.fetch_sub(1);
+				return attempt();
+			}
+			condition.wait(lock);
+		}
+	}
+
+	auto Wake(std::atomic<size_t>& waiters, std::condition_variable& condition) -> void
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (0 == waiters.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+		// Taken so the waiter is either before its last check or asleep.
+		{
+			std::lock_guard<std::mutex> lock{m_WaitMutex};
+		}
+		condition.notify_all();
+	}
+
+	auto WakeAll() -> void
+	{
+		{
+			std::lock_guard<std::mutex> lock{m_WaitMutex};
+		}
+		m_NotFull.notify_all();
+		m_NotEmpty.notify_all();
+	}
+};
+
+#endif // RING_QUEUE_H
@@ -0,0 +1,55 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	threadCount = ResolveThreadCount(threadCount);
+	m_Workers.reserve(threadCount);
+	for (size_t i{}; i < threadCount; ++i)
+	{
+		m_Workers.emplace_back([this]() { WorkerProc(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock{m_Mutex};
+		m_Stopping = true;
+	}
+	m_TaskCondition.notify_all();
+	for (auto& worker : m_Workers)
+	{
+		worker.join();
+	}
+}
+
+auto ThreadPool::ThreadCount() const noexcept -> size_t { return m_Workers.size(); }
+
+auto ThreadPool::ResolveThreadCount(const size_t threadCount) noexcept -> size_t
+{
+	if (0 != threadCount)
+	{
+		return threadCount;
+	}
+	return (std::max)(std::thread::hardware_concurrency(), 1u);
+}
+
+auto ThreadPool::WorkerProc() -> void
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock{m_Mutex};
+			m_TaskCondition.wait(lock, [this]() { return m_Stopping || !m_Tasks.empty(); });
+			if (m_Tasks.empty())
+			{
+				return;
+			}
+			task = std::move(m_Tasks.front());
+			m_Tasks.pop();
+		}
+		task();
+	}
+}
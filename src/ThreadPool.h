@@ -0,0 +1,105 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// <summary>
+/// Fixed size pool of worker threads.
+/// </summary>
+class ThreadPool
+{
+public:
+	/// <summary>
+	/// Start the workers.
+	/// </summary>
+	/// <param name="threadCount">Count of workers, 0 for the count of hardware threads</param>
+	explicit ThreadPool(size_t threadCount);
+
+	/// <summary>
+	/// Run the tasks left in queue and join the workers.
+	/// </summary>
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// <summary>
+	/// Queue a task.
+	/// </summary>
+	/// <param name="task">Callable without arguments</param>
+	/// <returns>Future of the task result, exceptions thrown by task are rethrown by get()</returns>
+	template <typename Task>
+	auto Submit(Task&& task) -> std::future<std::invoke_result_t<std::decay_t<Task>>>
+	{
+		using ResultType = std::invoke_result_t<std::decay_t<Task>>;
+		auto packagedTask = std::make_shared<std::packaged_task<ResultType()>>(std::forward<Task>(task));
+		auto result       = packagedTask->get_future();
+		{
+			std::lock_guard<std::mutex> lock{m_Mutex};
+			m_Tasks.emplace([packagedTask]() { (*packagedTask)(); });
+		}
+		m_TaskCondition.notify_one();
+		return result;
+	}
+
+	auto ThreadCount() const noexcept -> size_t;
+
+	/// <summary>
+	/// Resolve a requested thread count, 0 means the count of hardware threads.
+	/// </summary>
+	static auto ResolveThreadCount(size_t threadCount) noexcept -> size_t;
+
+	/// <summary>
+	/// Run task(i) for every i below count and wait for all of them.
+	/// Runs inline when a single thread is enough, so small inputs don't pay for starting workers.
+	/// </summary>
+	/// <param name="count">Count of task runs</param>
+	/// <param name="threadCount">Count of workers at most, 0 for the count of hardware threads</param>
+	/// <param name="task">Callable taking the index of run</param>
+	/// <returns>void</returns>
+	template <typename Task>
+	static auto ParallelFor(const size_t count, const size_t threadCount, const Task& task) -> void
+	{
+		const auto workerCount = (std::min)(ResolveThreadCount(threadCount), count);
+		if (workerCount <= 1)
+		{
+			for (size_t i{}; i < count; ++i)
+			{
+				task(i);
+			}
+			return;
+		}
+		ThreadPool threadPool{workerCount};
+		std::vector<std::future<void>> results;
+		results.reserve(count);
+		for (size_t i{}; i < count; ++i)
+		{
+			results.push_back(threadPool.Submit([&task, i]() { task(i); }));
+		}
+		for (auto& result : results)
+		{
+			result.get();
+		}
+	}
+
+private:
+	std::vector<std::thread> m_Workers;
+	std::queue<std::function<void()>> m_Tasks;
+	std::mutex m_Mutex;
+	std::condition_variable m_TaskCondition;
+	bool m_Stopping{false};
+
+	auto WorkerProc() -> void;
+};
+
+#endif // THREAD_POOL_H
@@ -8,6 +8,20 @@
 #define PCH_H
 
 // add headers that you want to pre-compile here
+#ifdef _AFXDLL
 #include "framework.h"
+#else
+// The codec core and command line tool build without MFC.
+#include <array>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#endif
 
 #endif //PCH_H
@@ -1,10 +1,50 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <random>
+#include <set>
+#include <thread>
 
+#include "../src/BatchScheduler.h"
 #include "../src/HuffmanEncoder.h"
+#include "../src/HuffmanCodec.h"
+#include "../src/HuffmanDecoder.h"
+#include "../src/RingQueue.h"
 #include "../src/Sha256.h"
 #include "../src/BitCollector.h"
+#include "../src/BitWriter.h"
+#include "../src/Digest.h"
+
+/// <summary>
+/// Stream buffer which can't seek, like a pipe.
+/// </summary>
+class PipeBuffer : public std::streambuf
+{
+public:
+	explicit PipeBuffer(std::string content = {})
+		: m_Content(std::move(content))
+	{
+		setg(m_Content.data(), m_Content.data(), m_Content.data() + m_Content.size());
+	}
+
+	auto Content() const -> const std::string& { return m_Content; }
+
+protected:
+	auto overflow(int_type character) -> int_type override
+	{
+		m_Content.push_back(traits_type::to_char_type(character));
+		return character;
+	}
+
+private:
+	std::string m_Content;
+};
 
 TEST(GeneralTest, HuffmanTableBuilderTest)
 {
@@ -40,6 +80,38 @@ TEST(GeneralTest, HuffmanTableBuilderTest)
 	EXPECT_EQ(std::get<0>(huffmanTable['g']), 4);
 	EXPECT_EQ(std::get<0>(huffmanTable['h']), 2);
 
+	// The cost of an optimal tree is the sum of every merged weight, and its codes fill the code space.
+	std::mt19937 random{31};
+	for (size_t alphabet : {2, 3, 100, 256})
+	{
+		HuffmanEncoder::FrequencyContainer frequency;
+		std::multiset<uint64_t> weights;
+		for (size_t i{}; i < alphabet; ++i)
+		{
+			const auto count = 1 + random() % (i % 2 ? 10 : 100000);
+			frequency[static_cast<char>(i)] = count;
+			weights.insert(count);
+		}
+		uint64_t expectedCost{};
+		while (weights.size() > 1)
+		{
+			const auto merged = *weights.begin() + *std::next(weights.begin());
+			weights.erase(weights.begin(), std::next(weights.begin(), 2));
+			weights.insert(merged);
+			expectedCost += merged;
+		}
+
+		uint64_t cost{};
+		double kraft{};
+		for (const auto& [character, item] : HuffmanEncoder::GenerateTreeFromFrequency(frequency))
+		{
+			cost += std::get<0>(item) * frequency[character];
+			kraft += std::ldexp(1.0, -static_cast<int>(std::get<0>(item)));
+		}
+		EXPECT_EQ(cost, expectedCost);
+		EXPECT_DOUBLE_EQ(kraft, 1.0);
+	}
+
 	HuffmanEncoder::Encode("test.txt","test.txt.huff");
 	HuffmanEncoder::Decode("test.txt.huff", "test.txt.decode");
 }
@@ -98,6 +170,1472 @@ TEST(GeneralTest, HuffmanTableSerializeTest)
 	EXPECT_EQ(std::get<0>(unSerializedTable['h']), 2);
 }
 
+TEST(GeneralTest, DecodeTableTest)
+{
+	HuffmanEncoder::FrequencyContainer freq;
+	freq['a'] = 19;
+	freq['b'] = 21;
+	freq['c'] = 2;
+	freq['d'] = 3;
+	freq['e'] = 6;
+	freq['f'] = 7;
+	freq['g'] = 10;
+	freq['h'] = 32;
+	auto huffmanTable = HuffmanEncoder::GenerateTreeFromFrequency(freq);
+	auto decodeTable  = HuffmanEncoder::BuildDecodeTable(
+		HuffmanEncoder::UnSerializeDecodeHuffmanTable(HuffmanEncoder::SerializeHuffmanTable(huffmanTable)));
+
+	EXPECT_EQ(decodeTable.m_LookupBit, 5);
+	EXPECT_EQ(decodeTable.m_Entries.size(), 32);
+	EXPECT_TRUE(decodeTable.m_LongCodes.empty());
+	for (size_t i{}; i < decodeTable.m_Entries.size(); ++i)
+	{
+		const auto character = static_cast<char>(decodeTable.m_Entries[i] & 0xff);
+		const auto bitLength = static_cast<size_t>(decodeTable.m_Entries[i] >> 8);
+		EXPECT_EQ(std::get<0>(huffmanTable[character]), bitLength);
+		EXPECT_EQ(std::get<1>(huffmanTable[character]), i & ((1u << bitLength) - 1));
+	}
+
+	// Skewed frequencies produce codes longer than the lookup table.
+	std::string source;
+	std::mt19937 random{42};
+	for (size_t i{}; i < 20000; ++i)
+	{
+		auto value = random();
+		auto character = 'a';
+		while (value & 1 && character < 'z')
+		{
+			value >>= 1;
+			++character;
+		}
+		source.push_back(character);
+	}
+	HuffmanEncoder::EncodeOptions options;
+	options.m_MaxBitLength = 32;
+	std::stringstream input{source}, encoded, decoded;
+	HuffmanEncoder::Encode(input, encoded, options);
+	HuffmanEncoder::Decode(encoded, decoded);
+	EXPECT_EQ(decoded.str(), source);
+}
+
+TEST(GeneralTest, CanonicalTableTest)
+{
+	HuffmanEncoder::FrequencyContainer freq;
+	freq['a'] = 19;
+	freq['b'] = 21;
+	freq['c'] = 2;
+	freq['d'] = 3;
+	freq['e'] = 6;
+	freq['f'] = 7;
+	freq['g'] = 10;
+	freq['h'] = 32;
+	auto huffmanTable = HuffmanEncoder::GenerateCanonicalTable(HuffmanEncoder::GenerateTreeFromFrequency(freq));
+
+	// Codes in stream order: a=00 b=01 h=10 e=1100 f=1101 g=1110 c=11110 d=11111
+	EXPECT_EQ(std::get<1>(huffmanTable['a']), 0b00);
+	EXPECT_EQ(std::get<1>(huffmanTable['b']), 0b10);
+	EXPECT_EQ(std::get<1>(huffmanTable['h']), 0b01);
+	EXPECT_EQ(std::get<1>(huffmanTable['e']), 0b0011);
+	EXPECT_EQ(std::get<1>(huffmanTable['f']), 0b1011);
+	EXPECT_EQ(std::get<1>(huffmanTable['g']), 0b0111);
+	EXPECT_EQ(std::get<1>(huffmanTable['c']), 0b01111);
+	EXPECT_EQ(std::get<1>(huffmanTable['d']), 0b11111);
+
+	auto tableBuffer = HuffmanEncoder::SerializeCanonicalHuffmanTable(huffmanTable);
+	EXPECT_EQ(tableBuffer.size(), 16);
+	EXPECT_EQ(HuffmanEncoder::UnSerializeHuffmanTable(HuffmanEncoder::TableFormat::Canonical, tableBuffer),
+	          huffmanTable);
+
+	// Lengths which overflow the code space are rejected.
+	const std::vector<uint8_t> invalidBuffer{'a', 1, 'b', 1, 'c', 1};
+	EXPECT_THROW(HuffmanEncoder::UnSerializeHuffmanTable(HuffmanEncoder::TableFormat::Canonical, invalidBuffer),
+	             std::invalid_argument);
+
+	// Both table formats decode to the source.
+	std::string source;
+	for (size_t i{}; i < 4096; ++i)
+	{
+		source.push_back(static_cast<char>(i % 7 ? i % 200 : 'x'));
+	}
+	for (auto format : {HuffmanEncoder::TableFormat::Explicit, HuffmanEncoder::TableFormat::Canonical})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_TableFormat = format;
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, options);
+		auto [metaData, table] = HuffmanEncoder::GetMetaData(encoded);
+		EXPECT_EQ(metaData.m_TableFormat, format);
+		EXPECT_EQ(metaData.m_TableLength, format == HuffmanEncoder::TableFormat::Explicit ? table.size() * 4 : 256);
+		encoded.seekg(0);
+		HuffmanEncoder::Decode(encoded, decoded);
+		EXPECT_EQ(decoded.str(), source);
+	}
+}
+
+TEST(GeneralTest, LengthLimitedTableTest)
+{
+	// Fibonacci frequencies build a tree as deep as the count of characters.
+	HuffmanEncoder::FrequencyContainer freq;
+	unsigned int previous{1}, current{1};
+	for (char character = 'A'; character < 'A' + 30; ++character)
+	{
+		freq[character] = current;
+		current += std::exchange(previous, current);
+	}
+	auto treeTable = HuffmanEncoder::GenerateTreeFromFrequency(freq);
+	size_t treeMaxBitLength{};
+	for (const auto& item : treeTable)
+	{
+		treeMaxBitLength = (std::max)(treeMaxBitLength, std::get<0>(item.second));
+	}
+	EXPECT_EQ(treeMaxBitLength, 29);
+
+	for (size_t maxBitLength : {5, 8, 12, 29})
+	{
+		auto huffmanTable = HuffmanEncoder::GenerateLengthLimitedTable(freq, maxBitLength);
+		EXPECT_EQ(huffmanTable.size(), freq.size());
+
+		double kraftSum{};
+		uint64_t limitedCost{}, treeCost{};
+		for (const auto& [character, pair] : huffmanTable)
+		{
+			EXPECT_LE(std::get<0>(pair), maxBitLength);
+			kraftSum += std::ldexp(1.0, -static_cast<int>(std::get<0>(pair)));
+			limitedCost += std::get<0>(pair) * freq[character];
+			treeCost += std::get<0>(treeTable[character]) * freq[character];
+		}
+		EXPECT_DOUBLE_EQ(kraftSum, 1.0);
+		EXPECT_GE(limitedCost, treeCost);
+		if (maxBitLength == treeMaxBitLength)
+		{
+			EXPECT_EQ(limitedCost, treeCost);
+		}
+	}
+	EXPECT_THROW(HuffmanEncoder::GenerateLengthLimitedTable(freq, 4), std::invalid_argument);
+
+	std::string source;
+	for (const auto& [character, count] : freq)
+	{
+		source.append(static_cast<size_t>((std::min)(count, uint64_t{5000})), character);
+	}
+	for (auto format : {HuffmanEncoder::TableFormat::Explicit, HuffmanEncoder::TableFormat::Canonical})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_TableFormat  = format;
+		options.m_MaxBitLength = 10;
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, options);
+		auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(encoded);
+		for (const auto& item : huffmanTable)
+		{
+			EXPECT_LE(std::get<0>(item.second), 10);
+		}
+		encoded.seekg(0);
+		HuffmanEncoder::Decode(encoded, decoded);
+		EXPECT_EQ(decoded.str(), source);
+	}
+}
+
+TEST(GeneralTest, BlockEncodeTest)
+{
+	std::string source;
+	std::mt19937 random{3};
+	for (size_t i{}; i < 100000; ++i)
+	{
+		source.push_back(static_cast<char>('a' + random() % 7 * random() % 13));
+	}
+
+	for (size_t blockSize : {1000, 4096, 100000, 300000})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize   = blockSize;
+		options.m_ThreadCount = 3;
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, options);
+
+		auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(encoded);
+		EXPECT_TRUE(metaData.m_Flags & HuffmanEncoder::kBlockIndexFlag);
+		auto [indexHeader, index] = HuffmanEncoder::ReadBlockIndex(encoded);
+		EXPECT_EQ(indexHeader.m_BlockSize, blockSize);
+		EXPECT_EQ(index.size(), (source.size() + blockSize - 1) / blockSize);
+		uint64_t offset{};
+		for (const auto& item : index)
+		{
+			EXPECT_EQ(item.m_Offset, offset);
+			offset += (item.m_BitLength + 7) / 8;
+		}
+		const auto payloadPos = static_cast<uint64_t>(encoded.tellg());
+		EXPECT_EQ(payloadPos + offset, encoded.str().size());
+
+		encoded.seekg(0);
+		HuffmanEncoder::Decode(encoded, decoded);
+		EXPECT_EQ(decoded.str(), source);
+	}
+}
+
+TEST(GeneralTest, ParallelDecodeTest)
+{
+	std::string source;
+	std::mt19937 random{5};
+	for (size_t i{}; i < 200000; ++i)
+	{
+		source.push_back(static_cast<char>(random() % 3 ? 'a' + random() % 4 : random() % 256));
+	}
+
+	HuffmanEncoder::EncodeOptions encodeOptions;
+	encodeOptions.m_BlockSize = 7000;
+	std::stringstream input{source}, encoded;
+	HuffmanEncoder::Encode(input, encoded, encodeOptions);
+	const auto encodedFile = encoded.str();
+
+	for (size_t threadCount : {1, 2, 8})
+	{
+		HuffmanEncoder::DecodeOptions options;
+		options.m_ThreadCount = threadCount;
+		std::stringstream encodedInput{encodedFile}, decoded;
+		HuffmanEncoder::Decode(encodedInput, decoded, options);
+		EXPECT_EQ(decoded.str(), source);
+	}
+
+	// Shortening a block is detected instead of shifting the rest of output.
+	auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(encoded);
+	const auto indexPos           = static_cast<size_t>(encoded.tellg()) + sizeof(HuffmanEncoder::SerializedBlockIndexHeader);
+	auto damagedFile              = encodedFile;
+	HuffmanEncoder::SerializedBlockIndexItem item{};
+	std::copy_n(damagedFile.data() + indexPos, sizeof(item), reinterpret_cast<char*>(&item));
+	item.m_BitLength -= 24;
+	std::copy_n(reinterpret_cast<const char*>(&item), sizeof(item), damagedFile.data() + indexPos);
+	std::stringstream damagedInput{damagedFile}, decoded;
+	EXPECT_THROW(HuffmanEncoder::Decode(damagedInput, decoded), std::runtime_error);
+
+	// A huge block size is damage too, not an allocation of it.
+	auto hugeBlockFile = encodedFile;
+	HuffmanEncoder::SerializedBlockIndexHeader indexHeader{};
+	const auto indexHeaderPos = indexPos - sizeof(indexHeader);
+	std::copy_n(hugeBlockFile.data() + indexHeaderPos, sizeof(indexHeader), reinterpret_cast<char*>(&indexHeader));
+	indexHeader.m_BlockSize = uint64_t{1} << 60;
+	std::copy_n(reinterpret_cast<const char*>(&indexHeader), sizeof(indexHeader), hugeBlockFile.data() + indexHeaderPos);
+	std::stringstream hugeBlockInput{hugeBlockFile}, hugeBlockDecoded;
+	EXPECT_THROW(HuffmanEncoder::Decode(hugeBlockInput, hugeBlockDecoded), std::runtime_error);
+
+	// So is a huge bit length, read from a file or from a pipe.
+	for (const uint64_t bitLength : {uint64_t{1} << 32, uint64_t{1} << 50})
+	{
+		auto hugeBitsFile = encodedFile;
+		std::copy_n(hugeBitsFile.data() + indexPos, sizeof(item), reinterpret_cast<char*>(&item));
+		item.m_BitLength = bitLength;
+		std::copy_n(reinterpret_cast<const char*>(&item), sizeof(item), hugeBitsFile.data() + indexPos);
+		std::stringstream hugeBitsInput{hugeBitsFile}, hugeBitsDecoded;
+		EXPECT_THROW(HuffmanEncoder::Decode(hugeBitsInput, hugeBitsDecoded), std::runtime_error);
+		PipeBuffer pipeBuffer{hugeBitsFile};
+		std::istream pipeInput{&pipeBuffer};
+		std::stringstream pipeDecoded;
+		EXPECT_THROW(HuffmanEncoder::Decode(pipeInput, pipeDecoded), std::runtime_error);
+	}
+}
+
+TEST(GeneralTest, StreamEncodeTest)
+{
+	std::string source;
+	std::mt19937 random{11};
+	for (size_t i{}; i < 50000; ++i)
+	{
+		// The statistics change between frames.
+		source.push_back(static_cast<char>(i < 25000 ? 'a' + random() % 5 : random() % 256));
+	}
+
+	for (size_t frameSize : {0, 3000, 25000})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize = frameSize;
+		PipeBuffer sourceBuffer{source}, encodedBuffer;
+		std::istream input{&sourceBuffer};
+		std::ostream encoded{&encodedBuffer};
+		HuffmanEncoder::EncodeStream(input, encoded, options);
+		EXPECT_TRUE(encoded.good());
+
+		PipeBuffer encodedInputBuffer{encodedBuffer.Content()}, decodedBuffer;
+		std::istream encodedInput{&encodedInputBuffer};
+		std::ostream decoded{&decodedBuffer};
+		auto digest = HuffmanEncoder::Decode(encodedInput, decoded);
+		EXPECT_EQ(decodedBuffer.Content(), source);
+		EXPECT_EQ(picosha2::bytes_to_hex_string(digest), picosha2::hash256_hex_string(source));
+	}
+
+	// An empty source is a valid stream.
+	std::stringstream input, encoded, decoded;
+	HuffmanEncoder::EncodeStream(input, encoded, HuffmanEncoder::EncodeOptions{});
+	HuffmanEncoder::Decode(encoded, decoded);
+	EXPECT_TRUE(decoded.str().empty());
+
+	// A cut stream is detected.
+	auto truncated = encoded.str();
+	truncated.pop_back();
+	std::stringstream truncatedInput{truncated};
+	EXPECT_THROW(HuffmanEncoder::Decode(truncatedInput, decoded), std::runtime_error);
+
+	// A frame header claiming the largest frame doesn't allocate it, a pipe ends it first.
+	std::stringstream frameInput{source}, frameEncoded;
+	HuffmanEncoder::EncodeStream(frameInput, frameEncoded, HuffmanEncoder::EncodeOptions{});
+	auto hugeFrame = frameEncoded.str();
+	HuffmanEncoder::SerializedFrameHeader frameHeader{};
+	std::copy_n(hugeFrame.data() + sizeof(HuffmanEncoder::kStreamMagic), sizeof(frameHeader), reinterpret_cast<char*>(&frameHeader));
+	frameHeader.m_SourceLength = HuffmanEncoder::kMaxFrameSize;
+	frameHeader.m_BitLength    = HuffmanEncoder::kMaxFrameSize * 32;
+	std::copy_n(reinterpret_cast<const char*>(&frameHeader), sizeof(frameHeader), hugeFrame.data() + sizeof(HuffmanEncoder::kStreamMagic));
+	PipeBuffer hugeFrameBuffer{hugeFrame}, hugeFrameDecoded;
+	std::istream hugeFrameInput{&hugeFrameBuffer};
+	std::ostream hugeFrameOutput{&hugeFrameDecoded};
+	EXPECT_THROW(HuffmanEncoder::Decode(hugeFrameInput, hugeFrameOutput), std::runtime_error);
+	EXPECT_LT(hugeFrameDecoded.Content().size(), source.size() * 8);
+}
+
+TEST(GeneralTest, IncrementalDecodeTest)
+{
+	std::string source;
+	std::mt19937 random{13};
+	for (size_t i{}; i < 30000; ++i)
+	{
+		source.push_back(static_cast<char>('a' + random() % 3 * random() % 17));
+	}
+
+	std::vector<std::string> encodedFiles;
+	for (size_t blockSize : {0, 1000})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize = blockSize;
+		std::stringstream input{source}, encoded, streamEncoded;
+		HuffmanEncoder::Encode(input, encoded, options);
+		encodedFiles.push_back(encoded.str());
+		input.clear();
+		input.seekg(0);
+		HuffmanEncoder::EncodeStream(input, streamEncoded, options);
+		encodedFiles.push_back(streamEncoded.str());
+	}
+
+	for (const auto& encodedFile : encodedFiles)
+	{
+		for (size_t maxChunkSize : {1, 7, 4096})
+		{
+			HuffmanDecoder decoder;
+			std::vector<uint8_t> output;
+			for (size_t pos{}; pos < encodedFile.size();)
+			{
+				const auto chunkSize = (std::min)(1 + random() % maxChunkSize, encodedFile.size() - pos);
+				decoder.Push(reinterpret_cast<const uint8_t*>(encodedFile.data()) + pos, chunkSize, output);
+				pos += chunkSize;
+			}
+			decoder.Finish(output);
+			EXPECT_TRUE(decoder.IsFinished());
+			EXPECT_EQ(std::string(output.begin(), output.end()), source);
+			EXPECT_EQ(picosha2::bytes_to_hex_string(decoder.Digest()), picosha2::hash256_hex_string(source));
+		}
+
+		// Half of the input leaves the decoder waiting for more.
+		HuffmanDecoder decoder;
+		std::vector<uint8_t> output;
+		decoder.Push(reinterpret_cast<const uint8_t*>(encodedFile.data()), encodedFile.size() / 2, output);
+		EXPECT_FALSE(decoder.IsFinished());
+	}
+}
+
+TEST(GeneralTest, PayloadLengthTest)
+{
+	std::string source;
+	std::mt19937 random{17};
+	for (size_t i{}; i < 40000; ++i)
+	{
+		source.push_back(static_cast<char>('0' + random() % 10));
+	}
+	std::stringstream input{source}, encoded;
+	HuffmanEncoder::Encode(input, encoded);
+	const auto encodedFile = encoded.str();
+
+	auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(encoded);
+	const auto payloadPos         = static_cast<size_t>(encoded.tellg());
+	EXPECT_TRUE(metaData.m_Flags & HuffmanEncoder::kPayloadLengthFlag);
+	EXPECT_EQ(metaData.m_SourceLength, source.size());
+	EXPECT_EQ((metaData.m_PayloadBitLength + 7) / 8, encodedFile.size() - payloadPos);
+
+	// The end of payload is known, so the source needn't be seekable.
+	PipeBuffer encodedBuffer{encodedFile}, decodedBuffer;
+	std::istream encodedInput{&encodedBuffer};
+	std::ostream decoded{&decodedBuffer};
+	HuffmanEncoder::Decode(encodedInput, decoded);
+	EXPECT_EQ(decodedBuffer.Content(), source);
+
+	// Files written before the payload length have a shorter metadata and always a last byte.
+	auto legacyMetaData = metaData;
+	legacyMetaData.m_Flags &= ~HuffmanEncoder::kPayloadLengthFlag;
+	std::string legacyFile(reinterpret_cast<const char*>(&legacyMetaData),
+	                       offsetof(HuffmanEncoder::SerializedHuffmanTableMetaData, m_SourceLength));
+	legacyFile.append(encodedFile, sizeof(metaData), std::string::npos);
+	if (0 == legacyMetaData.m_RedundancyBit)
+	{
+		legacyFile.push_back(0);
+	}
+	std::stringstream legacyInput{legacyFile}, legacyDecoded;
+	HuffmanEncoder::Decode(legacyInput, legacyDecoded);
+	EXPECT_EQ(legacyDecoded.str(), source);
+
+	HuffmanDecoder decoder;
+	std::vector<uint8_t> output;
+	decoder.Push(reinterpret_cast<const uint8_t*>(legacyFile.data()), legacyFile.size(), output);
+	EXPECT_FALSE(decoder.IsFinished());
+	decoder.Finish(output);
+	EXPECT_EQ(std::string(output.begin(), output.end()), source);
+}
+
+TEST(GeneralTest, FileEncodeTest)
+{
+	std::string source;
+	std::mt19937 random{19};
+	for (size_t i{}; i < 120000; ++i)
+	{
+		source.push_back(static_cast<char>(random() % 4 ? 'a' + random() % 9 : random() % 256));
+	}
+	const std::string sourceFile{"file-encode.test"}, encodedFile{sourceFile + ".huff"}, decodedFile{sourceFile + ".decode"};
+	const auto readFile = [](const std::string& filename)
+	{
+		std::ifstream fs{filename, std::ios::in | std::ios::binary};
+		return std::string{std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>()};
+	};
+
+	for (const auto& content : {source, std::string{}, std::string(5000, 'x')})
+	{
+		std::ofstream{sourceFile, std::ios::out | std::ios::binary} << content;
+		for (size_t blockSize : {0, 7000})
+		{
+			// Files and streams decode each other.
+			HuffmanEncoder::EncodeOptions options;
+			options.m_BlockSize   = blockSize;
+			options.m_ThreadCount = 3;
+			HuffmanEncoder::Encode(sourceFile, encodedFile, options);
+			std::stringstream encoded{readFile(encodedFile)}, decoded;
+			HuffmanEncoder::Decode(encoded, decoded);
+			EXPECT_EQ(decoded.str(), content);
+
+			std::stringstream input{content};
+			encoded.str({});
+			encoded.clear();
+			// Mapped and stream encodes write the same bytes.
+			const auto mappedEncoded = readFile(encodedFile);
+			HuffmanEncoder::Encode(input, encoded, options);
+			EXPECT_EQ(encoded.str(), mappedEncoded);
+			std::ofstream{encodedFile, std::ios::out | std::ios::binary} << encoded.str();
+			const auto digest = HuffmanEncoder::Decode(encodedFile, decodedFile);
+			EXPECT_EQ(readFile(decodedFile), content);
+			EXPECT_TRUE(HuffmanEncoder::Verify(decodedFile, digest));
+		}
+	}
+
+	// Framed streams are decoded from files too.
+	std::stringstream input{source}, encoded;
+	HuffmanEncoder::EncodeStream(input, encoded, HuffmanEncoder::EncodeOptions{});
+	std::ofstream{encodedFile, std::ios::out | std::ios::binary} << encoded.str();
+	HuffmanEncoder::Decode(encodedFile, decodedFile);
+	EXPECT_EQ(readFile(decodedFile), source);
+
+	// A damaged block can't overflow into the next one.
+	std::stringstream blockInput{source}, blockEncoded;
+	HuffmanEncoder::EncodeOptions options;
+	options.m_BlockSize = 7000;
+	HuffmanEncoder::Encode(blockInput, blockEncoded, options);
+	auto [metaData, huffmanTable] = HuffmanEncoder::GetMetaData(blockEncoded);
+	const auto itemPos            = static_cast<size_t>(blockEncoded.tellg())
+	                                + sizeof(HuffmanEncoder::SerializedBlockIndexHeader)
+	                                + sizeof(HuffmanEncoder::SerializedBlockIndexItem);
+	auto damaged = blockEncoded.str();
+	HuffmanEncoder::SerializedBlockIndexItem item{};
+	std::copy_n(damaged.data() + itemPos, sizeof(item), reinterpret_cast<char*>(&item));
+	item.m_BitLength += 64;
+	std::copy_n(reinterpret_cast<const char*>(&item), sizeof(item), damaged.data() + itemPos);
+	std::ofstream{encodedFile, std::ios::out | std::ios::binary} << damaged;
+	EXPECT_THROW(HuffmanEncoder::Decode(encodedFile, decodedFile), std::runtime_error);
+
+	std::filesystem::remove(sourceFile);
+	std::filesystem::remove(encodedFile);
+	std::filesystem::remove(decodedFile);
+}
+
+TEST(GeneralTest, BufferEncodeTest)
+{
+	std::string source;
+	std::mt19937 random{23};
+	for (size_t i{}; i < 60000; ++i)
+	{
+		source.push_back(static_cast<char>(random() % 5 ? 'k' + random() % 6 : random() % 256));
+	}
+
+	for (const auto& content : {source, std::string{}, std::string(300, 'q')})
+	{
+		const auto* first = reinterpret_cast<const uint8_t*>(content.data());
+		for (size_t blockSize : {0, 4000})
+		{
+			HuffmanEncoder::EncodeOptions options;
+			options.m_BlockSize   = blockSize;
+			options.m_TableFormat = blockSize ? HuffmanEncoder::TableFormat::Canonical : HuffmanEncoder::TableFormat::Explicit;
+			std::vector<uint8_t> encoded(static_cast<size_t>(HuffmanEncoder::EncodeBound(content.size(), options)));
+			encoded.resize(HuffmanEncoder::EncodeBuffer(first, content.size(), encoded.data(), encoded.size(), options));
+
+			// Streams read what buffers write.
+			std::stringstream encodedInput{std::string(encoded.begin(), encoded.end())}, decoded;
+			HuffmanEncoder::Decode(encodedInput, decoded);
+			EXPECT_EQ(decoded.str(), content);
+
+			EXPECT_EQ(HuffmanEncoder::DecodeBound(encoded.data(), encoded.size()), content.size());
+			std::vector<uint8_t> output(content.size());
+			auto [length, digest] = HuffmanEncoder::DecodeBuffer(
+				encoded.data(), encoded.size(), output.data(), output.size(), HuffmanEncoder::DecodeOptions{});
+			EXPECT_EQ(length, content.size());
+			EXPECT_EQ(std::string(output.begin(), output.end()), content);
+			EXPECT_EQ(picosha2::bytes_to_hex_string(digest), picosha2::hash256_hex_string(content));
+
+			if (!content.empty())
+			{
+				EXPECT_THROW(HuffmanEncoder::EncodeBuffer(first, content.size(), encoded.data(), encoded.size() - 1, options),
+				             std::length_error);
+				EXPECT_THROW(HuffmanEncoder::DecodeBuffer(encoded.data(), encoded.size(), output.data(), output.size() - 1,
+				                                          HuffmanEncoder::DecodeOptions{}),
+				             std::length_error);
+			}
+		}
+	}
+
+	// Single streams of every final bit count are the same bytes as those of Encode.
+	for (size_t length{}; length < 25; ++length)
+	{
+		std::string content;
+		for (size_t i{}; i < length * 37; ++i)
+		{
+			content.push_back(static_cast<char>('a' + random() % (1 + length % 7)));
+		}
+		HuffmanEncoder::EncodeOptions options;
+		std::vector<uint8_t> encoded(static_cast<size_t>(HuffmanEncoder::EncodeBound(content.size(), options)));
+		encoded.resize(HuffmanEncoder::EncodeBuffer(
+			reinterpret_cast<const uint8_t*>(content.data()), content.size(), encoded.data(), encoded.size(), options));
+		std::stringstream input{content}, streamEncoded;
+		HuffmanEncoder::Encode(input, streamEncoded, options);
+		EXPECT_EQ(std::string(encoded.begin(), encoded.end()), streamEncoded.str());
+	}
+
+	// Framed streams don't record their length, the bound is larger than the source.
+	std::stringstream input{source}, framed;
+	HuffmanEncoder::EncodeStream(input, framed, HuffmanEncoder::EncodeOptions{});
+	const auto framedFile = framed.str();
+	const auto* framedFirst = reinterpret_cast<const uint8_t*>(framedFile.data());
+	const auto bound        = HuffmanEncoder::DecodeBound(framedFirst, framedFile.size());
+	EXPECT_GE(bound, source.size());
+	std::vector<uint8_t> output(static_cast<size_t>(bound));
+	auto [length, digest] = HuffmanEncoder::DecodeBuffer(
+		framedFirst, framedFile.size(), output.data(), output.size(), HuffmanEncoder::DecodeOptions{});
+	EXPECT_EQ(std::string(output.begin(), output.begin() + length), source);
+	EXPECT_THROW(HuffmanEncoder::DecodeBuffer(framedFirst, framedFile.size(), output.data(), source.size() - 1,
+	                                          HuffmanEncoder::DecodeOptions{}),
+	             std::length_error);
+}
+
+TEST(GeneralTest, CodecReuseTest)
+{
+	std::mt19937 random{29};
+	std::vector<std::string> sources;
+	for (size_t length : {50000, 10, 0, 3000, 70000, 1})
+	{
+		std::string source;
+		const auto alphabet = 1 + random() % 255;
+		for (size_t i{}; i < length; ++i)
+		{
+			source.push_back(static_cast<char>(random() % alphabet));
+		}
+		sources.push_back(source);
+	}
+
+	// Buffers and tables left by larger or different inputs don't leak into later calls.
+	for (size_t blockSize : {0, 2000})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize = blockSize;
+		HuffmanCodec codec{options};
+		for (const auto& source : sources)
+		{
+			std::stringstream input{source}, encoded, decoded;
+			codec.Encode(input, encoded);
+			const auto digest = codec.Decode(encoded, decoded);
+			EXPECT_EQ(decoded.str(), source);
+			EXPECT_EQ(picosha2::bytes_to_hex_string(digest), picosha2::hash256_hex_string(source));
+
+			std::stringstream streamInput{source}, streamEncoded, streamDecoded;
+			codec.EncodeStream(streamInput, streamEncoded);
+			codec.Decode(streamEncoded, streamDecoded);
+			EXPECT_EQ(streamDecoded.str(), source);
+
+			const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+			std::vector<uint8_t> buffer(static_cast<size_t>(HuffmanEncoder::EncodeBound(source.size(), options)));
+			buffer.resize(codec.EncodeBuffer(first, source.size(), buffer.data(), buffer.size()));
+			std::vector<uint8_t> output(source.size());
+			auto [length, bufferDigest] = codec.DecodeBuffer(buffer.data(), buffer.size(), output.data(), output.size());
+			EXPECT_EQ(std::string(output.begin(), output.begin() + length), source);
+			EXPECT_EQ(bufferDigest, digest);
+		}
+	}
+}
+
+TEST(GeneralTest, FrequencyCountTest)
+{
+	std::mt19937 random(7);
+	for (const size_t length : {size_t{0}, size_t{13}, size_t{4096}, size_t{100003}, size_t{9 << 20}})
+	{
+		// Long runs of one character as well as random characters.
+		std::vector<uint8_t> source(length);
+		for (size_t i{}; i < length; ++i)
+		{
+			source[i] = i % 1000 < 500 ? uint8_t{'a'} : static_cast<uint8_t>(random());
+		}
+
+		HuffmanEncoder::FrequencyCounts expected{};
+		for (const auto character : source)
+		{
+			++expected[character];
+		}
+		HuffmanEncoder::FrequencyCounts counts{};
+		HuffmanEncoder::CountFrequency(source.data(), source.data() + source.size(), counts);
+		EXPECT_EQ(counts, expected);
+
+		// Counts are added to.
+		HuffmanEncoder::CountFrequency(source.data(), source.data() + source.size(), counts);
+		for (size_t character{}; character < counts.size(); ++character)
+		{
+			EXPECT_EQ(counts[character], 2 * expected[character]);
+		}
+
+		const auto frequency = HuffmanEncoder::GetFrequency(source.data(), source.data() + source.size());
+		for (size_t character{}; character < expected.size(); ++character)
+		{
+			const auto found = frequency.find(static_cast<char>(character));
+			EXPECT_EQ(found == frequency.end() ? 0 : found->second, expected[character]);
+		}
+
+		std::vector<unsigned char> expectedDigest(picosha2::k_digest_size);
+		picosha2::hash256(source.begin(), source.end(), expectedDigest.begin(), expectedDigest.end());
+		for (const size_t threadCount : {size_t{1}, size_t{4}})
+		{
+			HuffmanEncoder::EncodeOptions options;
+			options.m_ThreadCount = threadCount;
+			std::istringstream stream(std::string(source.begin(), source.end()));
+			std::vector<uint8_t> buffer;
+			HuffmanEncoder::Progress streamProgress;
+			auto [streamDigest, streamFrequency] =
+				HuffmanEncoder::GetFrequencyAndHash(stream, buffer, options, streamProgress);
+			EXPECT_EQ(streamFrequency, frequency);
+			EXPECT_EQ(streamDigest, expectedDigest);
+
+			HuffmanEncoder::Progress bufferProgress;
+			auto [bufferDigest, bufferFrequency] = HuffmanEncoder::GetFrequencyAndHash(
+				source.data(), source.data() + source.size(), options, bufferProgress);
+			EXPECT_EQ(bufferFrequency, frequency);
+			EXPECT_EQ(bufferDigest, expectedDigest);
+		}
+	}
+}
+
+TEST(GeneralTest, DigestTest)
+{
+	using Algorithm = Digest::Algorithm;
+	const auto digestHex = [](const Algorithm algorithm, const std::string& source)
+	{
+		const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+		return picosha2::bytes_to_hex_string(Digest::Compute(algorithm, first, first + source.size()));
+	};
+	EXPECT_EQ(digestHex(Algorithm::Sha256, "abc"), picosha2::hash256_hex_string(std::string("abc")));
+	EXPECT_EQ(digestHex(Algorithm::Crc32c, "123456789"), "e3069283");
+	EXPECT_EQ(digestHex(Algorithm::XxHash64, ""), "ef46db3751d8e999");
+	EXPECT_EQ(digestHex(Algorithm::XxHash64, "abc"), "44bc2cf5ad770999");
+	EXPECT_EQ(digestHex(Algorithm::XxHash64, "Nobody inspects the spammish repetition"), "fbcea83c8a378bf1");
+	EXPECT_EQ(digestHex(Algorithm::None, "abc"), "");
+
+	std::mt19937 random{5};
+	for (const size_t length : {0, 1, 31, 32, 55, 56, 63, 64, 65, 119, 120, 1000, 100000})
+	{
+		std::vector<uint8_t> source(length);
+		for (auto& character : source)
+		{
+			character = static_cast<uint8_t>(random());
+		}
+		std::vector<unsigned char> expected(picosha2::k_digest_size);
+		picosha2::hash256(source.begin(), source.end(), expected.begin(), expected.end());
+		EXPECT_EQ(Digest::Compute(Algorithm::Sha256, source.data(), source.data() + length), expected);
+
+		// Updates of any size give the same digest.
+		for (const auto algorithm : {Algorithm::Sha256, Algorithm::Crc32c, Algorithm::XxHash64, Algorithm::None})
+		{
+			Digest digest{algorithm};
+			for (size_t pos{}; pos < length;)
+			{
+				const auto count = (std::min)(length - pos, static_cast<size_t>(random() % 100));
+				digest.Update(source.data() + pos, source.data() + pos + count);
+				pos += count;
+			}
+			const auto result = digest.Finish();
+			EXPECT_EQ(result, Digest::Compute(algorithm, source.data(), source.data() + length));
+			EXPECT_EQ(result.size(), Digest::Length(algorithm));
+			EXPECT_EQ(Digest::FromLength(result.size()), algorithm);
+		}
+
+		// The instructions of CPU give the same results as the portable code.
+		if (const auto sha256Blocks = Digest::AcceleratedSha256())
+		{
+			uint32_t portableState[8]{1, 2, 3, 4, 5, 6, 7, 8};
+			uint32_t acceleratedState[8]{1, 2, 3, 4, 5, 6, 7, 8};
+			Digest::Sha256BlocksPortable(portableState, source.data(), length / 64);
+			sha256Blocks(acceleratedState, source.data(), length / 64);
+			EXPECT_TRUE(std::equal(std::begin(portableState), std::end(portableState), acceleratedState));
+		}
+		if (const auto crc32cUpdate = Digest::AcceleratedCrc32c())
+		{
+			EXPECT_EQ(crc32cUpdate(7, source.data(), source.data() + length),
+			          Digest::Crc32cPortable(7, source.data(), source.data() + length));
+		}
+	}
+
+	EXPECT_THROW(Digest{static_cast<Algorithm>(200)}, std::invalid_argument);
+	EXPECT_THROW(Digest::FromLength(5), std::invalid_argument);
+}
+
+TEST(GeneralTest, DigestEncodeTest)
+{
+	std::string source;
+	std::mt19937 random{17};
+	for (size_t i{}; i < 20000; ++i)
+	{
+		source.push_back(static_cast<char>('a' + random() % 9));
+	}
+	const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+
+	for (const auto algorithm : {Digest::Algorithm::Sha256,
+	                             Digest::Algorithm::Crc32c,
+	                             Digest::Algorithm::XxHash64,
+	                             Digest::Algorithm::None})
+	{
+		const auto expected = Digest::Compute(algorithm, first, first + source.size());
+		HuffmanEncoder::EncodeOptions options;
+		options.m_DigestAlgorithm = algorithm;
+		options.m_BlockSize       = 3000;
+
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, options);
+		EXPECT_EQ(HuffmanEncoder::Decode(encoded, decoded), expected);
+		EXPECT_EQ(decoded.str(), source);
+		std::istringstream decodedInput{decoded.str()};
+		EXPECT_TRUE(HuffmanEncoder::Verify(decodedInput, expected));
+		std::istringstream metaDataInput{encoded.str()};
+		const auto metaData = std::get<0>(HuffmanEncoder::GetMetaData(metaDataInput));
+		EXPECT_EQ(metaData.m_DigestAlgorithm, algorithm);
+		EXPECT_EQ(HuffmanEncoder::GetDigest(metaData), expected);
+
+		std::vector<uint8_t> output(source.size());
+		const auto content = encoded.str();
+		const auto [length, bufferDigest] = HuffmanEncoder::DecodeBuffer(
+			reinterpret_cast<const uint8_t*>(content.data()), content.size(), output.data(), output.size(), {});
+		EXPECT_EQ(length, source.size());
+		EXPECT_EQ(bufferDigest, expected);
+
+		std::stringstream streamInput{source}, framed, framedDecoded;
+		HuffmanEncoder::EncodeStream(streamInput, framed, options);
+		EXPECT_EQ(HuffmanEncoder::Decode(framed, framedDecoded), expected);
+		EXPECT_EQ(framedDecoded.str(), source);
+
+		HuffmanDecoder decoder;
+		const auto framedContent = framed.str();
+		std::vector<uint8_t> incremental;
+		decoder.Push(reinterpret_cast<const uint8_t*>(framedContent.data()), framedContent.size(), incremental);
+		decoder.Finish(incremental);
+		EXPECT_EQ(decoder.Digest(), expected);
+	}
+
+	// A digest of the wrong content or unknown length doesn't verify.
+	std::istringstream sha256Input{source}, unknownInput{source};
+	EXPECT_FALSE(HuffmanEncoder::Verify(sha256Input, std::vector<unsigned char>(picosha2::k_digest_size)));
+	EXPECT_FALSE(HuffmanEncoder::Verify(unknownInput, std::vector<unsigned char>(5)));
+
+	// An unknown algorithm recorded in file is refused.
+	std::stringstream input{source}, encoded, decoded;
+	HuffmanEncoder::Encode(input, encoded, HuffmanEncoder::EncodeOptions{});
+	auto damaged = encoded.str();
+	damaged[offsetof(HuffmanEncoder::SerializedHuffmanTableMetaData, m_DigestAlgorithm)] = 100;
+	std::istringstream damagedInput{damaged};
+	EXPECT_THROW(HuffmanEncoder::Decode(damagedInput, decoded), std::runtime_error);
+}
+
+TEST(GeneralTest, TreeDigestTest)
+{
+	using Algorithm = Digest::Algorithm;
+	const auto sha256 = [](const uint8_t prefix, const uint8_t* first, const uint8_t* last)
+	{
+		std::vector<uint8_t> message{prefix};
+		message.insert(message.end(), first, last);
+		std::vector<uint8_t> hash(picosha2::k_digest_size);
+		picosha2::hash256(message.begin(), message.end(), hash.begin(), hash.end());
+		return hash;
+	};
+	const auto node = [&sha256](const std::vector<uint8_t>& left, const std::vector<uint8_t>& right)
+	{
+		auto children = left;
+		children.insert(children.end(), right.begin(), right.end());
+		return sha256(1, children.data(), children.data() + children.size());
+	};
+
+	// The empty source is a single empty leaf.
+	const uint8_t empty{};
+	EXPECT_EQ(picosha2::bytes_to_hex_string(Digest::Compute(Algorithm::Sha256Tree, &empty, &empty)),
+	          "6e340b9cffb37a989ca544e6bb780a2c78901d3fb33738768511a30617afa01d");
+
+	// Five leaves, the last one short: ((L0 L1) (L2 L3)) L4.
+	const auto leafSize = Digest::kTreeLeafSize;
+	std::string source;
+	std::mt19937 random{37};
+	for (size_t i{}; i < 4 * leafSize + 12345; ++i)
+	{
+		source.push_back(static_cast<char>('a' + random() % 7));
+	}
+	const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+	std::vector<std::vector<uint8_t>> leaves;
+	for (size_t pos{}; pos < source.size(); pos += leafSize)
+	{
+		leaves.push_back(sha256(0, first + pos, first + (std::min)(pos + leafSize, source.size())));
+	}
+	const auto expected = node(node(node(leaves[0], leaves[1]), node(leaves[2], leaves[3])), leaves[4]);
+	EXPECT_EQ(Digest::Compute(Algorithm::Sha256Tree, first, first + source.size()), expected);
+
+	// Updates of any size and leaves hashed elsewhere give the same digest.
+	Digest updated{Algorithm::Sha256Tree}, appended{Algorithm::Sha256Tree};
+	for (size_t pos{}; pos < source.size();)
+	{
+		const auto count = (std::min)(source.size() - pos, static_cast<size_t>(random() % 300000));
+		updated.Update(first + pos, first + pos + count);
+		pos += count;
+	}
+	EXPECT_EQ(updated.Finish(), expected);
+	appended.Update(first, first + leafSize);
+	for (size_t pos{leafSize}; pos < source.size(); pos += leafSize)
+	{
+		const auto last = first + (std::min)(pos + leafSize, source.size());
+		appended.AppendLeaf(Digest::TreeLeaf(first + pos, last), static_cast<size_t>(last - first - pos));
+	}
+	EXPECT_THROW(appended.AppendLeaf(Digest::TreeLeaf(first, first + 1), 1), std::invalid_argument);
+	EXPECT_EQ(appended.Finish(), expected);
+
+	// Every path of encoding and verifying hashes alike, on one thread or more.
+	const std::string sourceFile{"tree-digest.test"};
+	std::ofstream{sourceFile, std::ios::out | std::ios::binary} << source;
+	for (const size_t threadCount : {1, 4})
+	{
+		HuffmanEncoder::EncodeOptions options;
+		options.m_DigestAlgorithm = Algorithm::Sha256Tree;
+		options.m_ThreadCount     = threadCount;
+		options.m_BlockSize       = 700000;
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, options);
+		EXPECT_EQ(HuffmanEncoder::Decode(encoded, decoded), expected);
+		std::vector<uint8_t> buffer(static_cast<size_t>(HuffmanEncoder::EncodeBound(source.size(), options)));
+		buffer.resize(HuffmanEncoder::EncodeBuffer(first, source.size(), buffer.data(), buffer.size(), options));
+		std::vector<uint8_t> output(source.size());
+		EXPECT_EQ(std::get<1>(HuffmanEncoder::DecodeBuffer(buffer.data(), buffer.size(), output.data(), output.size(), {})),
+		          expected);
+		std::stringstream streamInput{source}, framed, framedDecoded;
+		HuffmanEncoder::EncodeStream(streamInput, framed, options);
+		EXPECT_EQ(HuffmanEncoder::Decode(framed, framedDecoded), expected);
+
+		HuffmanEncoder::VerifyOptions verifyOptions;
+		verifyOptions.m_DigestAlgorithm = Algorithm::Sha256Tree;
+		verifyOptions.m_ThreadCount     = threadCount;
+		std::istringstream verifyInput{source}, damagedInput{source + "x"};
+		EXPECT_TRUE(HuffmanEncoder::Verify(verifyInput, expected, verifyOptions));
+		EXPECT_FALSE(HuffmanEncoder::Verify(damagedInput, expected, verifyOptions));
+		EXPECT_TRUE(HuffmanEncoder::Verify(sourceFile, expected, verifyOptions));
+		// Its length tells Sha256 instead.
+		EXPECT_FALSE(HuffmanEncoder::Verify(sourceFile, expected));
+	}
+	std::filesystem::remove(sourceFile);
+}
+
+TEST(GeneralTest, DecodeAndVerifyTest)
+{
+	std::string source;
+	std::mt19937 random{23};
+	for (size_t i{}; i < 40000; ++i)
+	{
+		source.push_back(static_cast<char>('a' + random() % 13));
+	}
+	const std::string encodedFile{"decode-verify.test.huff"}, decodedFile{"decode-verify.test.decode"};
+	const auto readFile = [](const std::string& filename)
+	{
+		std::ifstream fs{filename, std::ios::in | std::ios::binary};
+		return std::string{std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>()};
+	};
+
+	HuffmanCodec codec;
+	for (const auto algorithm : {Digest::Algorithm::Sha256, Digest::Algorithm::Crc32c, Digest::Algorithm::None})
+	{
+		for (const bool isFramed : {false, true})
+		{
+			for (size_t blockSize : {0, 6000})
+			{
+				HuffmanEncoder::EncodeOptions options;
+				options.m_DigestAlgorithm = algorithm;
+				options.m_BlockSize       = blockSize;
+				std::stringstream input{source}, encoded;
+				isFramed
+					? HuffmanEncoder::EncodeStream(input, encoded, options)
+					: HuffmanEncoder::Encode(input, encoded, options);
+				auto content = encoded.str();
+
+				std::stringstream encodedInput{content}, decoded;
+				EXPECT_TRUE(HuffmanEncoder::DecodeAndVerify(encodedInput, decoded, HuffmanEncoder::DecodeOptions{}));
+				EXPECT_EQ(decoded.str(), source);
+				std::ofstream{encodedFile, std::ios::out | std::ios::binary} << content;
+				EXPECT_TRUE(HuffmanEncoder::DecodeAndVerify(encodedFile, decodedFile, HuffmanEncoder::DecodeOptions{}));
+				EXPECT_EQ(readFile(decodedFile), source);
+				EXPECT_TRUE(codec.DecodeAndVerify(encodedFile, decodedFile));
+
+				if (Digest::Algorithm::None == algorithm)
+				{
+					continue;
+				}
+				// A damaged digest decodes, but doesn't verify.
+				const auto digestPos = isFramed
+					                       ? content.size() - 1
+					                       : offsetof(HuffmanEncoder::SerializedHuffmanTableMetaData, m_FileHash);
+				content[digestPos] ^= 1;
+				std::stringstream damagedInput{content}, damagedDecoded;
+				EXPECT_FALSE(HuffmanEncoder::DecodeAndVerify(damagedInput, damagedDecoded, HuffmanEncoder::DecodeOptions{}));
+				EXPECT_EQ(damagedDecoded.str(), source);
+				std::ofstream{encodedFile, std::ios::out | std::ios::binary} << content;
+				EXPECT_FALSE(codec.DecodeAndVerify(encodedFile, decodedFile));
+				EXPECT_EQ(readFile(decodedFile), source);
+
+				// Plain decoding through the same workspace is unaffected.
+				std::stringstream plainInput{content}, plainDecoded;
+				EXPECT_EQ(codec.Decode(plainInput, plainDecoded).size(), Digest::Length(algorithm));
+				EXPECT_EQ(plainDecoded.str(), source);
+			}
+		}
+	}
+
+	// Blocks digested as they are decoded, concurrently and across leaves of the tree.
+	std::string largeSource;
+	for (size_t i{}; i < 5 * Digest::kTreeLeafSize / 2; ++i)
+	{
+		largeSource.push_back(static_cast<char>('a' + random() % 13));
+	}
+	for (const auto algorithm : {Digest::Algorithm::Sha256Tree, Digest::Algorithm::XxHash64})
+	{
+		for (size_t blockSize : {size_t{0}, size_t{300000}, 3 * Digest::kTreeLeafSize / 2})
+		{
+			HuffmanEncoder::EncodeOptions options;
+			options.m_DigestAlgorithm = algorithm;
+			options.m_BlockSize       = blockSize;
+			options.m_ThreadCount     = 4;
+			std::stringstream input{largeSource};
+			std::ofstream encoded{encodedFile, std::ios::out | std::ios::binary};
+			HuffmanEncoder::Encode(input, encoded, options);
+			encoded.close();
+
+			HuffmanEncoder::DecodeOptions decodeOptions;
+			decodeOptions.m_ThreadCount = 4;
+			EXPECT_TRUE(HuffmanEncoder::DecodeAndVerify(encodedFile, decodedFile, decodeOptions));
+			EXPECT_EQ(readFile(decodedFile), largeSource);
+		}
+	}
+	std::filesystem::remove(encodedFile);
+	std::filesystem::remove(decodedFile);
+}
+
+TEST(GeneralTest, BlockChecksumTest)
+{
+	std::string source;
+	std::mt19937 random{31};
+	for (size_t i{}; i < 38000; ++i)
+	{
+		source.push_back(static_cast<char>('a' + random() % 17));
+	}
+	HuffmanEncoder::EncodeOptions options;
+	options.m_BlockSize     = 5000;
+	options.m_BlockChecksum = true;
+	options.m_ThreadCount   = 4;
+
+	// Streams and buffers write the same file.
+	std::stringstream input{source}, encoded;
+	HuffmanEncoder::Encode(input, encoded, options);
+	auto content      = encoded.str();
+	const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+	std::vector<uint8_t> buffer(static_cast<size_t>(HuffmanEncoder::EncodeBound(source.size(), options)));
+	buffer.resize(HuffmanEncoder::EncodeBuffer(first, source.size(), buffer.data(), buffer.size(), options));
+	EXPECT_EQ(std::string(buffer.begin(), buffer.end()), content);
+
+	HuffmanEncoder::DecodeOptions decodeOptions;
+	decodeOptions.m_ThreadCount = 4;
+	std::stringstream encodedInput{content}, decoded;
+	HuffmanEncoder::Decode(encodedInput, decoded, decodeOptions);
+	EXPECT_EQ(decoded.str(), source);
+
+	// Damage the checksum of block 2 and the payload of the last block.
+	HuffmanEncoder::SerializedHuffmanTableMetaData metaData{};
+	std::copy_n(content.data(), sizeof(metaData), reinterpret_cast<char*>(&metaData));
+	EXPECT_TRUE(metaData.m_Flags & HuffmanEncoder::kBlockChecksumFlag);
+	const size_t blockCount  = 8;
+	const size_t indexPos    = sizeof(metaData) + static_cast<size_t>(metaData.m_TableLength)
+	                           + sizeof(HuffmanEncoder::SerializedBlockIndexHeader);
+	const size_t checksumPos = indexPos + blockCount * sizeof(HuffmanEncoder::SerializedBlockIndexItem);
+	const size_t payloadPos  = checksumPos + blockCount * sizeof(uint32_t);
+	HuffmanEncoder::SerializedBlockIndexItem lastItem{};
+	std::copy_n(content.data() + checksumPos - sizeof(lastItem), sizeof(lastItem), reinterpret_cast<char*>(&lastItem));
+	content[checksumPos + 2 * sizeof(uint32_t)] ^= 1;
+	content[payloadPos + static_cast<size_t>(lastItem.m_Offset)] ^= 4;
+	auto expected = source;
+	std::fill_n(expected.begin() + 10000, 5000, '\0');
+	std::fill_n(expected.begin() + 35000, 3000, '\0');
+	const std::vector<std::pair<uint64_t, uint64_t>> expectedRanges{{10000, 5000}, {35000, 3000}};
+
+	// The first damaged block fails the decode.
+	std::stringstream damagedInput{content}, damagedDecoded;
+	EXPECT_THROW(HuffmanEncoder::Decode(damagedInput, damagedDecoded, decodeOptions), std::runtime_error);
+	const auto* damagedFirst = reinterpret_cast<const uint8_t*>(content.data());
+	std::vector<uint8_t> output(source.size());
+	EXPECT_THROW(HuffmanEncoder::DecodeBuffer(damagedFirst, content.size(), output.data(), output.size(), decodeOptions),
+	             std::runtime_error);
+	HuffmanDecoder decoder;
+	std::vector<uint8_t> pushed;
+	EXPECT_THROW(decoder.Push(damagedFirst, content.size(), pushed), std::runtime_error);
+	EXPECT_EQ(pushed.size(), 15000);
+
+	// Or damaged blocks are skipped and reported.
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;
+	decodeOptions.m_OnDamagedBlock = [&ranges](uint64_t offset, uint64_t length) { ranges.emplace_back(offset, length); };
+	std::stringstream skippedInput{content}, skippedDecoded;
+	HuffmanEncoder::Decode(skippedInput, skippedDecoded, decodeOptions);
+	EXPECT_EQ(skippedDecoded.str(), expected);
+	EXPECT_EQ(ranges, expectedRanges);
+
+	ranges.clear();
+	auto [length, digest] =
+		HuffmanEncoder::DecodeBuffer(damagedFirst, content.size(), output.data(), output.size(), decodeOptions);
+	EXPECT_EQ(length, source.size());
+	EXPECT_EQ(std::string(output.begin(), output.end()), expected);
+	EXPECT_EQ(ranges, expectedRanges);
+
+	// Without checksums, a last block decoding short of the recorded length is damaged too.
+	HuffmanEncoder::EncodeOptions plainOptions;
+	plainOptions.m_BlockSize = 1000;
+	std::stringstream plainInput{source.substr(0, 20000)}, plainEncoded;
+	HuffmanEncoder::Encode(plainInput, plainEncoded, plainOptions);
+	auto shortened = plainEncoded.str();
+	std::copy_n(shortened.data(), sizeof(metaData), reinterpret_cast<char*>(&metaData));
+	EXPECT_FALSE(metaData.m_Flags & HuffmanEncoder::kBlockChecksumFlag);
+	const size_t lastItemPos = sizeof(metaData) + static_cast<size_t>(metaData.m_TableLength)
+	                           + sizeof(HuffmanEncoder::SerializedBlockIndexHeader)
+	                           + 19 * sizeof(HuffmanEncoder::SerializedBlockIndexItem);
+	std::copy_n(shortened.data() + lastItemPos, sizeof(lastItem), reinterpret_cast<char*>(&lastItem));
+	lastItem.m_BitLength -= 64;
+	std::copy_n(reinterpret_cast<const char*>(&lastItem), sizeof(lastItem), shortened.data() + lastItemPos);
+
+	decodeOptions.m_OnDamagedBlock = nullptr;
+	std::stringstream shortenedInput{shortened}, shortenedDecoded;
+	EXPECT_THROW(HuffmanEncoder::Decode(shortenedInput, shortenedDecoded, decodeOptions), std::runtime_error);
+	ranges.clear();
+	decodeOptions.m_OnDamagedBlock = [&ranges](uint64_t offset, uint64_t length) { ranges.emplace_back(offset, length); };
+	std::stringstream skippedShortenedInput{shortened}, skippedShortenedDecoded;
+	HuffmanEncoder::Decode(skippedShortenedInput, skippedShortenedDecoded, decodeOptions);
+	EXPECT_EQ(skippedShortenedDecoded.str().size(), 20000);
+	EXPECT_EQ(ranges, (std::vector<std::pair<uint64_t, uint64_t>>{{19000, 1000}}));
+	ranges.clear();
+	const auto* shortenedFirst = reinterpret_cast<const uint8_t*>(shortened.data());
+	HuffmanEncoder::DecodeBuffer(shortenedFirst, shortened.size(), output.data(), output.size(), decodeOptions);
+	EXPECT_EQ(ranges, (std::vector<std::pair<uint64_t, uint64_t>>{{19000, 1000}}));
+}
+
+TEST(GeneralTest, StatsTest)
+{
+	std::string source;
+	std::mt19937 random{41};
+	for (size_t i{}; i < 80000; ++i)
+	{
+		source.push_back(static_cast<char>(random() % 3 ? 'a' + random() % 5 : random() % 256));
+	}
+	const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+	const std::string sourceFile{"stats.test"}, encodedFile{sourceFile + ".huff"}, decodedFile{sourceFile + ".decode"};
+	std::ofstream{sourceFile, std::ios::out | std::ios::binary} << source;
+
+	const auto expectConsistent = [](const HuffmanEncoder::CodecStats& stats)
+	{
+		EXPECT_GE(stats.m_TotalTime,
+		          stats.m_FrequencyAndHashTime + stats.m_TreeBuildTime + stats.m_TableSerializeTime
+		          + stats.m_PayloadTime + stats.m_FlushTime);
+		EXPECT_GT(stats.m_PayloadTime.count(), 0);
+		EXPECT_GT(stats.m_SymbolCount, 5);
+	};
+
+	for (size_t blockSize : {0, 9000})
+	{
+		HuffmanEncoder::CodecStats encodeStats, decodeStats;
+		HuffmanEncoder::EncodeOptions encodeOptions;
+		encodeOptions.m_BlockSize = blockSize;
+		encodeOptions.m_Stats     = &encodeStats;
+		HuffmanEncoder::DecodeOptions decodeOptions;
+		decodeOptions.m_Stats = &decodeStats;
+
+		// Streams.
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, encodeOptions);
+		expectConsistent(encodeStats);
+		EXPECT_GT(encodeStats.m_FrequencyAndHashTime.count(), 0);
+		EXPECT_EQ(encodeStats.m_BytesIn, source.size());
+		EXPECT_EQ(encodeStats.m_BytesOut, encoded.str().size());
+		EXPECT_GT(encodeStats.m_Entropy, 0.0);
+		EXPECT_GE(encodeStats.m_AverageCodeLength, encodeStats.m_Entropy);
+		EXPECT_LT(encodeStats.m_AverageCodeLength, encodeStats.m_Entropy + 1);
+
+		HuffmanEncoder::Decode(encoded, decoded, decodeOptions);
+		expectConsistent(decodeStats);
+		EXPECT_EQ(decodeStats.m_BytesIn, encodeStats.m_BytesOut);
+		EXPECT_EQ(decodeStats.m_BytesOut, source.size());
+		EXPECT_EQ(decodeStats.m_SymbolCount, encodeStats.m_SymbolCount);
+		EXPECT_DOUBLE_EQ(decodeStats.m_AverageCodeLength, encodeStats.m_AverageCodeLength);
+		EXPECT_EQ(decodeStats.m_FrequencyAndHashTime.count(), 0);
+
+		// Buffers, and stats are cleared between calls.
+		const auto streamStats = encodeStats;
+		std::vector<uint8_t> buffer(static_cast<size_t>(HuffmanEncoder::EncodeBound(source.size(), encodeOptions)));
+		buffer.resize(HuffmanEncoder::EncodeBuffer(first, source.size(), buffer.data(), buffer.size(), encodeOptions));
+		expectConsistent(encodeStats);
+		EXPECT_EQ(encodeStats.m_BytesOut, buffer.size());
+		EXPECT_EQ(encodeStats.m_BytesOut, streamStats.m_BytesOut);
+		EXPECT_DOUBLE_EQ(encodeStats.m_Entropy, streamStats.m_Entropy);
+
+		std::vector<uint8_t> output(source.size());
+		HuffmanEncoder::DecodeBuffer(buffer.data(), buffer.size(), output.data(), output.size(), decodeOptions);
+		expectConsistent(decodeStats);
+		EXPECT_EQ(decodeStats.m_BytesIn, buffer.size());
+		EXPECT_EQ(decodeStats.m_BytesOut, source.size());
+
+		// Files.
+		HuffmanEncoder::Encode(sourceFile, encodedFile, encodeOptions);
+		expectConsistent(encodeStats);
+		EXPECT_EQ(encodeStats.m_BytesOut, std::filesystem::file_size(encodedFile));
+		EXPECT_TRUE(HuffmanEncoder::DecodeAndVerify(encodedFile, decodedFile, decodeOptions));
+		expectConsistent(decodeStats);
+		EXPECT_EQ(decodeStats.m_BytesIn, std::filesystem::file_size(encodedFile));
+		EXPECT_EQ(decodeStats.m_BytesOut, source.size());
+	}
+
+	// Framed streams add up their frames.
+	HuffmanEncoder::CodecStats encodeStats, decodeStats;
+	HuffmanEncoder::EncodeOptions encodeOptions;
+	encodeOptions.m_BlockSize = 10000;
+	encodeOptions.m_Stats     = &encodeStats;
+	std::stringstream input{source}, framed, decoded;
+	HuffmanEncoder::EncodeStream(input, framed, encodeOptions);
+	expectConsistent(encodeStats);
+	EXPECT_EQ(encodeStats.m_BytesIn, source.size());
+	EXPECT_EQ(encodeStats.m_BytesOut, framed.str().size());
+	EXPECT_GE(encodeStats.m_AverageCodeLength, encodeStats.m_Entropy);
+
+	HuffmanEncoder::DecodeOptions decodeOptions;
+	decodeOptions.m_Stats = &decodeStats;
+	HuffmanEncoder::Decode(framed, decoded, decodeOptions);
+	expectConsistent(decodeStats);
+	EXPECT_EQ(decodeStats.m_BytesIn, framed.str().size());
+	EXPECT_EQ(decodeStats.m_BytesOut, source.size());
+	EXPECT_EQ(decodeStats.m_SymbolCount, encodeStats.m_SymbolCount);
+
+	std::filesystem::remove(sourceFile);
+	std::filesystem::remove(encodedFile);
+	std::filesystem::remove(decodedFile);
+}
+
+TEST(GeneralTest, ProgressTest)
+{
+	std::string source;
+	std::mt19937 random{43};
+	for (size_t i{}; i < 80000; ++i)
+	{
+		source.push_back(static_cast<char>(random() % 3 ? 'a' + random() % 5 : random() % 256));
+	}
+	const auto* first = reinterpret_cast<const uint8_t*>(source.data());
+	const std::string sourceFile{"progress.test"}, encodedFile{sourceFile + ".huff"}, decodedFile{sourceFile + ".decode"};
+	std::ofstream{sourceFile, std::ios::out | std::ios::binary} << source;
+
+	// Every call reports growing bytes done, up to the bytes to do.
+	std::vector<std::pair<uint64_t, uint64_t>> reports;
+	const auto expectDone = [&reports](const uint64_t total)
+	{
+		EXPECT_FALSE(reports.empty());
+		for (size_t i{1}; i < reports.size(); ++i)
+		{
+			EXPECT_GT(reports[i].first, reports[i - 1].first);
+			EXPECT_EQ(reports[i].second, reports[0].second);
+		}
+		EXPECT_EQ(reports.empty() ? 0 : reports.back().first, total);
+		reports.clear();
+	};
+	const auto onProgress = [&reports](const uint64_t done, const uint64_t total) { reports.emplace_back(done, total); };
+
+	for (size_t blockSize : {0, 9000})
+	{
+		HuffmanEncoder::EncodeOptions encodeOptions;
+		encodeOptions.m_BlockSize        = blockSize;
+		encodeOptions.m_ThreadCount      = 4;
+		encodeOptions.m_OnProgress       = onProgress;
+		encodeOptions.m_ProgressInterval = 4096;
+		HuffmanEncoder::DecodeOptions decodeOptions;
+		decodeOptions.m_ThreadCount      = 4;
+		decodeOptions.m_OnProgress       = onProgress;
+		decodeOptions.m_ProgressInterval = 4096;
+
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded, encodeOptions);
+		expectDone(2 * source.size());
+		HuffmanEncoder::Decode(encoded, decoded, decodeOptions);
+		expectDone(encoded.str().size());
+
+		std::vector<uint8_t> buffer(static_cast<size_t>(HuffmanEncoder::EncodeBound(source.size(), encodeOptions)));
+		buffer.resize(HuffmanEncoder::EncodeBuffer(first, source.size(), buffer.data(), buffer.size(), encodeOptions));
+		expectDone(2 * source.size());
+		std::vector<uint8_t> output(source.size());
+		HuffmanEncoder::DecodeBuffer(buffer.data(), buffer.size(), output.data(), output.size(), decodeOptions);
+		expectDone(buffer.size());
+
+		HuffmanEncoder::Encode(sourceFile, encodedFile, encodeOptions);
+		expectDone(2 * source.size());
+		EXPECT_TRUE(HuffmanEncoder::DecodeAndVerify(encodedFile, decodedFile, decodeOptions));
+		expectDone(std::filesystem::file_size(encodedFile));
+	}
+
+	// Framed streams aren't read in advance, their bytes to do are unknown.
+	HuffmanEncoder::EncodeOptions encodeOptions;
+	encodeOptions.m_BlockSize        = 10000;
+	encodeOptions.m_OnProgress       = onProgress;
+	encodeOptions.m_ProgressInterval = 4096;
+	std::stringstream input{source}, framed;
+	HuffmanEncoder::EncodeStream(input, framed, encodeOptions);
+	EXPECT_EQ(reports.back().second, 0);
+	expectDone(source.size());
+
+	// Cancelled from the callback, as soon as anything is reported.
+	std::atomic<bool> isCancelled{false};
+	const auto cancel = [&isCancelled](uint64_t, uint64_t) { isCancelled = true; };
+	for (size_t blockSize : {0, 9000})
+	{
+		HuffmanEncoder::EncodeOptions cancelEncodeOptions;
+		cancelEncodeOptions.m_BlockSize        = blockSize;
+		cancelEncodeOptions.m_ThreadCount      = 4;
+		cancelEncodeOptions.m_OnProgress       = cancel;
+		cancelEncodeOptions.m_ProgressInterval = 1;
+		cancelEncodeOptions.m_Cancellation     = &isCancelled;
+		HuffmanEncoder::DecodeOptions cancelDecodeOptions;
+		cancelDecodeOptions.m_ThreadCount      = 4;
+		cancelDecodeOptions.m_OnProgress       = cancel;
+		cancelDecodeOptions.m_ProgressInterval = 1;
+		cancelDecodeOptions.m_Cancellation     = &isCancelled;
+
+		std::stringstream cancelInput{source}, encoded, decoded;
+		EXPECT_THROW(HuffmanEncoder::Encode(cancelInput, encoded, cancelEncodeOptions), HuffmanEncoder::CancelledError);
+		isCancelled = false;
+		std::vector<uint8_t> buffer(static_cast<size_t>(HuffmanEncoder::EncodeBound(source.size(), cancelEncodeOptions)));
+		EXPECT_THROW(HuffmanEncoder::EncodeBuffer(first, source.size(), buffer.data(), buffer.size(), cancelEncodeOptions),
+		             HuffmanEncoder::CancelledError);
+		isCancelled = false;
+		EXPECT_THROW(HuffmanEncoder::Encode(sourceFile, encodedFile, cancelEncodeOptions), HuffmanEncoder::CancelledError);
+		isCancelled = false;
+
+		HuffmanEncoder::EncodeOptions options;
+		options.m_BlockSize = blockSize;
+		HuffmanEncoder::Encode(sourceFile, encodedFile, options);
+		std::ifstream encodedInput{encodedFile, std::ios::in | std::ios::binary};
+		EXPECT_THROW(HuffmanEncoder::Decode(encodedInput, decoded, cancelDecodeOptions), HuffmanEncoder::CancelledError);
+		isCancelled = false;
+		EXPECT_THROW(HuffmanEncoder::Decode(encodedFile, decodedFile, cancelDecodeOptions), HuffmanEncoder::CancelledError);
+		isCancelled = false;
+	}
+
+	std::filesystem::remove(sourceFile);
+	std::filesystem::remove(encodedFile);
+	std::filesystem::remove(decodedFile);
+}
+
+TEST(GeneralTest, BatchSchedulerTest)
+{
+	// Largest jobs first, equal ones in their order.
+	const std::vector<uint64_t> memory{3, 10, 1, 7, 3, 20};
+	EXPECT_EQ(BatchScheduler::Order(memory), (std::vector<size_t>{5, 1, 3, 0, 4, 2}));
+
+	std::mutex mutex;
+	std::vector<size_t> started;
+	BatchScheduler::Options options;
+	options.m_WorkerCount = 1;
+	BatchScheduler::Run(memory, options, [&](const size_t index)
+	{
+		std::lock_guard<std::mutex> lock{mutex};
+		started.push_back(index);
+	});
+	EXPECT_EQ(started, BatchScheduler::Order(memory));
+
+	// Jobs in flight stay within the budget, but for the job larger than it, which runs alone.
+	options.m_WorkerCount  = 4;
+	options.m_MemoryBudget = 12;
+	uint64_t memoryInFlight{};
+	size_t jobsInFlight{}, maxJobsInFlight{};
+	bool isWithinBudget{true};
+	std::vector<uint64_t> manyMemory(40, 3);
+	manyMemory.push_back(20);
+	std::atomic<size_t> runCount{};
+	BatchScheduler::Run(manyMemory, options, [&](const size_t index)
+	{
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			memoryInFlight += manyMemory[index];
+			++jobsInFlight;
+			maxJobsInFlight = (std::max)(maxJobsInFlight, jobsInFlight);
+			isWithinBudget  = isWithinBudget
+			                  && (memoryInFlight <= options.m_MemoryBudget || (20 == memoryInFlight && 1 == jobsInFlight));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		std::lock_guard<std::mutex> lock{mutex};
+		memoryInFlight -= manyMemory[index];
+		--jobsInFlight;
+		++runCount;
+	});
+	EXPECT_EQ(runCount, manyMemory.size());
+	EXPECT_TRUE(isWithinBudget);
+	EXPECT_GT(maxJobsInFlight, 1);
+	EXPECT_LE(maxJobsInFlight, options.m_WorkerCount);
+
+	// Cancelled jobs are skipped, and the exception of a job is rethrown once the others are done.
+	std::atomic<bool> isCancelled{false};
+	options.m_Cancellation = &isCancelled;
+	options.m_MemoryBudget = 0;
+	runCount               = 0;
+	BatchScheduler::Run(manyMemory, options, [&](size_t)
+	{
+		++runCount;
+		isCancelled = true;
+	});
+	EXPECT_GE(runCount, 1);
+	EXPECT_LE(runCount, options.m_WorkerCount);
+
+	options.m_Cancellation = nullptr;
+	runCount               = 0;
+	EXPECT_THROW(BatchScheduler::Run(manyMemory, options, [&](const size_t index)
+	{
+		++runCount;
+		if (0 == index)
+		{
+			throw std::runtime_error("Failed job");
+		}
+	}), std::runtime_error);
+	EXPECT_EQ(runCount, manyMemory.size());
+}
+
+TEST(GeneralTest, RingQueueTest)
+{
+	EXPECT_THROW(RingQueue<int>(6), std::invalid_argument);
+
+	// Full and empty rings refuse without blocking, elements come out in order.
+	RingQueue<int> queue(4);
+	for (int i{}; i < 4; ++i)
+	{
+		EXPECT_TRUE(queue.TryPush(i));
+	}
+	EXPECT_FALSE(queue.TryPush(4));
+	EXPECT_EQ(queue.Size(), 4);
+	int value{};
+	for (int i{}; i < 4; ++i)
+	{
+		EXPECT_TRUE(queue.TryPop(value));
+		EXPECT_EQ(value, i);
+	}
+	EXPECT_FALSE(queue.TryPop(value));
+	EXPECT_TRUE(queue.Empty());
+
+	// Lvalues are copied, rvalues moved, and a refused push leaves its element alone.
+	RingQueue<std::string> stringQueue(2);
+	std::string copied{"copied"}, moved{"moved"}, refused{"refused"}, popped;
+	EXPECT_TRUE(stringQueue.TryPush(copied));
+	EXPECT_EQ(copied, "copied");
+	EXPECT_TRUE(stringQueue.TryPush(std::move(moved)));
+	EXPECT_FALSE(stringQueue.TryPush(std::move(refused)));
+	EXPECT_EQ(refused, "refused");
+	EXPECT_TRUE(stringQueue.TryPop(popped));
+	EXPECT_EQ(popped, "copied");
+	EXPECT_TRUE(stringQueue.TryPop(popped));
+	EXPECT_EQ(popped, "moved");
+
+	// Every element pushed by the producers is popped once by the consumers, through a ring much smaller than them.
+	constexpr int kProducerCount = 4, kConsumerCount = 4, kPerProducer = 20000;
+	RingQueue<int> smallQueue(8);
+	std::vector<std::thread> threads;
+	std::atomic<int64_t> poppedSum{};
+	std::atomic<int> poppedCount{};
+	for (int consumer{}; consumer < kConsumerCount; ++consumer)
+	{
+		threads.emplace_back([&]()
+		{
+			int popped{};
+			while (smallQueue.Pop(popped))
+			{
+				poppedSum += popped;
+				++poppedCount;
+			}
+		});
+	}
+	std::vector<std::thread> producers;
+	for (int producer{}; producer < kProducerCount; ++producer)
+	{
+		producers.emplace_back([&, producer]()
+		{
+			for (int i{}; i < kPerProducer; ++i)
+			{
+				EXPECT_TRUE(smallQueue.Push(producer * kPerProducer + i));
+			}
+		});
+	}
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+	// Pops drain what is left after Close, then report the end.
+	smallQueue.Close();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	constexpr int64_t kTotal = int64_t{kProducerCount} * kPerProducer;
+	EXPECT_EQ(poppedCount, kTotal);
+	EXPECT_EQ(poppedSum, kTotal * (kTotal - 1) / 2);
+	EXPECT_FALSE(smallQueue.Push(0));
+
+	// Cancel wakes a blocked pop.
+	RingQueue<int> cancelledQueue(2);
+	std::atomic<bool> isPopped{true};
+	std::thread consumer([&]()
+	{
+		int popped{};
+		isPopped = cancelledQueue.Pop(popped);
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	cancelledQueue.Cancel();
+	consumer.join();
+	EXPECT_FALSE(isPopped);
+	EXPECT_FALSE(cancelledQueue.TryPush(1));
+	EXPECT_FALSE(cancelledQueue.Pop(value));
+
+	// And abandons the elements left.
+	RingQueue<int> abandonedQueue(2);
+	EXPECT_TRUE(abandonedQueue.TryPush(1));
+	abandonedQueue.Cancel();
+	EXPECT_FALSE(abandonedQueue.TryPop(value));
+	EXPECT_FALSE(abandonedQueue.Pop(value));
+}
+
 TEST(GeneralTest, BitCollectorTest)
 {
 	std::vector<uint8_t> buffer;
@@ -118,3 +1656,77 @@ TEST(GeneralTest, BitCollectorTest)
 	EXPECT_EQ(buffer[2], 15);
 	EXPECT_EQ(buffer[3], 0);
 }
+
+
+TEST(GeneralTest, EncodeTableTest)
+{
+	HuffmanEncoder::FrequencyContainer freq;
+	freq['a'] = 19;
+	freq['b'] = 21;
+	freq['c'] = 2;
+	freq['h'] = 32;
+	auto huffmanTable = HuffmanEncoder::GenerateTreeFromFrequency(freq);
+	auto encodeTable  = HuffmanEncoder::BuildEncodeTable(huffmanTable);
+
+	for (size_t i{}; i < encodeTable.size(); ++i)
+	{
+		auto it = huffmanTable.find(static_cast<char>(i));
+		if (it == huffmanTable.end())
+		{
+			EXPECT_EQ(encodeTable[i].m_BitLength, 0);
+			continue;
+		}
+		EXPECT_EQ(encodeTable[i].m_BitLength, std::get<0>(it->second));
+		EXPECT_EQ(encodeTable[i].m_Encode, std::get<1>(it->second));
+	}
+
+	// Sources with zero or one distinct character.
+	for (const auto& source : {std::string{}, std::string(1000, 'x')})
+	{
+		std::stringstream input{source}, encoded, decoded;
+		HuffmanEncoder::Encode(input, encoded);
+		HuffmanEncoder::Decode(encoded, decoded);
+		EXPECT_EQ(decoded.str(), source);
+	}
+}
+
+TEST(GeneralTest, BitWriterTest)
+{
+	std::vector<uint8_t> buffer;
+	std::vector<uint8_t> expected;
+	BitWriter writer(buffer);
+	BitCollector collector(expected);
+
+	std::mt19937 random{7};
+	for (size_t i{}; i < 1000; ++i)
+	{
+		const auto bitLength = 1 + random() % 32;
+		const auto value     = static_cast<uint32_t>(random() & (bitLength == 32 ? ~0u : (1u << bitLength) - 1));
+		writer.Push(value, bitLength);
+		collector.Push(value, 0, bitLength);
+	}
+	writer.Flush();
+
+	EXPECT_EQ(buffer, expected);
+	EXPECT_EQ(writer.Unpacked(), collector.Unpacked());
+	EXPECT_EQ(writer.RedundancyBit(), collector.RedundancyBit());
+
+	// Writing into memory gives the same bytes, and stops at the end of memory.
+	std::vector<uint8_t> memory(buffer.size());
+	BitWriter memoryWriter(memory.data(), memory.data() + memory.size());
+	random.seed(7);
+	for (size_t i{}; i < 1000; ++i)
+	{
+		const auto bitLength = 1 + random() % 32;
+		const auto value     = static_cast<uint32_t>(random() & (bitLength == 32 ? ~0u : (1u << bitLength) - 1));
+		memoryWriter.Push(value, bitLength);
+	}
+	memoryWriter.Flush();
+	EXPECT_EQ(memory, buffer);
+	EXPECT_THROW(
+		{
+			memoryWriter.Push(0, 32);
+			memoryWriter.Push(0, 32);
+		},
+		std::out_of_range);
+}